@@ -0,0 +1,71 @@
+#include "compression.h"
+
+#include <stdexcept>
+
+namespace compression {
+
+namespace {
+
+// 15 bits of window plus 16 selects the gzip wrapper instead of zlib
+constexpr int GZIP_WINDOW_BITS = 15 + 16;
+constexpr int MEMORY_LEVEL = 8;
+
+}  // namespace
+
+GzipCompressor::GzipCompressor(int level) {
+    if (deflateInit2(&stream_, level, Z_DEFLATED, GZIP_WINDOW_BITS, MEMORY_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw std::runtime_error("Failed to initialize gzip compressor");
+    }
+}
+
+GzipCompressor::~GzipCompressor() {
+    deflateEnd(&stream_);
+}
+
+GzipCompressor& GzipCompressor::ForThisThread() {
+    thread_local GzipCompressor compressor;
+    return compressor;
+}
+
+void GzipCompressor::Reset() {
+    deflateReset(&stream_);
+}
+
+size_t GzipCompressor::Bound(size_t size) {
+    return deflateBound(&stream_, size);
+}
+
+size_t GzipCompressor::Deflate(std::string_view data, char* out, size_t out_size) {
+    stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream_.avail_in = data.size();
+    stream_.next_out = reinterpret_cast<Bytef*>(out);
+    stream_.avail_out = out_size;
+    if (deflate(&stream_, Z_FINISH) != Z_STREAM_END) {
+        throw std::runtime_error("Failed to gzip data");
+    }
+    return out_size - stream_.avail_out;
+}
+
+bool Decompress(std::string_view data, std::string& out) {
+    z_stream stream{};
+    if (inflateInit2(&stream, GZIP_WINDOW_BITS) != Z_OK) {
+        return false;
+    }
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream.avail_in = data.size();
+    out.clear();
+    int result = Z_OK;
+    while (result == Z_OK) {
+        constexpr size_t CHUNK_SIZE = 16384;
+        auto size = out.size();
+        out.resize(size + CHUNK_SIZE);
+        stream.next_out = reinterpret_cast<Bytef*>(out.data() + size);
+        stream.avail_out = CHUNK_SIZE;
+        result = inflate(&stream, Z_NO_FLUSH);
+        out.resize(size + CHUNK_SIZE - stream.avail_out);
+    }
+    inflateEnd(&stream);
+    return result == Z_STREAM_END && stream.avail_in == 0;
+}
+
+}  // namespace compression
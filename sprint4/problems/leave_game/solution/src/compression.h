@@ -0,0 +1,46 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <zlib.h>
+
+namespace compression {
+
+/*
+ *  Сжатие в формат gzip (Content-Encoding: gzip).
+ *  Контекст deflate создаётся один раз и сбрасывается перед каждым телом,
+ *  поэтому повторное сжатие не выделяет память под внутренние таблицы zlib.
+ *  Объект не потокобезопасен, для сжатия из разных потоков есть ForThisThread().
+ */
+class GzipCompressor {
+public:
+    explicit GzipCompressor(int level = Z_DEFAULT_COMPRESSION);
+    ~GzipCompressor();
+
+    GzipCompressor(const GzipCompressor&) = delete;
+    GzipCompressor& operator=(const GzipCompressor&) = delete;
+
+    static GzipCompressor& ForThisThread();
+
+    //Appends the whole gzip stream of data to a contiguous buffer such as beast::flat_buffer
+    template <typename DynamicBuffer>
+    void Compress(std::string_view data, DynamicBuffer& buffer) {
+        Reset();
+        auto out = buffer.prepare(Bound(data.size()));
+        auto written = Deflate(data, static_cast<char*>(out.data()), out.size());
+        buffer.commit(written);
+    }
+
+private:
+    z_stream stream_{};
+
+    void Reset();
+    size_t Bound(size_t size);
+    //out has room for Bound() bytes, so one call finishes the stream
+    size_t Deflate(std::string_view data, char* out, size_t out_size);
+};
+
+//Used by tests and tools, false if data is not a complete gzip stream
+bool Decompress(std::string_view data, std::string& out);
+
+}  // namespace compression
@@ -1,4 +1,5 @@
 #include "db.h"
+#include "trace.h"
 
 namespace database {
     void InitializeDB(std::shared_ptr<ConnectionPool> pool) {
@@ -25,6 +26,7 @@ CREATE INDEX IF NOT EXISTS name_idx ON retired_players (name);
     }
 
     std::vector<StatInfo> StatProvider::GetStats(int start_id, int max_items) const {
+        trace::Span span{ "db", "get stats" };
         auto conn = pool_->GetConnection();
         pqxx::work work{ *conn };
         std::vector<StatInfo> stats;
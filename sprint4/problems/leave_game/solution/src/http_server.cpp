@@ -1,6 +1,8 @@
 #include "http_server.h"
 
+#include <algorithm>
 #include <iostream>
+#include <span>
 
 #include <boost/json.hpp>
 #include <boost/log/trivial.hpp>
@@ -23,49 +25,382 @@ void ReportError(beast::error_code ec, std::string_view where) {
     BOOST_LOG_TRIVIAL(error) << boost::log::add_value(error_data, data) << "error";
 }
 
-SessionBase::SessionBase(tcp::socket&& socket)
-    : address_(socket.remote_endpoint().address()), stream_(std::move(socket)) {
+std::optional<ConnectionGovernor::Ticket> ConnectionGovernor::TryAdmit(const net::ip::address& address) {
+    std::lock_guard lock{ mutex_ };
+    if (active_ >= limits_.max_sessions) {
+        ++counters_.sessions_rejected;
+        return std::nullopt;
+    }
+    if (limits_.max_sessions_per_ip != 0) {
+        auto& count = per_ip_[address];
+        if (count >= limits_.max_sessions_per_ip) {
+            ++counters_.sessions_rejected;
+            ++counters_.sessions_rejected_per_ip;
+            return std::nullopt;
+        }
+        ++count;
+    }
+    ++active_;
+    ++counters_.sessions_accepted;
+    return Ticket(shared_from_this(), address);
+}
+
+void ConnectionGovernor::Release(const net::ip::address& address) {
+    std::lock_guard lock{ mutex_ };
+    --active_;
+    if (limits_.max_sessions_per_ip != 0) {
+        auto it = per_ip_.find(address);
+        if (it != per_ip_.end() && --it->second == 0) {
+            per_ip_.erase(it);
+        }
+    }
+}
+
+void RejectConnection(SessionSocket&& socket) {
+    static constexpr std::string_view RESPONSE =
+        "HTTP/1.1 503 Service Unavailable\r\n"
+        "Content-Type: application/json\r\n"
+        "Content-Length: 67\r\n"
+        "Retry-After: 1\r\n"
+        "Connection: close\r\n"
+        "\r\n"
+        R"({ "code": "serviceUnavailable", "message": "Too many connections" })"sv;
+    struct Rejected {
+        SessionStream stream;
+        std::array<char, 1024> discard;
+    };
+    auto rejected = std::make_shared<Rejected>(SessionStream(std::move(socket)));
+    // Клиенту, который не читает ответ, хватит короткого таймаута
+    rejected->stream.expires_after(1s);
+    net::async_write(rejected->stream, net::buffer(RESPONSE), [rejected](beast::error_code ec, std::size_t) {
+        if (ec) {
+            return;
+        }
+        rejected->stream.socket().shutdown(tcp::socket::shutdown_send, ec);
+        // Закрытие с непрочитанным запросом в буфере сбросило бы соединение раньше, чем клиент прочтёт ответ
+        rejected->stream.async_read_some(net::buffer(rejected->discard), [rejected](beast::error_code, std::size_t) {});
+    });
+}
+
+SessionBase::SessionBase(SessionSocket&& socket, ConnectionGovernor::Ticket&& ticket)
+    : address_(socket.remote_endpoint().address()), stream_(std::move(socket)), ticket_(std::move(ticket)) {
+}
+
+void* RequestArena::Allocate(size_t bytes, size_t alignment) {
+    for (; current_ < blocks_.size(); ++current_, offset_ = 0) {
+        auto& block = blocks_[current_];
+        void* ptr = block.data.get() + offset_;
+        size_t space = block.size - offset_;
+        if (std::align(alignment, bytes, ptr, space)) {
+            offset_ = static_cast<std::byte*>(ptr) - block.data.get() + bytes;
+            return ptr;
+        }
+    }
+    // Новый блок не меньше удвоенного предыдущего, чтобы их число росло логарифмически
+    size_t size = std::max(blocks_.empty() ? INITIAL_BLOCK_SIZE : blocks_.back().size * 2, bytes + alignment);
+    blocks_.push_back({ std::make_unique<std::byte[]>(size), size });
+    current_ = blocks_.size() - 1;
+    void* ptr = blocks_.back().data.get();
+    std::align(alignment, bytes, ptr, size);
+    offset_ = static_cast<std::byte*>(ptr) - blocks_.back().data.get() + bytes;
+    return ptr;
 }
 
 void SessionBase::Read() {
-    using namespace std::literals;
+    // Очередь ответов заполнена: следующий запрос прочитаем после записи головы очереди
+    if (reading_ || read_closed_ || closed_ || read_seq_ - write_seq_ == MAX_PIPELINED) {
+        return;
+    }
     // Очищаем запрос от прежнего значения (метод Read может быть вызван несколько раз)
-    request_ = {};
-    stream_.expires_after(30s);
-    // Считываем request_ из stream_, используя buffer_ для хранения считанных данных
-    http::async_read(stream_, buffer_, request_,
+    parser_.reset();
+    const size_t slot = read_seq_ % MAX_PIPELINED;
+    // Ответ из слота уже записан, но его обработчик может ещё доживать в другом потоке,
+    // тогда арена сбросится при следующем использовании слота
+    if (slots_[slot].handlers == 0) {
+        slots_[slot].arena.Reset();
+    }
+    parser_.emplace(std::piecewise_construct, std::make_tuple(GetAllocator(slot)), std::make_tuple(GetAllocator(slot)));
+    reading_ = true;
+    if (buffer_.size() != 0) {
+        // Следующий запрос уже начал приходить вместе с предыдущим
+        return ReadHeader();
+    }
+    read_phase_ = ReadPhase::IDLE;
+    ArmReadTimeout();
+    stream_.async_read_some(buffer_.prepare(IDLE_READ_SIZE),
+        ArenaBoundHandler(beast::bind_front_handler(&SessionBase::OnIdleRead, GetSharedThis()), GetAllocator(slot)));
+}
+
+void SessionBase::ArmReadTimeout() {
+    const auto& limits = ticket_.GetGovernor().GetLimits();
+    switch (read_phase_) {
+    case ReadPhase::IDLE: stream_.expires_after(limits.idle_timeout); break;
+    case ReadPhase::HEADER: stream_.expires_after(limits.header_timeout); break;
+    case ReadPhase::BODY: stream_.expires_after(limits.body_timeout); break;
+    }
+}
+
+void SessionBase::OnIdleRead(beast::error_code ec, std::size_t bytes_read) {
+    if (ec == net::error::eof) {
+        return OnRead(http::error::end_of_stream, 0);
+    }
+    if (ec) {
+        return OnReadError(ec);
+    }
+    buffer_.commit(bytes_read);
+    ReadHeader();
+}
+
+void SessionBase::ReadHeader() {
+    read_phase_ = ReadPhase::HEADER;
+    ArmReadTimeout();
+    http::async_read_header(stream_, buffer_, *parser_,
+        ArenaBoundHandler(beast::bind_front_handler(&SessionBase::OnReadHeader, GetSharedThis()), GetAllocator(read_seq_ % MAX_PIPELINED)));
+}
+
+void SessionBase::OnReadHeader(beast::error_code ec, [[maybe_unused]] std::size_t bytes_read) {
+    if (ec) {
+        return OnReadError(ec);
+    }
+    if (parser_->is_done()) {
+        return OnRead(ec, 0);
+    }
+    read_phase_ = ReadPhase::BODY;
+    ArmReadTimeout();
+    // Считываем тело из stream_, используя buffer_ для хранения считанных данных
+    http::async_read(stream_, buffer_, *parser_,
         // По окончании операции будет вызван метод OnRead
-        beast::bind_front_handler(&SessionBase::OnRead, GetSharedThis()));
+        ArenaBoundHandler(beast::bind_front_handler(&SessionBase::OnRead, GetSharedThis()), GetAllocator(read_seq_ % MAX_PIPELINED)));
 }
 
-void SessionBase::OnRead(beast::error_code ec, [[maybe_unused]] std::size_t bytes_read) {
+void SessionBase::OnReadError(beast::error_code ec) {
     using namespace std::literals;
+    reading_ = false;
+    read_closed_ = true;
+    if (ec != beast::error::timeout) {
+        return ReportError(ec, "read"sv);
+    }
+    // basic_stream уже закрыл сокет, недописанные ответы пропадут
+    closed_ = true;
+    auto& counters = ticket_.GetGovernor().GetCounters();
+    switch (read_phase_) {
+    case ReadPhase::IDLE:
+        // Простаивающее keep-alive соединение - обычное дело, не ошибка
+        ++counters.idle_timeouts;
+        return;
+    case ReadPhase::HEADER:
+        ++counters.header_timeouts;
+        return ReportError(ec, "read header"sv);
+    case ReadPhase::BODY:
+        ++counters.body_timeouts;
+        return ReportError(ec, "read body"sv);
+    }
+}
+
+void SessionBase::OnRead(beast::error_code ec, [[maybe_unused]] std::size_t bytes_read) {
+    reading_ = false;
     if (ec == http::error::end_of_stream) {
-        // Нормальная ситуация - клиент закрыл соединение
-        return Close();
+        // Нормальная ситуация - клиент закрыл соединение. Закрываем после записи оставшихся ответов
+        read_closed_ = true;
+        if (!writing_ && write_seq_ == read_seq_) {
+            Close();
+        }
+        return;
     }
     if (ec) {
-        return ReportError(ec, "read"sv);
+        return OnReadError(ec);
+    }
+    if (websocket::is_upgrade(parser_->get())) {
+        upgrade_request_.emplace(parser_->get().base());
+        read_closed_ = true;
     }
-    HandleRequest(std::move(request_));
+    const size_t slot = read_seq_++ % MAX_PIPELINED;
+    HandleRequest(slot, parser_->release());
+    // Читаем следующий запрос, не дожидаясь ответа на этот
+    Read();
+}
+
+void SessionBase::OnResponse(size_t slot, std::shared_ptr<PendingResponse>&& response) {
+    slots_[slot].response = std::move(response);
+    Flush();
+}
+
+void SessionBase::Upgrade(WebSocketSession::OpenHandler&& on_open) {
+    net::dispatch(stream_.get_executor(), [self = GetSharedThis(), on_open = std::move(on_open)]() mutable {
+        self->on_upgrade_ = std::move(on_open);
+        self->Flush();
+    });
+}
+
+void SessionBase::Flush() {
+    if (writing_ || closed_) {
+        return;
+    }
+    // Запрос на апгрейд последний из прочитанных, перед ним всё записано
+    if (on_upgrade_ && upgrade_request_ && write_seq_ + 1 == read_seq_) {
+        closed_ = true;
+        auto session = std::make_shared<WebSocketSession>(std::move(stream_), std::move(ticket_));
+        session->Accept(*upgrade_request_, std::move(*on_upgrade_));
+        return;
+    }
+    gather_.clear();
+    size_t count = 0;
+    for (uint64_t seq = write_seq_; seq != read_seq_; ++seq) {
+        auto& response = slots_[seq % MAX_PIPELINED].response;
+        if (!response) {
+            break;
+        }
+        if (!response->CanGather()) {
+            if (count == 0) {
+                // Файл пишется отдельно, сериализатор читает его кусками
+                writing_ = true;
+                response->AsyncWrite(stream_, ArenaBoundHandler(WriteHandler{ GetSharedThis(), 1 }, GetAllocator(seq % MAX_PIPELINED)));
+                return;
+            }
+            break;
+        }
+        response->Gather(gather_);
+        ++count;
+        if (response->NeedEof()) {
+            // После ответа, закрывающего соединение, ничего не пишем
+            break;
+        }
+    }
+    if (count == 0) {
+        return;
+    }
+    writing_ = true;
+    stream_.expires_after(WRITE_TIMEOUT);
+    // Несколько готовых ответов уходят одной записью. Вектор не копируется в операцию, поэтому передаём span
+    net::async_write(stream_, std::span<const net::const_buffer>(gather_),
+        ArenaBoundHandler(WriteHandler{ GetSharedThis(), count }, GetAllocator(write_seq_ % MAX_PIPELINED)));
+}
+
+void WriteHandler::operator()(beast::error_code ec, std::size_t bytes_written) {
+    session->OnWrite(count, ec, bytes_written);
 }
 
 void SessionBase::Close() {
-    stream_.socket().shutdown(tcp::socket::shutdown_send);
+    closed_ = true;
+    // Клиент мог уже оборвать соединение, это не ошибка
+    beast::error_code ec;
+    stream_.socket().shutdown(tcp::socket::shutdown_send, ec);
 }
 
-void SessionBase::OnWrite(bool close, beast::error_code ec, [[maybe_unused]] std::size_t bytes_written) {
+void SessionBase::OnWrite(size_t count, beast::error_code ec, [[maybe_unused]] std::size_t bytes_written) {
+    writing_ = false;
     if (ec) {
+        closed_ = true;
         return ReportError(ec, "write"sv);
     }
 
-    if (close) {
-        // Семантика ответа требует закрыть соединение
+    bool close = false;
+    for (; count != 0; --count, ++write_seq_) {
+        auto& response = slots_[write_seq_ % MAX_PIPELINED].response;
+        close = close || response->NeedEof();
+        response.reset();
+    }
+
+    if (close || (read_closed_ && write_seq_ == read_seq_)) {
+        // Семантика ответа требует закрыть соединение, либо клиент уже закрыл свою сторону
         return Close();
     }
 
-    // Считываем следующий запрос
+    if (reading_) {
+        // Таймаут у stream_ общий для чтения и записи, возвращаем таймаут текущей фазы чтения
+        ArmReadTimeout();
+    }
+    // В очереди освободилось место
     Read();
+    Flush();
+}
+
+WebSocketSession::WebSocketSession(SessionStream&& stream, ConnectionGovernor::Ticket&& ticket)
+    : ws_(std::move(stream)), ticket_(std::move(ticket)) {
+    // Таймауты HTTP не подходят долгоживущему соединению, у websocket::stream свои
+    beast::get_lowest_layer(ws_).expires_never();
+    ws_.set_option(websocket::stream_base::timeout::suggested(beast::role_type::server));
+    ws_.text(true);
+}
+
+void WebSocketSession::Accept(const UpgradeRequest& request, OpenHandler&& on_open) {
+    on_open_ = std::move(on_open);
+    // Ответ на рукопожатие строится сразу, поэтому request может не пережить операцию
+    ws_.async_accept(request, beast::bind_front_handler(&WebSocketSession::OnAccept, shared_from_this()));
+}
+
+void WebSocketSession::OnAccept(beast::error_code ec) {
+    using namespace std::literals;
+    if (ec) {
+        return ReportError(ec, "websocket accept"sv);
+    }
+    open_ = true;
+    auto on_open = std::move(on_open_);
+    on_open(shared_from_this());
+    Read();
+}
+
+void WebSocketSession::Read() {
+    ws_.async_read(read_buffer_, beast::bind_front_handler(&WebSocketSession::OnRead, shared_from_this()));
+}
+
+void WebSocketSession::OnRead(beast::error_code ec, [[maybe_unused]] std::size_t bytes_read) {
+    using namespace std::literals;
+    if (ec) {
+        open_ = false;
+        if (ec != websocket::error::closed) {
+            ReportError(ec, "websocket read"sv);
+        }
+        return;
+    }
+    read_buffer_.clear();
+    Read();
+}
+
+void WebSocketSession::Send(Message message) {
+    ++backlog_;
+    net::dispatch(ws_.get_executor(), [self = shared_from_this(), message = std::move(message)]() mutable {
+        if (!self->open_) {
+            --self->backlog_;
+            return;
+        }
+        if (self->writing_) {
+            if (self->pending_) {
+                --self->backlog_;
+            }
+            self->pending_ = std::move(message);
+            return;
+        }
+        self->writing_ = std::move(message);
+        self->Write();
+    });
+}
+
+void WebSocketSession::Write() {
+    ws_.async_write(net::buffer(*writing_), beast::bind_front_handler(&WebSocketSession::OnWrite, shared_from_this()));
+}
+
+void WebSocketSession::OnWrite(beast::error_code ec, [[maybe_unused]] std::size_t bytes_written) {
+    using namespace std::literals;
+    --backlog_;
+    writing_.reset();
+    if (ec) {
+        open_ = false;
+        return ReportError(ec, "websocket write"sv);
+    }
+    if (pending_) {
+        writing_ = std::move(pending_);
+        Write();
+    }
+}
+
+void WebSocketSession::Close() {
+    net::dispatch(ws_.get_executor(), [self = shared_from_this()] {
+        if (!self->open_.exchange(false)) {
+            return;
+        }
+        self->ws_.async_close(websocket::close_code::policy_error, [self](beast::error_code) {});
+    });
 }
 
 }  // namespace http_server
\ No newline at end of file
@@ -4,9 +4,20 @@
 #define BOOST_BEAST_USE_STD_STRING_VIEW
 
 #include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/asio/strand.hpp>
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
+#include <boost/beast/websocket.hpp>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
 
 namespace http_server {
 
@@ -14,12 +25,386 @@ namespace http_server {
     using tcp = net::ip::tcp;
     namespace beast = boost::beast;
     namespace http = beast::http;
+    namespace websocket = beast::websocket;
     namespace sys = boost::system;
 
     using namespace std::literals;
 
     void ReportError(beast::error_code ec, std::string_view where);
 
+    /*
+     *  Арена соединения: поля и тело запроса, ответ и замыкания обработчиков
+     *  выделяются из неё, а после ответа арена сбрасывается целиком.
+     *  Блоки не возвращаются в кучу при сбросе, поэтому на установившемся
+     *  keep-alive трафике обработка запроса не обращается к malloc.
+     *  Не потокобезопасна: в каждый момент с ней работает только тот, кто обрабатывает запрос сессии.
+     */
+    class RequestArena {
+    public:
+        RequestArena() = default;
+        RequestArena(const RequestArena&) = delete;
+        RequestArena& operator=(const RequestArena&) = delete;
+
+        void* Allocate(size_t bytes, size_t alignment);
+
+        //Every object allocated since the previous reset must be already destroyed
+        void Reset() {
+            current_ = 0;
+            offset_ = 0;
+        }
+
+    private:
+        constexpr static size_t INITIAL_BLOCK_SIZE = 16 * 1024;
+
+        struct Block {
+            std::unique_ptr<std::byte[]> data;
+            size_t size;
+        };
+
+        std::vector<Block> blocks_;
+        size_t current_ = 0;
+        size_t offset_ = 0;
+    };
+
+    /*
+     *  Аллокатор поверх RequestArena. Освобождение памяти ничего не делает.
+     *  Аллокатор без арены (созданный по умолчанию) работает с кучей,
+     *  поэтому Beast может создавать такие объекты сам.
+     */
+    template <typename T>
+    class ArenaAllocator {
+    public:
+        using value_type = T;
+        using propagate_on_container_copy_assignment = std::true_type;
+        using propagate_on_container_move_assignment = std::true_type;
+        using propagate_on_container_swap = std::true_type;
+
+        ArenaAllocator() noexcept = default;
+
+        ArenaAllocator(RequestArena* arena) noexcept
+            : arena_(arena) {
+        }
+
+        template <typename U>
+        ArenaAllocator(const ArenaAllocator<U>& other) noexcept
+            : arena_(other.GetArena()) {
+        }
+
+        T* allocate(size_t n) {
+            if (!arena_) {
+                return std::allocator<T>{}.allocate(n);
+            }
+            return static_cast<T*>(arena_->Allocate(n * sizeof(T), alignof(T)));
+        }
+
+        void deallocate(T* ptr, size_t n) noexcept {
+            if (!arena_) {
+                std::allocator<T>{}.deallocate(ptr, n);
+            }
+        }
+
+        RequestArena* GetArena() const noexcept {
+            return arena_;
+        }
+
+        template <typename U>
+        bool operator==(const ArenaAllocator<U>& other) const noexcept {
+            return arena_ == other.GetArena();
+        }
+
+    private:
+        RequestArena* arena_ = nullptr;
+    };
+
+    // Обработчик завершения операции с аллокатором арены: asio и Beast выделяют под операцию память из неё
+    template <typename Handler>
+    class ArenaBoundHandler {
+    public:
+        using allocator_type = ArenaAllocator<char>;
+
+        ArenaBoundHandler(Handler&& handler, allocator_type alloc)
+            : handler_(std::move(handler))
+            , alloc_(alloc) {
+        }
+
+        template <typename... Args>
+        void operator()(Args&&... args) {
+            handler_(std::forward<Args>(args)...);
+        }
+
+        allocator_type get_allocator() const noexcept {
+            return alloc_;
+        }
+
+    private:
+        Handler handler_;
+        allocator_type alloc_;
+    };
+
+    // Конкретный тип исполнителя: any_io_executor выделяет память в куче при каждом копировании
+    using SessionStrand = net::strand<net::io_context::executor_type>;
+    using SessionSocket = tcp::socket::rebind_executor<SessionStrand>::other;
+    using SessionStream = beast::basic_stream<tcp, SessionStrand>;
+
+    using Fields = http::basic_fields<ArenaAllocator<char>>;
+    using StringBody = http::basic_string_body<char, std::char_traits<char>, ArenaAllocator<char>>;
+    using ArenaString = StringBody::value_type;
+    using HttpRequest = http::request<StringBody, Fields>;
+    template <typename Body>
+    using HttpResponse = http::response<Body, Fields>;
+    //Response body for json_writer
+    using ResponseBuffer = beast::basic_flat_buffer<ArenaAllocator<char>>;
+    using BufferBody = http::basic_dynamic_body<ResponseBuffer>;
+
+    // Соединение сверх лимита получает готовый ответ 503 без чтения запроса и закрывается
+    void RejectConnection(SessionSocket&& socket);
+
+    struct ConnectionLimits {
+        size_t max_sessions = 10000;
+        // 0 - без ограничения
+        size_t max_sessions_per_ip = 0;
+        // Ожидание следующего запроса keep-alive соединения
+        std::chrono::milliseconds idle_timeout = 30s;
+        // Чтение заголовков с первого байта запроса
+        std::chrono::milliseconds header_timeout = 10s;
+        std::chrono::milliseconds body_timeout = 30s;
+    };
+
+    struct ListenerOptions {
+        // With reuse_port ServeHttp may be called once per io_context on the same endpoint
+        bool reuse_port = false;
+    };
+
+    struct ServerCounters {
+        std::atomic<uint64_t> sessions_accepted = 0;
+        std::atomic<uint64_t> sessions_rejected = 0;
+        std::atomic<uint64_t> sessions_rejected_per_ip = 0;
+        std::atomic<uint64_t> idle_timeouts = 0;
+        std::atomic<uint64_t> header_timeouts = 0;
+        std::atomic<uint64_t> body_timeouts = 0;
+        // Requests answered with 503 by the request handler
+        std::atomic<uint64_t> requests_shed = 0;
+    };
+
+    /*
+     *  Учёт открытых соединений: общее число и число с одного адреса.
+     *  Соединение занимает место, пока жив выданный ему Ticket,
+     *  в том числе после перехода на WebSocket. Потокобезопасен.
+     */
+    class ConnectionGovernor : public std::enable_shared_from_this<ConnectionGovernor> {
+    public:
+        class Ticket {
+        public:
+            Ticket() = default;
+            Ticket(std::shared_ptr<ConnectionGovernor> governor, const net::ip::address& address)
+                : governor_(std::move(governor))
+                , address_(address) {
+            }
+
+            Ticket(Ticket&&) noexcept = default;
+            Ticket& operator=(Ticket&& other) noexcept {
+                if (this != &other) {
+                    Release();
+                    governor_ = std::move(other.governor_);
+                    address_ = other.address_;
+                }
+                return *this;
+            }
+
+            ~Ticket() {
+                Release();
+            }
+
+            ConnectionGovernor& GetGovernor() const {
+                return *governor_;
+            }
+
+        private:
+            std::shared_ptr<ConnectionGovernor> governor_;
+            net::ip::address address_;
+
+            void Release() {
+                if (governor_) {
+                    governor_->Release(address_);
+                    governor_.reset();
+                }
+            }
+        };
+
+        explicit ConnectionGovernor(ConnectionLimits limits)
+            : limits_(limits) {
+        }
+
+        //Empty if the connection is over a limit, it is counted as rejected then
+        std::optional<Ticket> TryAdmit(const net::ip::address& address);
+
+        const ConnectionLimits& GetLimits() const {
+            return limits_;
+        }
+
+        ServerCounters& GetCounters() {
+            return counters_;
+        }
+
+        size_t GetActiveSessions() const {
+            return active_;
+        }
+
+    private:
+        struct AddressHash {
+            size_t operator()(const net::ip::address& address) const {
+                if (address.is_v4()) {
+                    return std::hash<uint32_t>{}(address.to_v4().to_uint());
+                }
+                auto bytes = address.to_v6().to_bytes();
+                return std::hash<std::string_view>{}(std::string_view(reinterpret_cast<const char*>(bytes.data()), bytes.size()));
+            }
+        };
+
+        const ConnectionLimits limits_;
+        ServerCounters counters_;
+        std::atomic<size_t> active_ = 0;
+        std::mutex mutex_;
+        std::unordered_map<net::ip::address, size_t, AddressHash> per_ip_;
+
+        void Release(const net::ip::address& address);
+    };
+
+    /*
+     *  Соединение, переключённое с HTTP на WebSocket.
+     *  Сервер только отправляет сообщения. Входящие читаются ради управляющих кадров и отбрасываются.
+     *  Очередь не растёт: в полёте не больше одного сообщения и одно ожидающее,
+     *  а новое ожидающее заменяет прежнее. Отправитель смотрит на Backlog(),
+     *  чтобы не терять сообщения у медленного клиента.
+     */
+    class WebSocketSession : public std::enable_shared_from_this<WebSocketSession> {
+    public:
+        using Message = std::shared_ptr<const std::string>;
+        using OpenHandler = std::function<void(std::shared_ptr<WebSocketSession>)>;
+        using UpgradeRequest = http::request<http::empty_body, Fields>;
+
+        WebSocketSession(SessionStream&& stream, ConnectionGovernor::Ticket&& ticket);
+
+        //Must be called in the stream strand, on_open is called there after the handshake
+        void Accept(const UpgradeRequest& request, OpenHandler&& on_open);
+
+        //Thread safe
+        void Send(Message message);
+
+        //Thread safe
+        void Close();
+
+        //Messages accepted by Send and not written yet
+        int Backlog() const {
+            return backlog_;
+        }
+
+        bool IsOpen() const {
+            return open_;
+        }
+
+    private:
+        websocket::stream<SessionStream> ws_;
+        ConnectionGovernor::Ticket ticket_;
+        beast::flat_buffer read_buffer_;
+        Message writing_;
+        Message pending_;
+        std::atomic<int> backlog_ = 0;
+        std::atomic<bool> open_ = false;
+        OpenHandler on_open_;
+
+        void OnAccept(beast::error_code ec);
+
+        void Read();
+
+        void OnRead(beast::error_code ec, [[maybe_unused]] std::size_t bytes_read);
+
+        void Write();
+
+        void OnWrite(beast::error_code ec, [[maybe_unused]] std::size_t bytes_written);
+    };
+
+    class SessionBase;
+
+    // Завершение записи count ответов из головы очереди сессии
+    struct WriteHandler {
+        std::shared_ptr<SessionBase> session;
+        size_t count;
+
+        void operator()(beast::error_code ec, std::size_t bytes_written);
+    };
+
+    /*
+     *  Сериализованный ответ, ждущий своей очереди на запись.
+     *  Ответы с телом в памяти собираются в общую scatter-gather запись вместе с соседями,
+     *  файлы и chunked-ответы записываются по одному.
+     */
+    class PendingResponse {
+    public:
+        virtual ~PendingResponse() = default;
+
+        virtual bool CanGather() const = 0;
+        virtual bool NeedEof() const = 0;
+
+        //Appends buffers of the whole message, they stay valid while the response is alive
+        virtual void Gather(std::vector<net::const_buffer>& buffers) = 0;
+
+        virtual void AsyncWrite(SessionStream& stream,
+            ArenaBoundHandler<WriteHandler>&& handler) = 0;
+    };
+
+    template <typename Body>
+    class PendingResponseImpl : public PendingResponse {
+    public:
+        explicit PendingResponseImpl(HttpResponse<Body>&& response)
+            : response_(std::move(response))
+            , serializer_(response_)
+            , header_(response_.get_allocator()) {
+        }
+
+        bool CanGather() const override {
+            return !std::is_same_v<Body, http::file_body> && !response_.chunked();
+        }
+
+        bool NeedEof() const override {
+            return response_.need_eof();
+        }
+
+        void Gather(std::vector<net::const_buffer>& buffers) override {
+            beast::error_code ec;
+            serializer_.split(true);
+            // Заголовок сериализуется во внутренний буфер сериализатора, поэтому копируем его
+            while (!ec && !serializer_.is_header_done()) {
+                serializer_.next(ec, [this](beast::error_code&, const auto& data) {
+                    for (auto buffer : beast::buffers_range_ref(data)) {
+                        header_.append(static_cast<const char*>(buffer.data()), buffer.size());
+                    }
+                    serializer_.consume(net::buffer_size(data));
+                });
+            }
+            buffers.push_back(net::buffer(header_));
+            // Тело без chunked-кодирования отдаётся ссылками прямо на память ответа
+            while (!ec && !serializer_.is_done()) {
+                serializer_.next(ec, [this, &buffers](beast::error_code&, const auto& data) {
+                    for (auto buffer : beast::buffers_range_ref(data)) {
+                        buffers.push_back(buffer);
+                    }
+                    serializer_.consume(net::buffer_size(data));
+                });
+            }
+        }
+
+        void AsyncWrite(SessionStream& stream,
+            ArenaBoundHandler<WriteHandler>&& handler) override {
+            http::async_write(stream, serializer_, std::move(handler));
+        }
+
+    private:
+        HttpResponse<Body> response_;
+        http::response_serializer<Body, Fields> serializer_;
+        ArenaString header_;
+    };
+
     class SessionBase {
     public:
         // Запрещаем копирование и присваивание объектов SessionBase и его наследников
@@ -29,41 +414,110 @@ namespace http_server {
         void Run();
 
     protected:
+        // Сколько запросов читается наперёд, пока ответ на первый из них не записан
+        constexpr static size_t MAX_PIPELINED = 8;
+        constexpr static auto WRITE_TIMEOUT = 30s;
+        // Порция, которой читается первый байт следующего запроса
+        constexpr static size_t IDLE_READ_SIZE = 4096;
+
         beast::net::ip::address address_;
-        using HttpRequest = http::request<http::string_body>;
 
         ~SessionBase() = default;
 
-        explicit SessionBase(tcp::socket&& socket);
+        SessionBase(SessionSocket&& socket, ConnectionGovernor::Ticket&& ticket);
 
-        template <typename Body, typename Fields>
-        void Write(http::response<Body, Fields>&& response) {
-            // Запись выполняется асинхронно, поэтому response перемещаем в область кучи
-            auto safe_response = std::make_shared<http::response<Body, Fields>>(std::move(response));
+        // Запрос с номером seq и всё, что выделено под его обработку, живут в арене слота seq % MAX_PIPELINED
+        ArenaAllocator<char> GetAllocator(size_t slot) {
+            return &slots_[slot].arena;
+        }
 
-            auto self = GetSharedThis();
-            http::async_write(stream_, *safe_response,
-                [safe_response, self](beast::error_code ec, std::size_t bytes_written) {
-                    self->OnWrite(safe_response->need_eof(), ec, bytes_written);
-                });
+        void AcquireSlot(size_t slot) {
+            ++slots_[slot].handlers;
+        }
+
+        void ReleaseSlot(size_t slot) {
+            --slots_[slot].handlers;
         }
 
+        // Может вызываться из любого потока, ответ ставится в очередь в strand сессии
+        template <typename Body>
+        void Write(size_t slot, HttpResponse<Body>&& response) {
+            auto pending = std::allocate_shared<PendingResponseImpl<Body>>(GetAllocator(slot), std::move(response));
+            auto on_response = [self = GetSharedThis(), slot, pending = std::move(pending)]() mutable {
+                self->OnResponse(slot, std::move(pending));
+            };
+            net::dispatch(stream_.get_executor(), ArenaBoundHandler(std::move(on_response), GetAllocator(slot)));
+        }
+
+        // Может вызываться из любого потока. Соединение перейдёт к WebSocket после записи предшествующих ответов
+        void Upgrade(WebSocketSession::OpenHandler&& on_open);
+
     private:
-        // tcp_stream содержит внутри себя сокет и добавляет поддержку таймаутов
-        beast::tcp_stream stream_;
+        friend struct WriteHandler;
+
+        struct Slot {
+            RequestArena arena;
+            // Число живых обработчиков запроса, которые могут ссылаться на память арены
+            std::atomic<int> handlers = 0;
+            std::shared_ptr<PendingResponse> response;
+        };
+
+        using RequestParser = http::request_parser<StringBody, ArenaAllocator<char>>;
+
+        // Какой таймаут сейчас взведён на чтение
+        enum class ReadPhase {
+            IDLE,
+            HEADER,
+            BODY
+        };
+
+        // basic_stream содержит внутри себя сокет и добавляет поддержку таймаутов
+        SessionStream stream_;
+        ConnectionGovernor::Ticket ticket_;
         beast::flat_buffer buffer_;
-        HttpRequest request_;
+        // Объявлены до parser_, чтобы пережить его
+        std::array<Slot, MAX_PIPELINED> slots_;
+        std::optional<RequestParser> parser_;
+        ReadPhase read_phase_ = ReadPhase::IDLE;
+        // Заголовки запроса на апгрейд до WebSocket, после него запросы больше не читаются
+        std::optional<WebSocketSession::UpgradeRequest> upgrade_request_;
+        std::optional<WebSocketSession::OpenHandler> on_upgrade_;
+        // Номер следующего читаемого запроса и номер ответа, ожидающего записи
+        uint64_t read_seq_ = 0;
+        uint64_t write_seq_ = 0;
+        bool reading_ = false;
+        bool writing_ = false;
+        bool read_closed_ = false;
+        bool closed_ = false;
+        std::vector<net::const_buffer> gather_;
 
         void Read();
 
+        // Первый байт следующего запроса ждём с idle-таймаутом, заголовки и тело - каждые со своим
+        void OnIdleRead(beast::error_code ec, std::size_t bytes_read);
+
+        void ReadHeader();
+
+        void OnReadHeader(beast::error_code ec, [[maybe_unused]] std::size_t bytes_read);
+
         void OnRead(beast::error_code ec, [[maybe_unused]] std::size_t bytes_read);
 
+        // Ошибка чтения или таймаут фазы read_phase_, соединение больше не читается
+        void OnReadError(beast::error_code ec);
+
+        void ArmReadTimeout();
+
+        void OnResponse(size_t slot, std::shared_ptr<PendingResponse>&& response);
+
+        // Записывает готовые ответы из головы очереди, соблюдая порядок запросов
+        void Flush();
+
         void Close();
 
-        void OnWrite(bool close, beast::error_code ec, [[maybe_unused]] std::size_t bytes_written);
+        void OnWrite(size_t count, beast::error_code ec, [[maybe_unused]] std::size_t bytes_written);
 
         // Обработку запроса делегируем подклассу
-        virtual void HandleRequest(HttpRequest&& request) = 0;
+        virtual void HandleRequest(size_t slot, HttpRequest&& request) = 0;
 
         virtual std::shared_ptr<SessionBase> GetSharedThis() = 0;
     };
@@ -72,21 +526,71 @@ namespace http_server {
     class Session : public SessionBase, public std::enable_shared_from_this<Session<RequestHandler>> {
     public:
         template <typename Handler>
-        Session(tcp::socket&& socket, Handler&& request_handler)
-            : SessionBase(std::move(socket))
+        Session(SessionSocket&& socket, ConnectionGovernor::Ticket&& ticket, Handler&& request_handler)
+            : SessionBase(std::move(socket), std::move(ticket))
             , request_handler_(std::forward<Handler>(request_handler)) {
         }
 
     private:
+        /*
+         *  Функция отправки ответа, передаваемая обработчику.
+         *  Держит сессию, а вместе с ней и арену слота запроса, живой, пока существует.
+         *  Пока хотя бы одна такая функция жива, арена слота не сбрасывается.
+         *  Аллокатор арены доступен через get_allocator().
+         */
+        class ResponseSender {
+        public:
+            using allocator_type = ArenaAllocator<char>;
+
+            ResponseSender(std::shared_ptr<Session> session, size_t slot)
+                : session_(std::move(session))
+                , slot_(slot) {
+                session_->AcquireSlot(slot_);
+            }
+
+            ResponseSender(ResponseSender&& other) noexcept = default;
+            ResponseSender(const ResponseSender&) = delete;
+            ResponseSender& operator=(const ResponseSender&) = delete;
+
+            ~ResponseSender() {
+                if (session_) {
+                    session_->ReleaseSlot(slot_);
+                }
+            }
+
+            template <typename Response>
+            void operator()(Response&& response) const {
+                session_->Write(slot_, std::move(response));
+            }
+
+            //Set by the request handler from Accept-Encoding
+            void SetGzipAccepted(bool accepted) {
+                gzip_accepted_ = accepted;
+            }
+
+            bool IsGzipAccepted() const {
+                return gzip_accepted_;
+            }
+
+            //Answers a WebSocket upgrade request with the handshake, on_open gets the connection
+            void AcceptWebSocket(WebSocketSession::OpenHandler&& on_open) const {
+                session_->Upgrade(std::move(on_open));
+            }
+
+            allocator_type get_allocator() const {
+                return session_->GetAllocator(slot_);
+            }
+
+        private:
+            std::shared_ptr<Session> session_;
+            size_t slot_;
+            bool gzip_accepted_ = false;
+        };
+
         RequestHandler request_handler_;
 
-        void HandleRequest(HttpRequest&& request) override {
-            // Захватываем умный указатель на текущий объект Session в лямбде,
-            // чтобы продлить время жизни сессии до вызова лямбды.
-            // Используется generic-лямбда функция, способная принять response произвольного типа
-            request_handler_(std::move(request), [self = this->shared_from_this()](auto&& response) {
-                self->Write(std::move(response));
-                }, address_);
+        void HandleRequest(size_t slot, HttpRequest&& request) override {
+            request_handler_(std::move(request), ResponseSender(this->shared_from_this(), slot), address_);
         }
 
         std::shared_ptr<SessionBase> GetSharedThis() override {
@@ -97,11 +601,18 @@ namespace http_server {
     template <typename RequestHandler>
     class Listener : public std::enable_shared_from_this<Listener<RequestHandler>> {
     public:
+        // SO_REUSEPORT: несколько acceptor-ов на одном порту, ядро распределяет соединения между ними
+        using ReusePort = net::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+        // Пауза перед новым accept, когда у процесса кончились дескрипторы
+        static constexpr std::chrono::milliseconds ACCEPT_RETRY_DELAY{ 100 };
+
         template <typename Handler>
-        Listener(net::io_context& ioc, const tcp::endpoint& endpoint, Handler&& request_handler)
+        Listener(net::io_context& ioc, const tcp::endpoint& endpoint, std::shared_ptr<ConnectionGovernor> governor, Handler&& request_handler, ListenerOptions options = {})
             : ioc_(ioc)
             // Обработчики асинхронных операций acceptor_ будут вызываться в своём strand
             , acceptor_(net::make_strand(ioc))
+            , retry_timer_(acceptor_.get_executor())
+            , governor_(std::move(governor))
             , request_handler_(std::forward<Handler>(request_handler)) {
             // Открываем acceptor, используя протокол (IPv4 или IPv6), указанный в endpoint
             acceptor_.open(endpoint.protocol());
@@ -111,6 +622,9 @@ namespace http_server {
             // Однако это может помешать повторно открыть сокет в полузакрытом состоянии.
             // Флаг reuse_address разрешает открыть сокет, когда он "наполовину закрыт"
             acceptor_.set_option(net::socket_base::reuse_address(true));
+            if (options.reuse_port) {
+                acceptor_.set_option(ReusePort(true));
+            }
             // Привязываем acceptor к адресу и порту endpoint
             acceptor_.bind(endpoint);
             // Переводим acceptor в состояние, в котором он способен принимать новые соединения
@@ -125,10 +639,12 @@ namespace http_server {
     private:
         net::io_context& ioc_;
         tcp::acceptor acceptor_;
+        net::steady_timer retry_timer_;
+        std::shared_ptr<ConnectionGovernor> governor_;
         RequestHandler request_handler_;
 
-        void AsyncRunSession(tcp::socket&& socket) {
-            std::make_shared<Session<RequestHandler>>(std::move(socket), request_handler_)->Run();
+        void AsyncRunSession(SessionSocket&& socket, ConnectionGovernor::Ticket&& ticket) {
+            std::make_shared<Session<RequestHandler>>(std::move(socket), std::move(ticket), request_handler_)->Run();
         }
 
         void DoAccept() {
@@ -147,15 +663,40 @@ namespace http_server {
                 beast::bind_front_handler(&Listener::OnAccept, this->shared_from_this()));
         }
 
-        void OnAccept(sys::error_code ec, tcp::socket socket) {
+        void OnAccept(sys::error_code ec, SessionSocket socket) {
             using namespace std::literals;
 
             if (ec) {
-                return ReportError(ec, "accept"sv);
+                if (ec == net::error::operation_aborted) {
+                    return;
+                }
+                ReportError(ec, "accept"sv);
+                // Пока не хватает дескрипторов или памяти, соединение из очереди не принять,
+                // повтор без паузы только нагрузит процессор
+                if (ec == net::error::no_descriptors || ec == sys::errc::too_many_files_open_in_system
+                    || ec == net::error::no_buffer_space || ec == net::error::no_memory) {
+                    retry_timer_.expires_after(ACCEPT_RETRY_DELAY);
+                    retry_timer_.async_wait([self = this->shared_from_this()](sys::error_code ec) {
+                        if (!ec) {
+                            self->DoAccept();
+                        }
+                    });
+                    return;
+                }
+                return DoAccept();
             }
 
-            // Асинхронно обрабатываем сессию
-            AsyncRunSession(std::move(socket));
+            beast::error_code endpoint_ec;
+            auto endpoint = socket.remote_endpoint(endpoint_ec);
+            if (!endpoint_ec) {
+                if (auto ticket = governor_->TryAdmit(endpoint.address())) {
+                    // Асинхронно обрабатываем сессию
+                    AsyncRunSession(std::move(socket), std::move(*ticket));
+                }
+                else {
+                    RejectConnection(std::move(socket));
+                }
+            }
 
             // Принимаем новое соединение
             DoAccept();
@@ -163,10 +704,10 @@ namespace http_server {
     };
 
     template <typename RequestHandler>
-    void ServeHttp(net::io_context& ioc, const tcp::endpoint& endpoint, RequestHandler&& handler) {
+    void ServeHttp(net::io_context& ioc, const tcp::endpoint& endpoint, std::shared_ptr<ConnectionGovernor> governor, RequestHandler&& handler, ListenerOptions options = {}) {
         using MyListener = Listener<std::decay_t<RequestHandler>>;
 
-        std::make_shared<MyListener>(ioc, endpoint, std::forward<RequestHandler>(handler))->Run();
+        std::make_shared<MyListener>(ioc, endpoint, std::move(governor), std::forward<RequestHandler>(handler), options)->Run();
     }
 
 }  // namespace http_server
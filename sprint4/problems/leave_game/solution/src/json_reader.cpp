@@ -0,0 +1,503 @@
+#include "json_reader.h"
+
+#include <limits>
+
+namespace json_reader {
+
+namespace {
+
+// Same limit as boost::json::parse_options::max_depth
+constexpr int MAX_DEPTH = 32;
+constexpr size_t MAX_KEY_SIZE = 32;
+
+class KeyBuffer {
+public:
+    void push_back(char c) {
+        if (size_ == MAX_KEY_SIZE) {
+            overflow_ = true;
+            return;
+        }
+        data_[size_++] = c;
+    }
+
+    //Overflowed keys are longer than any requested key, so they never match
+    std::string_view View() const {
+        return overflow_ ? std::string_view{} : std::string_view{ data_, size_ };
+    }
+
+private:
+    char data_[MAX_KEY_SIZE];
+    size_t size_ = 0;
+    bool overflow_ = false;
+};
+
+int HexValue(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+template <typename Out>
+void AppendUtf8(Out& out, uint32_t code_point) {
+    if (code_point < 0x80) {
+        out.push_back(static_cast<char>(code_point));
+    }
+    else if (code_point < 0x800) {
+        out.push_back(static_cast<char>(0xC0 | (code_point >> 6)));
+        out.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    }
+    else if (code_point < 0x10000) {
+        out.push_back(static_cast<char>(0xE0 | (code_point >> 12)));
+        out.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    }
+    else {
+        out.push_back(static_cast<char>(0xF0 | (code_point >> 18)));
+        out.push_back(static_cast<char>(0x80 | ((code_point >> 12) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    }
+}
+
+uint32_t ReadHex4(const char* p) {
+    return (HexValue(p[0]) << 12) | (HexValue(p[1]) << 8) | (HexValue(p[2]) << 4) | HexValue(p[3]);
+}
+
+//raw is an already validated string content without quotes
+template <typename Out>
+void Unescape(std::string_view raw, Out& out) {
+    for (size_t i = 0; i < raw.size(); ++i) {
+        if (raw[i] != '\\') {
+            out.push_back(raw[i]);
+            continue;
+        }
+        ++i;
+        switch (raw[i]) {
+        case 'b': out.push_back('\b'); break;
+        case 'f': out.push_back('\f'); break;
+        case 'n': out.push_back('\n'); break;
+        case 'r': out.push_back('\r'); break;
+        case 't': out.push_back('\t'); break;
+        case 'u': {
+            uint32_t code_point = ReadHex4(raw.data() + i + 1);
+            i += 4;
+            if (code_point >= 0xD800 && code_point <= 0xDBFF) {
+                uint32_t low = ReadHex4(raw.data() + i + 3);
+                i += 6;
+                code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+            }
+            AppendUtf8(out, code_point);
+            break;
+        }
+        default:
+            out.push_back(raw[i]);
+        }
+    }
+}
+
+class Reader {
+public:
+    explicit Reader(std::string_view body)
+        : pos_(body.data())
+        , end_(body.data() + body.size()) {
+    }
+
+    bool ReadTopObject(std::initializer_list<FieldRef> fields) {
+        SkipWhitespace();
+        if (!ReadObject(fields, 1)) {
+            return false;
+        }
+        SkipWhitespace();
+        return pos_ == end_;
+    }
+
+    bool ReadTopArray(const std::function<bool(std::string_view element)>& on_element) {
+        SkipWhitespace();
+        if (!Consume('[')) {
+            return false;
+        }
+        SkipWhitespace();
+        if (!Consume(']')) {
+            while (true) {
+                SkipWhitespace();
+                const char* start = pos_;
+                if (!ReadValue(nullptr, 1) || !on_element(std::string_view(start, pos_ - start))) {
+                    return false;
+                }
+                SkipWhitespace();
+                if (Consume(']')) {
+                    break;
+                }
+                if (!Consume(',')) {
+                    return false;
+                }
+            }
+        }
+        SkipWhitespace();
+        return pos_ == end_;
+    }
+
+private:
+    const char* pos_;
+    const char* end_;
+
+    void SkipWhitespace() {
+        while (pos_ != end_ && (*pos_ == ' ' || *pos_ == '\t' || *pos_ == '\n' || *pos_ == '\r')) {
+            ++pos_;
+        }
+    }
+
+    bool Consume(char c) {
+        if (pos_ != end_ && *pos_ == c) {
+            ++pos_;
+            return true;
+        }
+        return false;
+    }
+
+    bool ConsumeLiteral(std::string_view literal) {
+        if (static_cast<size_t>(end_ - pos_) < literal.size() || std::string_view(pos_, literal.size()) != literal) {
+            return false;
+        }
+        pos_ += literal.size();
+        return true;
+    }
+
+    bool IsContinuation(size_t offset, unsigned char min = 0x80, unsigned char max = 0xBF) const {
+        if (end_ - pos_ <= static_cast<std::ptrdiff_t>(offset)) {
+            return false;
+        }
+        auto c = static_cast<unsigned char>(pos_[offset]);
+        return c >= min && c <= max;
+    }
+
+    //Validates one multibyte UTF-8 sequence, rejecting overlongs and surrogates
+    bool SkipUtf8() {
+        auto lead = static_cast<unsigned char>(*pos_);
+        size_t length;
+        if (lead >= 0xC2 && lead <= 0xDF) {
+            length = 2;
+        }
+        else if (lead == 0xE0) {
+            length = IsContinuation(1, 0xA0, 0xBF) ? 3 : 0;
+        }
+        else if (lead == 0xED) {
+            length = IsContinuation(1, 0x80, 0x9F) ? 3 : 0;
+        }
+        else if (lead >= 0xE1 && lead <= 0xEF) {
+            length = 3;
+        }
+        else if (lead == 0xF0) {
+            length = IsContinuation(1, 0x90, 0xBF) ? 4 : 0;
+        }
+        else if (lead == 0xF4) {
+            length = IsContinuation(1, 0x80, 0x8F) ? 4 : 0;
+        }
+        else if (lead >= 0xF1 && lead <= 0xF3) {
+            length = 4;
+        }
+        else {
+            return false;
+        }
+        for (size_t i = 1; i < length; ++i) {
+            if (!IsContinuation(i)) {
+                return false;
+            }
+        }
+        pos_ += length;
+        return length != 0;
+    }
+
+    bool SkipUnicodeEscape(uint32_t& code_unit) {
+        if (end_ - pos_ < 5 || *pos_ != 'u') {
+            return false;
+        }
+        for (int i = 1; i <= 4; ++i) {
+            if (HexValue(pos_[i]) < 0) {
+                return false;
+            }
+        }
+        code_unit = ReadHex4(pos_ + 1);
+        pos_ += 5;
+        return true;
+    }
+
+    //pos_ points after the opening quote, raw gets the content between quotes
+    bool ReadString(std::string_view& raw, bool& escaped) {
+        const char* start = pos_;
+        escaped = false;
+        while (pos_ != end_) {
+            auto c = static_cast<unsigned char>(*pos_);
+            if (c == '"') {
+                raw = std::string_view(start, pos_ - start);
+                ++pos_;
+                return true;
+            }
+            if (c < 0x20) {
+                return false;
+            }
+            if (c >= 0x80) {
+                if (!SkipUtf8()) {
+                    return false;
+                }
+                continue;
+            }
+            ++pos_;
+            if (c != '\\') {
+                continue;
+            }
+            escaped = true;
+            if (pos_ == end_) {
+                return false;
+            }
+            switch (*pos_) {
+            case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+                ++pos_;
+                break;
+            case 'u': {
+                uint32_t code_unit;
+                if (!SkipUnicodeEscape(code_unit)) {
+                    return false;
+                }
+                if (code_unit >= 0xDC00 && code_unit <= 0xDFFF) {
+                    return false;
+                }
+                if (code_unit >= 0xD800 && code_unit <= 0xDBFF) {
+                    uint32_t low;
+                    if (!Consume('\\') || !SkipUnicodeEscape(low) || low < 0xDC00 || low > 0xDFFF) {
+                        return false;
+                    }
+                }
+                break;
+            }
+            default:
+                return false;
+            }
+        }
+        return false;
+    }
+
+    bool SkipDigits() {
+        const char* start = pos_;
+        while (pos_ != end_ && *pos_ >= '0' && *pos_ <= '9') {
+            ++pos_;
+        }
+        return pos_ != start;
+    }
+
+    bool ReadNumber(Field* field) {
+        bool negative = Consume('-');
+        const char* digits = pos_;
+        // Leading zeros are not allowed
+        if (!Consume('0')) {
+            if (pos_ == end_ || *pos_ < '1' || *pos_ > '9') {
+                return false;
+            }
+            SkipDigits();
+        }
+        const char* digits_end = pos_;
+        bool integer = true;
+        if (Consume('.')) {
+            integer = false;
+            if (!SkipDigits()) {
+                return false;
+            }
+        }
+        if (Consume('e') || Consume('E')) {
+            integer = false;
+            if (!Consume('+')) {
+                Consume('-');
+            }
+            if (!SkipDigits()) {
+                return false;
+            }
+        }
+        if (!field) {
+            return true;
+        }
+        field->kind = Field::OTHER;
+        if (!integer) {
+            return true;
+        }
+        // Accumulate as negative to cover the whole int64 range
+        std::int64_t value = 0;
+        constexpr std::int64_t MIN = std::numeric_limits<std::int64_t>::min();
+        for (const char* p = digits; p != digits_end; ++p) {
+            int digit = *p - '0';
+            if (value < (MIN + digit) / 10) {
+                return true;
+            }
+            value = value * 10 - digit;
+        }
+        if (!negative) {
+            if (value == MIN) {
+                return true;
+            }
+            value = -value;
+        }
+        field->kind = Field::INT64;
+        field->int64 = value;
+        return true;
+    }
+
+    bool ReadValue(Field* field, int depth) {
+        const char* start = pos_;
+        if (!ReadValueOf(field, depth)) {
+            return false;
+        }
+        if (field) {
+            field->raw = std::string_view(start, pos_ - start);
+        }
+        return true;
+    }
+
+    bool ReadValueOf(Field* field, int depth) {
+        if (pos_ == end_) {
+            return false;
+        }
+        switch (*pos_) {
+        case '{':
+            if (field) {
+                field->kind = Field::OTHER;
+            }
+            return ReadObject({}, depth + 1);
+        case '[':
+            if (field) {
+                field->kind = Field::OTHER;
+            }
+            return ReadArray(depth + 1);
+        case '"': {
+            ++pos_;
+            std::string_view raw;
+            bool escaped;
+            if (!ReadString(raw, escaped)) {
+                return false;
+            }
+            if (field) {
+                field->kind = Field::STRING;
+                if (escaped) {
+                    field->unescaped.clear();
+                    Unescape(raw, field->unescaped);
+                    field->string = field->unescaped;
+                }
+                else {
+                    field->string = raw;
+                }
+            }
+            return true;
+        }
+        case 't':
+        case 'f':
+        case 'n':
+            if (field) {
+                field->kind = Field::OTHER;
+            }
+            return ConsumeLiteral("true") || ConsumeLiteral("false") || ConsumeLiteral("null");
+        default:
+            return ReadNumber(field);
+        }
+    }
+
+    bool ReadArray(int depth) {
+        if (depth > MAX_DEPTH || !Consume('[')) {
+            return false;
+        }
+        SkipWhitespace();
+        if (Consume(']')) {
+            return true;
+        }
+        while (true) {
+            SkipWhitespace();
+            if (!ReadValue(nullptr, depth)) {
+                return false;
+            }
+            SkipWhitespace();
+            if (Consume(']')) {
+                return true;
+            }
+            if (!Consume(',')) {
+                return false;
+            }
+        }
+    }
+
+    Field* FindField(std::initializer_list<FieldRef> fields, std::string_view key) const {
+        for (const auto& ref : fields) {
+            if (ref.key == key) {
+                return ref.field;
+            }
+        }
+        return nullptr;
+    }
+
+    //Only the top level object passes requested fields
+    bool ReadObject(std::initializer_list<FieldRef> fields, int depth) {
+        if (depth > MAX_DEPTH || !Consume('{')) {
+            return false;
+        }
+        SkipWhitespace();
+        if (Consume('}')) {
+            return true;
+        }
+        while (true) {
+            SkipWhitespace();
+            if (!Consume('"')) {
+                return false;
+            }
+            std::string_view key;
+            bool escaped;
+            if (!ReadString(key, escaped)) {
+                return false;
+            }
+            Field* field = nullptr;
+            if (fields.size() != 0) {
+                if (escaped) {
+                    KeyBuffer buffer;
+                    Unescape(key, buffer);
+                    field = FindField(fields, buffer.View());
+                }
+                else {
+                    field = FindField(fields, key);
+                }
+            }
+            SkipWhitespace();
+            if (!Consume(':')) {
+                return false;
+            }
+            SkipWhitespace();
+            if (!ReadValue(field, depth)) {
+                return false;
+            }
+            SkipWhitespace();
+            if (Consume('}')) {
+                return true;
+            }
+            if (!Consume(',')) {
+                return false;
+            }
+        }
+    }
+};
+
+}  // namespace
+
+bool ReadObject(std::string_view body, std::initializer_list<FieldRef> fields) {
+    for (const auto& ref : fields) {
+        ref.field->kind = Field::ABSENT;
+        ref.field->raw = {};
+    }
+    return Reader(body).ReadTopObject(fields);
+}
+
+bool ReadArray(std::string_view body, const std::function<bool(std::string_view element)>& on_element) {
+    return Reader(body).ReadTopArray(on_element);
+}
+
+}  // namespace json_reader
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+
+namespace json_reader {
+
+/*
+ *  Значение поля верхнего уровня JSON-объекта.
+ *  Строки без escape-последовательностей ссылаются прямо на разбираемый буфер,
+ *  поэтому поле действительно, пока жив буфер с телом запроса.
+ */
+struct Field {
+    enum Kind {
+        ABSENT,
+        STRING,
+        INT64,
+        OTHER
+    };
+
+    Field() = default;
+    Field(const Field&) = delete;
+    Field& operator=(const Field&) = delete;
+
+    Kind kind = ABSENT;
+    std::string_view string;
+    std::int64_t int64 = 0;
+    //Storage for strings with escape sequences, string points here in that case
+    std::string unescaped;
+    //JSON text of the value as it is in the body, e.g. to read a double
+    std::string_view raw;
+};
+
+struct FieldRef {
+    std::string_view key;
+    Field* field;
+};
+
+/*
+ * Проверяет, что body - корректный JSON-объект, и заполняет запрошенные поля
+ * верхнего уровня. Разбор идёт прямо по буферу, без построения DOM.
+ * При повторе ключа побеждает последнее значение.
+ * Возвращает false, если body не является корректным JSON-объектом.
+ */
+bool ReadObject(std::string_view body, std::initializer_list<FieldRef> fields);
+
+/*
+ * Проверяет, что body - корректный JSON-массив, и передаёт on_element текст каждого элемента.
+ * Возвращает false, если body не является корректным JSON-массивом или on_element вернул false.
+ */
+bool ReadArray(std::string_view body, const std::function<bool(std::string_view element)>& on_element);
+
+}  // namespace json_reader
@@ -0,0 +1,366 @@
+#pragma once
+
+#include <boost/asio/buffer.hpp>
+#include <cassert>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "model.h"
+
+namespace json_writer {
+
+using namespace std::literals;
+
+/*
+ *  Потоковая запись JSON прямо в DynamicBuffer (например, beast::flat_buffer),
+ *  без промежуточного DOM и строки.
+ *  Запятые между элементами расставляются автоматически.
+ *  Данные копятся в небольшом чанке и попадают в буфер при его заполнении,
+ *  при вызове Flush() и в деструкторе.
+ */
+template <typename DynamicBuffer>
+class Writer {
+public:
+    explicit Writer(DynamicBuffer& buffer)
+        : buffer_(buffer) {
+    }
+
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+
+    ~Writer() {
+        Flush();
+    }
+
+    void Flush() {
+        if (size_ == 0) {
+            return;
+        }
+        auto buffer = buffer_.prepare(size_);
+        boost::asio::buffer_copy(buffer, boost::asio::buffer(chunk_, size_));
+        buffer_.commit(size_);
+        size_ = 0;
+    }
+
+    Writer& BeginObject() {
+        BeforeValue();
+        Put('{');
+        Push();
+        return *this;
+    }
+
+    Writer& EndObject() {
+        --depth_;
+        Put('}');
+        return *this;
+    }
+
+    Writer& BeginArray() {
+        BeforeValue();
+        Put('[');
+        Push();
+        return *this;
+    }
+
+    Writer& EndArray() {
+        --depth_;
+        Put(']');
+        return *this;
+    }
+
+    Writer& Key(std::string_view key) {
+        BeforeValue();
+        PutString(key);
+        Put(':');
+        after_key_ = true;
+        return *this;
+    }
+
+    Writer& String(std::string_view value) {
+        BeforeValue();
+        PutString(value);
+        return *this;
+    }
+
+    Writer& Int(std::int64_t value) {
+        BeforeValue();
+        PutNumber(value);
+        return *this;
+    }
+
+    Writer& Uint(std::uint64_t value) {
+        BeforeValue();
+        PutNumber(value);
+        return *this;
+    }
+
+    //Shortest representation which reads back to the same double
+    Writer& Double(double value) {
+        BeforeValue();
+        if (!std::isfinite(value)) {
+            Put("null"sv);
+            return *this;
+        }
+        Reserve(MAX_NUMBER_SIZE + 2);
+        char* begin = chunk_ + size_;
+        auto [end, ec] = std::to_chars(begin, begin + MAX_NUMBER_SIZE, value);
+        size_ += end - begin;
+        if (std::string_view(begin, end - begin).find_first_of(".e"sv) == std::string_view::npos) {
+            Put(".0"sv);
+        }
+        return *this;
+    }
+
+    //Writes already serialized JSON as is
+    Writer& Raw(std::string_view json) {
+        BeforeValue();
+        Put(json);
+        return *this;
+    }
+
+private:
+    static constexpr size_t CHUNK_SIZE = 4096;
+    static constexpr size_t MAX_NUMBER_SIZE = 32;
+    static constexpr int MAX_DEPTH = 64;
+
+    DynamicBuffer& buffer_;
+    char chunk_[CHUNK_SIZE];
+    size_t size_ = 0;
+    //Bit i is set while the container at depth i has no elements yet
+    std::uint64_t empty_ = 0;
+    int depth_ = 0;
+    bool after_key_ = false;
+
+    void Push() {
+        assert(depth_ < MAX_DEPTH);
+        empty_ |= std::uint64_t{ 1 } << depth_++;
+    }
+
+    void Reserve(size_t size) {
+        if (CHUNK_SIZE - size_ < size) {
+            Flush();
+        }
+    }
+
+    void BeforeValue() {
+        if (after_key_) {
+            after_key_ = false;
+            return;
+        }
+        if (depth_ != 0) {
+            const auto bit = std::uint64_t{ 1 } << (depth_ - 1);
+            if (!(empty_ & bit)) {
+                Put(',');
+            }
+            empty_ &= ~bit;
+        }
+    }
+
+    void Put(char c) {
+        Reserve(1);
+        chunk_[size_++] = c;
+    }
+
+    void Put(std::string_view data) {
+        if (data.size() > CHUNK_SIZE) {
+            Flush();
+            auto buffer = buffer_.prepare(data.size());
+            boost::asio::buffer_copy(buffer, boost::asio::buffer(data.data(), data.size()));
+            buffer_.commit(data.size());
+            return;
+        }
+        Reserve(data.size());
+        std::memcpy(chunk_ + size_, data.data(), data.size());
+        size_ += data.size();
+    }
+
+    template <typename Integer>
+    void PutNumber(Integer value) {
+        Reserve(MAX_NUMBER_SIZE);
+        auto [end, ec] = std::to_chars(chunk_ + size_, chunk_ + size_ + MAX_NUMBER_SIZE, value);
+        size_ = end - chunk_;
+    }
+
+    void PutString(std::string_view value) {
+        constexpr std::string_view HEX = "0123456789abcdef"sv;
+        Put('"');
+        size_t plain_start = 0;
+        for (size_t i = 0; i < value.size(); ++i) {
+            auto c = static_cast<unsigned char>(value[i]);
+            if (c >= 0x20 && c != '"' && c != '\\') {
+                continue;
+            }
+            Put(value.substr(plain_start, i - plain_start));
+            plain_start = i + 1;
+            switch (c) {
+            case '"': Put("\\\""sv); break;
+            case '\\': Put("\\\\"sv); break;
+            case '\b': Put("\\b"sv); break;
+            case '\f': Put("\\f"sv); break;
+            case '\n': Put("\\n"sv); break;
+            case '\r': Put("\\r"sv); break;
+            case '\t': Put("\\t"sv); break;
+            default: {
+                const char escaped[] = { '\\', 'u', '0', '0', HEX[c >> 4], HEX[c & 0xF] };
+                Put(std::string_view(escaped, sizeof(escaped)));
+            }
+            }
+        }
+        Put(value.substr(plain_start));
+        Put('"');
+    }
+};
+
+//Rough size of one serialized dog, used to reserve the buffer once
+constexpr size_t DOG_STATE_SIZE_HINT = 160;
+constexpr size_t LOOT_STATE_SIZE_HINT = 64;
+
+inline std::string_view DirectionToString(model::Direction dir) {
+    switch (dir) {
+    case model::Direction::NORTH:
+        return "U"sv;
+    case model::Direction::SOUTH:
+        return "D"sv;
+    case model::Direction::EAST:
+        return "R"sv;
+    case model::Direction::WEST:
+        return "L"sv;
+    }
+    return ""sv;
+}
+
+template <typename DynamicBuffer>
+void WriteDogState(Writer<DynamicBuffer>& writer, const model::Dog& dog) {
+    auto pos = dog.GetPosition();
+    auto speed = dog.GetSpeed();
+    writer.BeginObject();
+    writer.Key("pos"sv).BeginArray().Double(pos.x).Double(pos.y).EndArray();
+    writer.Key("speed"sv).BeginArray().Double(speed.vx).Double(speed.vy).EndArray();
+    writer.Key("dir"sv).String(DirectionToString(dog.GetDirection()));
+    writer.Key("bag"sv).BeginArray();
+    for (const auto& item : dog.GetItems()) {
+        writer.BeginObject().Key("id"sv).Uint(item.id).Key("type"sv).Uint(item.type).EndObject();
+    }
+    writer.EndArray();
+    writer.Key("score"sv).Uint(dog.GetScore());
+    writer.EndObject();
+}
+
+template <typename DynamicBuffer>
+void WriteLootState(Writer<DynamicBuffer>& writer, model::GameSession::LootType type, model::Position pos) {
+    writer.BeginObject();
+    writer.Key("type"sv).Uint(type);
+    writer.Key("pos"sv).BeginArray().Double(pos.x).Double(pos.y).EndArray();
+    writer.EndObject();
+}
+
+template <typename DynamicBuffer>
+void WriteStateFields(Writer<DynamicBuffer>& writer, const std::vector<const model::Dog*>& dogs, const model::GameSession& session) {
+    writer.Key("players"sv).BeginObject();
+    for (const auto* dog : dogs) {
+        writer.Key(std::to_string(dog->GetId()));
+        WriteDogState(writer, *dog);
+    }
+    writer.EndObject();
+    writer.Key("lostObjects"sv).BeginObject();
+    for (const auto& loot : session.GetLoot()) {
+        writer.Key(std::to_string(loot.id));
+        WriteLootState(writer, loot.type, loot.position);
+    }
+    writer.EndObject();
+}
+
+//Body of /api/v1/game/state
+template <typename DynamicBuffer>
+void WriteState(DynamicBuffer& buffer, const std::vector<const model::Dog*>& dogs, const model::GameSession& session) {
+    buffer.prepare(dogs.size() * DOG_STATE_SIZE_HINT + session.GetLoot().Size() * LOOT_STATE_SIZE_HINT);
+    Writer writer{ buffer };
+    writer.BeginObject();
+    WriteStateFields(writer, dogs, session);
+    writer.EndObject();
+}
+
+//Whole state with its generation, same fields as /api/v1/game/state
+template <typename DynamicBuffer>
+void WriteStateSnapshot(DynamicBuffer& buffer, const model::GameSession& session) {
+    auto dogs = session.GetDogs();
+    buffer.prepare(dogs.size() * DOG_STATE_SIZE_HINT + session.GetLoot().Size() * LOOT_STATE_SIZE_HINT);
+    Writer writer{ buffer };
+    writer.BeginObject();
+    writer.Key("type"sv).String("snapshot"sv);
+    writer.Key("generation"sv).Uint(session.GetGeneration());
+    WriteStateFields(writer, dogs, session);
+    writer.EndObject();
+}
+
+//Changes up to the current generation: changed dogs and spawned loot are written whole
+template <typename DynamicBuffer>
+void WriteStateDelta(DynamicBuffer& buffer, const model::GameSession& session, const model::ChangeSet& changes) {
+    buffer.prepare(changes.dogs.size() * DOG_STATE_SIZE_HINT + changes.loot.size() * LOOT_STATE_SIZE_HINT);
+    Writer writer{ buffer };
+    writer.BeginObject();
+    writer.Key("type"sv).String("delta"sv);
+    writer.Key("generation"sv).Uint(session.GetGeneration());
+    writer.Key("players"sv).BeginObject();
+    for (auto id : changes.dogs) {
+        if (const auto* dog = session.FindDog(id)) {
+            writer.Key(std::to_string(id));
+            WriteDogState(writer, *dog);
+        }
+    }
+    writer.EndObject();
+    writer.Key("removedPlayers"sv).BeginArray();
+    for (auto id : changes.removed_dogs) {
+        writer.Uint(id);
+    }
+    writer.EndArray();
+    const auto& loot = session.GetLoot();
+    writer.Key("lostObjects"sv).BeginObject();
+    for (auto id : changes.loot) {
+        if (const auto* object = loot.Find(id)) {
+            writer.Key(std::to_string(id));
+            WriteLootState(writer, object->type, object->position);
+        }
+    }
+    writer.EndObject();
+    writer.Key("removedObjects"sv).BeginArray();
+    for (auto id : changes.removed_loot) {
+        writer.Uint(id);
+    }
+    writer.EndArray();
+    writer.EndObject();
+}
+
+//Body of /api/v1/game/players
+template <typename DynamicBuffer>
+void WritePlayers(DynamicBuffer& buffer, const std::vector<const model::Dog*>& dogs) {
+    Writer writer{ buffer };
+    writer.BeginObject();
+    for (const auto* dog : dogs) {
+        writer.Key(std::to_string(dog->GetId()));
+        writer.BeginArray().String("name"sv).String(dog->GetName()).EndArray();
+    }
+    writer.EndObject();
+}
+
+//Body of /api/v1/game/records, Record has name, score and playtime fields
+template <typename DynamicBuffer, typename Records>
+void WriteRecords(DynamicBuffer& buffer, const Records& records) {
+    Writer writer{ buffer };
+    writer.BeginArray();
+    for (const auto& record : records) {
+        writer.BeginObject();
+        writer.Key("name"sv).String(record.name);
+        writer.Key("score"sv).Int(record.score);
+        writer.Key("playTime"sv).Double(record.playtime);
+        writer.EndObject();
+    }
+    writer.EndArray();
+}
+
+}  // namespace json_writer
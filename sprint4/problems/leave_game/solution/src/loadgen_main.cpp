@@ -0,0 +1,341 @@
+#include "sdk.h"
+// boost.beast будет использовать std::string_view вместо boost::string_view
+#define BOOST_BEAST_USE_STD_STRING_VIEW
+
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/program_options.hpp>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "json_reader.h"
+
+/*
+ *  Нагрузочный генератор для API игры.
+ *  Каждый игрок входит в игру через /api/v1/game/join, держит своё keep-alive соединение
+ *  и шлёт запросы состояния, действий и списка игроков в заданной пропорции.
+ *  С --rate игрок шлёт запросы по расписанию (открытая модель), без него - сразу после ответа.
+ *  С --tick-period отдельное соединение двигает время через /api/v1/game/tick,
+ *  для сервера, запущенного без --tick-period.
+ *  В конце печатает число запросов, ошибок, пропускную способность и перцентили задержек по каждому запросу.
+ */
+
+using namespace std::literals;
+namespace net = boost::asio;
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace sys = boost::system;
+using tcp = net::ip::tcp;
+
+namespace {
+
+enum Endpoint {
+    JOIN,
+    STATE,
+    ACTION,
+    PLAYERS,
+    TICK,
+    ENDPOINTS_COUNT
+};
+
+constexpr std::array<std::string_view, ENDPOINTS_COUNT> ENDPOINT_NAMES{ "join"sv, "state"sv, "action"sv, "players"sv, "tick"sv };
+constexpr std::array<std::string_view, 4> MOVES{ R"({"move":"L"})"sv, R"({"move":"R"})"sv, R"({"move":"U"})"sv, R"({"move":"D"})"sv };
+constexpr std::string_view STOP = R"({"move":""})"sv;
+// Запрос к зависшему серверу считается ошибкой и не задерживает конец прогона
+constexpr auto REQUEST_TIMEOUT = 5s;
+
+struct Args {
+    std::string host = "127.0.0.1"s;
+    std::string port = "8080"s;
+    std::string map_id = "map1"s;
+    unsigned players = 100;
+    unsigned threads = 1;
+    unsigned duration = 10;
+    double rate = 0.;
+    // Веса state, action и players
+    std::array<double, 3> mix{ 6., 3., 1. };
+    unsigned tick_period = 0;
+};
+
+// Набирается отдельно каждым игроком и сливается после прогона, поэтому без блокировок
+struct Stats {
+    std::array<std::vector<std::uint32_t>, ENDPOINTS_COUNT> latencies_us;
+    std::array<size_t, ENDPOINTS_COUNT> errors{};
+
+    void Add(Endpoint endpoint, std::chrono::steady_clock::duration latency, bool ok) {
+        latencies_us[endpoint].push_back(static_cast<std::uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(latency).count()));
+        errors[endpoint] += !ok;
+    }
+
+    void Merge(const Stats& other) {
+        for (size_t i = 0; i < ENDPOINTS_COUNT; ++i) {
+            latencies_us[i].insert(latencies_us[i].end(), other.latencies_us[i].begin(), other.latencies_us[i].end());
+            errors[i] += other.errors[i];
+        }
+    }
+};
+
+std::array<double, 3> ParseMix(const std::string& mix) {
+    std::array<double, 3> weights{};
+    std::istringstream in(mix);
+    char separator;
+    if (!(in >> weights[0] >> separator >> weights[1] >> separator >> weights[2])
+        || std::ranges::any_of(weights, [](double weight) { return weight < 0.; })
+        || weights[0] + weights[1] + weights[2] <= 0.) {
+        throw std::runtime_error("Wrong mix, expected state:action:players weights"s);
+    }
+    return weights;
+}
+
+[[nodiscard]] std::optional<Args> ParseCommandLine(int argc, const char* const argv[]) {
+    namespace po = boost::program_options;
+
+    po::options_description desc{ "All options"s };
+
+    Args args;
+    std::string mix = "6:3:1"s;
+    desc.add_options()
+        ("help,h", "produce help message")
+        ("host", po::value(&args.host)->value_name("address"s), "set server address, 127.0.0.1 by default")
+        ("port", po::value(&args.port)->value_name("port"s), "set server port, 8080 by default")
+        ("map", po::value(&args.map_id)->value_name("id"s), "set map to join, map1 by default")
+        ("players,n", po::value(&args.players)->value_name("count"s), "set number of simulated players")
+        ("threads", po::value(&args.threads)->value_name("count"s), "set number of client threads")
+        ("duration,d", po::value(&args.duration)->value_name("seconds"s), "set load duration")
+        ("rate", po::value(&args.rate)->value_name("requests"s), "set requests per second of each player, 0 sends the next request right after the answer")
+        ("mix", po::value(&mix)->value_name("state:action:players"s), "set request weights, 6:3:1 by default")
+        ("tick-period", po::value(&args.tick_period)->value_name("milliseconds"s), "drive /api/v1/game/tick with this period");
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.contains("help"s)) {
+        std::cout << desc;
+        return std::nullopt;
+    }
+    if (args.players == 0 || args.threads == 0 || args.duration == 0 || args.rate < 0.) {
+        throw std::runtime_error("Wrong load parameters"s);
+    }
+    args.mix = ParseMix(mix);
+    return args;
+}
+
+// Keep-alive соединение с сервером, после ошибки переподключается
+class Connection {
+public:
+    Connection(net::any_io_executor executor, const tcp::resolver::results_type& endpoints, const Args& args)
+        : stream_(executor)
+        , endpoints_(endpoints)
+        , host_(args.host + ":"s + args.port) {
+    }
+
+    //Returns nullopt on a network error
+    net::awaitable<std::optional<http::response<http::string_body>>> Send(http::verb method, std::string_view target,
+                                                                          std::string_view body, std::string_view token = {}) {
+        http::request<http::string_body> request{ method, target, 11 };
+        request.set(http::field::host, host_);
+        if (!token.empty()) {
+            request.set(http::field::authorization, "Bearer "s.append(token));
+        }
+        if (method == http::verb::post) {
+            request.set(http::field::content_type, "application/json"sv);
+            request.body() = body;
+        }
+        request.prepare_payload();
+
+        sys::error_code ec;
+        if (!connected_) {
+            stream_.expires_after(REQUEST_TIMEOUT);
+            co_await stream_.async_connect(endpoints_, net::redirect_error(net::use_awaitable, ec));
+            if (ec) {
+                co_return std::nullopt;
+            }
+            connected_ = true;
+        }
+        stream_.expires_after(REQUEST_TIMEOUT);
+        co_await http::async_write(stream_, request, net::redirect_error(net::use_awaitable, ec));
+        http::response<http::string_body> response;
+        if (!ec) {
+            co_await http::async_read(stream_, buffer_, response, net::redirect_error(net::use_awaitable, ec));
+        }
+        stream_.expires_never();
+        if (ec || response.need_eof()) {
+            sys::error_code ignored;
+            stream_.socket().close(ignored);
+            buffer_.clear();
+            connected_ = false;
+        }
+        if (ec) {
+            co_return std::nullopt;
+        }
+        co_return response;
+    }
+
+private:
+    beast::tcp_stream stream_;
+    tcp::resolver::results_type endpoints_;
+    std::string host_;
+    beast::flat_buffer buffer_;
+    bool connected_ = false;
+};
+
+using Clock = std::chrono::steady_clock;
+
+net::awaitable<void> RunPlayer(const Args& args, const tcp::resolver::results_type& endpoints, unsigned index,
+                               Clock::time_point deadline, Stats& stats) {
+    auto executor = co_await net::this_coro::executor;
+    Connection connection{ executor, endpoints, args };
+
+    std::string join_body = R"({"userName":"bot)"s + std::to_string(index) + R"(","mapId":")"s + args.map_id + R"("})"s;
+    auto start = Clock::now();
+    auto joined = co_await connection.Send(http::verb::post, "/api/v1/game/join"sv, join_body);
+    json_reader::Field token;
+    const bool ok = joined && joined->result() == http::status::ok
+        && json_reader::ReadObject(joined->body(), { { "authToken"sv, &token } }) && token.kind == json_reader::Field::STRING;
+    stats.Add(JOIN, Clock::now() - start, ok);
+    if (!ok) {
+        co_return;
+    }
+    const std::string auth_token(token.string);
+
+    std::mt19937 random{ index };
+    std::discrete_distribution<int> pick{ args.mix.begin(), args.mix.end() };
+    net::steady_timer timer{ executor };
+    const auto interval = args.rate > 0. ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1. / args.rate)) : Clock::duration{};
+    // Игроки стартуют вразброс, чтобы не приходить к серверу пачками
+    auto next = Clock::now() + (args.rate > 0. ? interval * (index % 100) / 100 : Clock::duration{});
+    while (Clock::now() < deadline) {
+        if (args.rate > 0.) {
+            timer.expires_at(next);
+            sys::error_code ec;
+            co_await timer.async_wait(net::redirect_error(net::use_awaitable, ec));
+            // Задержка считается от запланированного момента, иначе медленный сервер занижал бы её
+            start = next;
+            next += interval;
+        }
+        else {
+            start = Clock::now();
+        }
+        const auto endpoint = static_cast<Endpoint>(STATE + pick(random));
+        std::optional<http::response<http::string_body>> response;
+        switch (endpoint) {
+        case STATE:
+            response = co_await connection.Send(http::verb::get, "/api/v1/game/state"sv, {}, auth_token);
+            break;
+        case ACTION: {
+            const auto move = random() % (MOVES.size() + 1);
+            response = co_await connection.Send(http::verb::post, "/api/v1/game/player/action"sv,
+                                                move < MOVES.size() ? MOVES[move] : STOP, auth_token);
+            break;
+        }
+        default:
+            response = co_await connection.Send(http::verb::get, "/api/v1/game/players"sv, {}, auth_token);
+            break;
+        }
+        stats.Add(endpoint, Clock::now() - start, response && response->result() == http::status::ok);
+    }
+}
+
+net::awaitable<void> RunTicker(const Args& args, const tcp::resolver::results_type& endpoints,
+                               Clock::time_point deadline, Stats& stats) {
+    auto executor = co_await net::this_coro::executor;
+    Connection connection{ executor, endpoints, args };
+    net::steady_timer timer{ executor };
+    const std::string body = R"({"timeDelta":)"s + std::to_string(args.tick_period) + "}"s;
+    auto next = Clock::now();
+    while (Clock::now() < deadline) {
+        next += std::chrono::milliseconds(args.tick_period);
+        timer.expires_at(next);
+        sys::error_code ec;
+        co_await timer.async_wait(net::redirect_error(net::use_awaitable, ec));
+        auto start = Clock::now();
+        auto response = co_await connection.Send(http::verb::post, "/api/v1/game/tick"sv, body);
+        stats.Add(TICK, Clock::now() - start, response && response->result() == http::status::ok);
+    }
+}
+
+double Percentile(const std::vector<std::uint32_t>& sorted, double rank) {
+    if (sorted.empty()) {
+        return 0.;
+    }
+    return sorted[std::min(sorted.size() - 1, static_cast<size_t>(rank * sorted.size()))] / 1000.;
+}
+
+void PrintReport(Stats& total, double seconds) {
+    std::cout << std::left << std::setw(10) << "endpoint"sv << std::right << std::setw(10) << "requests"sv
+              << std::setw(10) << "errors"sv << std::setw(12) << "req/s"sv << std::setw(10) << "p50 ms"sv
+              << std::setw(10) << "p90 ms"sv << std::setw(10) << "p99 ms"sv << std::setw(10) << "max ms"sv << '\n';
+    std::cout << std::fixed << std::setprecision(2);
+    for (size_t i = 0; i < ENDPOINTS_COUNT; ++i) {
+        auto& latencies = total.latencies_us[i];
+        if (latencies.empty()) {
+            continue;
+        }
+        std::ranges::sort(latencies);
+        std::cout << std::left << std::setw(10) << ENDPOINT_NAMES[i] << std::right << std::setw(10) << latencies.size()
+                  << std::setw(10) << total.errors[i] << std::setw(12) << latencies.size() / seconds
+                  << std::setw(10) << Percentile(latencies, 0.5) << std::setw(10) << Percentile(latencies, 0.9)
+                  << std::setw(10) << Percentile(latencies, 0.99) << std::setw(10) << latencies.back() / 1000. << '\n';
+    }
+    std::cout.flush();
+}
+
+}  // namespace
+
+int main(int argc, const char* argv[]) {
+    try {
+        auto args = ParseCommandLine(argc, argv);
+        if (!args) {
+            return EXIT_SUCCESS;
+        }
+
+        net::io_context ioc(static_cast<int>(args->threads));
+        tcp::resolver resolver{ ioc };
+        const auto endpoints = resolver.resolve(args->host, args->port);
+
+        std::vector<Stats> stats(args->players + 1);
+        const auto start = Clock::now();
+        const auto deadline = start + std::chrono::seconds(args->duration);
+        if (args->tick_period > 0) {
+            net::co_spawn(ioc, RunTicker(*args, endpoints, deadline, stats.back()), net::detached);
+        }
+        for (unsigned i = 0; i < args->players; ++i) {
+            net::co_spawn(ioc, RunPlayer(*args, endpoints, i, deadline, stats[i]), net::detached);
+        }
+
+        std::vector<std::jthread> workers;
+        for (unsigned i = 1; i < args->threads; ++i) {
+            workers.emplace_back([&ioc] {
+                ioc.run();
+            });
+        }
+        ioc.run();
+        workers.clear();
+        const std::chrono::duration<double> elapsed = Clock::now() - start;
+
+        Stats total;
+        for (const auto& player_stats : stats) {
+            total.Merge(player_stats);
+        }
+        PrintReport(total, elapsed.count());
+    } catch (const std::exception& ex) {
+        std::cerr << ex.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+}
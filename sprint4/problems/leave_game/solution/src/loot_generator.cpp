@@ -19,4 +19,50 @@ unsigned LootGenerator::Generate(TimeInterval time_delta, unsigned loot_count,
     return generated_loot;
 }
 
+void BatchLootGenerator::Resize(size_t sessions_count) {
+    time_without_loot_.resize(sessions_count);
+    factors_.resize(sessions_count, 1.0);
+    if (seed_) {
+        streams_.reserve(sessions_count);
+        while (streams_.size() < sessions_count) {
+            streams_.push_back(MakeStream(*seed_, streams_.size()));
+        }
+        streams_.resize(sessions_count);
+    }
+}
+
+void BatchLootGenerator::Seed(std::optional<std::uint64_t> seed) {
+    seed_ = seed;
+    streams_.clear();
+    std::ranges::fill(factors_, 1.0);
+    Resize(Size());
+}
+
+void BatchLootGenerator::Generate(TimeInterval time_delta, std::span<const unsigned> loot_counts,
+                                  std::span<const unsigned> looter_counts, std::span<unsigned> generated) {
+    const size_t count = time_without_loot_.size();
+    if (seed_) {
+        std::uniform_real_distribution<double> factor{0.0, 1.0};
+        for (size_t i = 0; i < count; ++i) {
+            factors_[i] = factor(streams_[i]);
+        }
+    }
+    // Без ветвлений, кроме std::clamp, по плоским массивам
+    for (size_t i = 0; i < count; ++i) {
+        time_without_loot_[i] += time_delta.count();
+        const unsigned loot_shortage = loot_counts[i] > looter_counts[i] ? 0u : looter_counts[i] - loot_counts[i];
+        const double ratio = std::chrono::duration<double>{TimeInterval{time_without_loot_[i]}} / base_interval_;
+        const double probability
+            = std::clamp((1.0 - std::pow(1.0 - probability_, ratio)) * factors_[i], 0.0, 1.0);
+        generated[i] = static_cast<unsigned>(std::round(loot_shortage * probability));
+        time_without_loot_[i] = generated[i] > 0 ? 0 : time_without_loot_[i];
+    }
+}
+
+BatchLootGenerator::Random BatchLootGenerator::MakeStream(std::uint64_t seed, size_t index) {
+    std::seed_seq sequence{static_cast<std::uint32_t>(seed), static_cast<std::uint32_t>(seed >> 32),
+                           static_cast<std::uint32_t>(index), static_cast<std::uint32_t>(std::uint64_t{index} >> 32)};
+    return Random{sequence};
+}
+
 } // namespace loot_gen
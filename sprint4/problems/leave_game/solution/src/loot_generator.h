@@ -1,6 +1,11 @@
 #pragma once
 #include <chrono>
+#include <cstdint>
 #include <functional>
+#include <optional>
+#include <random>
+#include <span>
+#include <vector>
 
 namespace loot_gen {
 
@@ -35,6 +40,14 @@ public:
      */
     unsigned Generate(TimeInterval time_delta, unsigned loot_count, unsigned looter_count);
 
+    TimeInterval GetBaseInterval() const noexcept {
+        return base_interval_;
+    }
+
+    double GetProbability() const noexcept {
+        return probability_;
+    }
+
 private:
     static double DefaultGenerator() noexcept {
         return 1.0;
@@ -45,4 +58,51 @@ private:
     RandomGenerator random_generator_;
 };
 
+/*
+ *  Генератор трофеев сразу для всех игровых сессий, считает их за один проход.
+ *  Для каждой сессии результат тот же, что у отдельного LootGenerator,
+ *  но у каждой сессии своё время без трофеев и свой поток случайных чисел,
+ *  поэтому сессии не влияют друг на друга.
+ *  Без seed случайный множитель равен 1, как у LootGenerator по умолчанию.
+ */
+class BatchLootGenerator {
+public:
+    using TimeInterval = LootGenerator::TimeInterval;
+    using Random = std::mt19937_64;
+
+    BatchLootGenerator(TimeInterval base_interval, double probability, std::optional<std::uint64_t> seed = std::nullopt)
+        : base_interval_{base_interval}
+        , probability_{probability}
+        , seed_{seed} {
+    }
+
+    //New sessions get their own streams, existing ones keep their state
+    void Resize(size_t sessions_count);
+
+    //Restarts the streams of all sessions, nullopt turns the random factor off
+    void Seed(std::optional<std::uint64_t> seed);
+
+    size_t Size() const noexcept {
+        return time_without_loot_.size();
+    }
+
+    /*
+     * Для каждой сессии i записывает в generated[i] количество новых трофеев.
+     * loot_counts, looter_counts и generated - по одному элементу на сессию, не меньше Size()
+     */
+    void Generate(TimeInterval time_delta, std::span<const unsigned> loot_counts,
+                  std::span<const unsigned> looter_counts, std::span<unsigned> generated);
+
+    //Stream of random factors of session index for the given seed
+    static Random MakeStream(std::uint64_t seed, size_t index);
+
+private:
+    TimeInterval base_interval_;
+    double probability_;
+    std::optional<std::uint64_t> seed_;
+    std::vector<TimeInterval::rep> time_without_loot_;
+    std::vector<Random> streams_;
+    std::vector<double> factors_;
+};
+
 }  // namespace loot_gen
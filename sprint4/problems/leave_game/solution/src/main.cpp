@@ -5,13 +5,18 @@
 #include <filesystem>
 #include <iostream>
 #include <optional>
+#include <pthread.h>
 #include <thread>
 
 #include "json_loader.h"
 #include "model_serialization.h"
+#include "replay.h"
 #include "request_handler.h"
+#include "router.h"
 #include "stat_saver_impl.h"
+#include "tick_budget.h"
 #include "ticker.h"
+#include "trace.h"
 
 using namespace std::literals;
 namespace net = boost::asio;
@@ -32,6 +37,16 @@ struct Args {
     int saving_period;
     bool auto_save = false;
     bool no_saving_file = false;
+    bool io_context_per_core = false;
+    bool metrics = false;
+    std::optional<std::uint64_t> seed;
+    std::string record_path;
+    std::string trace_path = "trace.json"s;
+    http_server::ConnectionLimits connection_limits;
+    http_handler::OverloadLimits overload_limits;
+    tick_budget::Config tick_budget;
+    std::optional<size_t> shard_index;
+    std::vector<std::string> shard_maps;
 };
 
 [[nodiscard]] std::optional<Args> ParseCommandLine(int argc, const char* const argv[]) {
@@ -40,6 +55,18 @@ struct Args {
     po::options_description desc{ "All options"s };
 
     Args args;
+    size_t max_connections = args.connection_limits.max_sessions;
+    size_t max_connections_per_ip = args.connection_limits.max_sessions_per_ip;
+    int idle_timeout = args.connection_limits.idle_timeout.count();
+    int header_timeout = args.connection_limits.header_timeout.count();
+    int body_timeout = args.connection_limits.body_timeout.count();
+    size_t max_strand_queue = 0;
+    int max_tick_lag = 0;
+    std::uint64_t seed = 0;
+    unsigned tick_budget_us = 0;
+    unsigned max_tick_stretch = 0;
+    size_t shard_index = 0;
+    std::string shard_maps;
     desc.add_options()
         // Добавляем опцию --help и её короткую версию -h
         ("help,h", "produce help message")
@@ -48,7 +75,24 @@ struct Args {
         ("www-root,w", po::value(&args.static_path)->value_name("path"s), "set static files root")
         ("randomize-spawn-points", "spawn dogs at random positions")
         ("state-file", po::value(&args.state_path)->value_name("path"s), "set saving file path")
-        ("save-state-period", po::value(&args.saving_period)->value_name("milliseconds"s), "set autosave period");
+        ("save-state-period", po::value(&args.saving_period)->value_name("milliseconds"s), "set autosave period")
+        ("io-context-per-core", "run a pinned io_context with its own SO_REUSEPORT acceptor on every core")
+        ("metrics", "serve operator counters at /api/v1/metrics, which has no authentication")
+        ("seed", po::value(&seed)->value_name("number"s), "make spawn points, loot and tokens reproducible")
+        ("record", po::value(&args.record_path)->value_name("path"s), "record joins, actions and ticks for game_replay")
+        ("trace-file", po::value(&args.trace_path)->value_name("path"s), "set where SIGUSR1 writes the trace, trace.json by default")
+        ("max-connections", po::value(&max_connections)->value_name("count"s), "set open connections limit")
+        ("max-connections-per-ip", po::value(&max_connections_per_ip)->value_name("count"s), "set open connections limit for one address, 0 is unlimited")
+        ("idle-timeout", po::value(&idle_timeout)->value_name("milliseconds"s), "set keep-alive connection idle timeout")
+        ("header-timeout", po::value(&header_timeout)->value_name("milliseconds"s), "set request header read timeout")
+        ("body-timeout", po::value(&body_timeout)->value_name("milliseconds"s), "set request body read timeout")
+        ("max-strand-queue", po::value(&max_strand_queue)->value_name("count"s), "answer 503 when so many API requests wait for the game strand, 0 is off")
+        ("max-tick-lag", po::value(&max_tick_lag)->value_name("milliseconds"s), "answer 503 when the game tick is late by more, 0 is off")
+        ("tick-budget", po::value(&tick_budget_us)->value_name("microseconds"s), "defer parts of the game while ticks run longer on average, 0 is off")
+        ("degraded-broadcast-interval", po::value(&args.tick_budget.broadcast_interval)->value_name("ticks"s), "broadcast state once in so many ticks over the budget, 4 by default, 1 is off")
+        ("max-tick-stretch", po::value(&max_tick_stretch)->value_name("milliseconds"s), "lengthen the tick period by so much over the budget, 0 is off")
+        ("shard-index", po::value(&shard_index)->value_name("number"s), "run as the shard with this index behind game_router")
+        ("shard-maps", po::value(&shard_maps)->value_name("map1,map2"s), "serve only these maps, goes with --shard-index");
 
     po::variables_map vm;
     po::store(po::parse_command_line(argc, argv, desc), vm);
@@ -73,12 +117,46 @@ struct Args {
     if (vm.contains("randomize-spawn-points")) {
         args.randomize_spawn = true;
     }
+    if (vm.contains("io-context-per-core"s)) {
+        args.io_context_per_core = true;
+    }
+    if (vm.contains("metrics"s)) {
+        args.metrics = true;
+    }
+    if (vm.contains("seed"s)) {
+        args.seed = seed;
+    }
     if (!vm.contains("state-file"s)) {
         args.no_saving_file = true;
     }
     if (!args.no_saving_file && vm.contains("save-state-period"s)) {
         args.auto_save = true;
     }
+    if (max_connections == 0 || idle_timeout < 1 || header_timeout < 1 || body_timeout < 1 || max_tick_lag < 0) {
+        throw std::runtime_error("Wrong connection limits"s);
+    }
+    args.connection_limits.max_sessions = max_connections;
+    args.connection_limits.max_sessions_per_ip = max_connections_per_ip;
+    args.connection_limits.idle_timeout = std::chrono::milliseconds(idle_timeout);
+    args.connection_limits.header_timeout = std::chrono::milliseconds(header_timeout);
+    args.connection_limits.body_timeout = std::chrono::milliseconds(body_timeout);
+    args.overload_limits.max_strand_queue = max_strand_queue;
+    args.overload_limits.max_tick_lag = std::chrono::milliseconds(max_tick_lag);
+    if (args.tick_budget.broadcast_interval == 0) {
+        throw std::runtime_error("Wrong tick budget"s);
+    }
+    args.tick_budget.budget = std::chrono::microseconds(tick_budget_us);
+    args.tick_budget.max_period_stretch = std::chrono::milliseconds(max_tick_stretch);
+    if (vm.contains("shard-index"s) != vm.contains("shard-maps"s)) {
+        throw std::runtime_error("Shard index and shard maps go together"s);
+    }
+    if (vm.contains("shard-index"s)) {
+        args.shard_index = shard_index;
+        args.shard_maps = router::SplitList(shard_maps);
+        if (args.shard_maps.empty()) {
+            throw std::runtime_error("No shard maps"s);
+        }
+    }
 
     // С опциями программы всё в порядке, возвращаем структуру args
     return args;
@@ -97,6 +175,54 @@ void RunWorkers(unsigned n, const Fn& fn) {
     fn();
 }
 
+// Ошибку не считаем фатальной: в контейнере часть ядер может быть недоступна
+void PinThisThread(unsigned core) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+}
+
+// Поток i обслуживает только contexts[i] и закреплён за ядром i
+void RunPerCoreWorkers(const std::vector<net::io_context*>& contexts) {
+    std::vector<std::jthread> workers;
+    workers.reserve(contexts.size() - 1);
+    for (unsigned i = 1; i < contexts.size(); ++i) {
+        workers.emplace_back([context = contexts[i], i] {
+            PinThisThread(i);
+            context->run();
+        });
+    }
+    PinThisThread(0);
+    contexts[0]->run();
+}
+
+// Первый SIGUSR1 включает трассировку, следующий выключает её и записывает события в файл
+void WaitTraceToggle(net::signal_set& signals, const std::string& trace_path) {
+    signals.async_wait([&signals, &trace_path](const sys::error_code& ec, [[maybe_unused]] int signal_number) {
+        if (ec) {
+            return;
+        }
+        if (!trace::IsEnabled()) {
+            trace::Start();
+            BOOST_LOG_TRIVIAL(info) << logging::add_value(additional_data, boost::json::value{ {"path"s, trace_path} })
+                << "tracing started"sv;
+        }
+        else {
+            trace::Stop();
+            try {
+                trace::Dump(trace_path);
+                BOOST_LOG_TRIVIAL(info) << logging::add_value(additional_data, boost::json::value{ {"path"s, trace_path} })
+                    << "trace written"sv;
+            } catch (const std::exception& ex) {
+                BOOST_LOG_TRIVIAL(error) << logging::add_value(additional_data, boost::json::value{ {"text"s, ex.what()}, {"where"s, "trace"s} })
+                    << "error"sv;
+            }
+        }
+        WaitTraceToggle(signals, trace_path);
+    });
+}
+
 void InitLogger() {
     logging::add_console_log(
         std::cout,
@@ -132,51 +258,107 @@ int main(int argc, const char* argv[]) {
         });
         database::InitializeDB(shared_pool);
         auto stat_saver = std::make_shared<model::StatSaverImpl>(shared_pool);
-        app::Application app{std::move(json_loader::LoadGame(args->config_path)), args->randomize_spawn, stat_saver};
+        // Запись без seed тоже должна повторяться, поэтому seed выбирается здесь и сохраняется в неё
+        if (!args->record_path.empty() && !args->seed) {
+            args->seed = std::random_device{}();
+        }
+        auto game = json_loader::LoadGame(args->config_path);
+        if (args->shard_index) {
+            // Запись воспроизводит игру со всеми картами и обычными токенами
+            if (!args->record_path.empty()) {
+                throw std::runtime_error("Recording needs a game without shards"s);
+            }
+            game.KeepMaps({ args->shard_maps.begin(), args->shard_maps.end() });
+        }
+        app::Application app{std::move(game), args->randomize_spawn, stat_saver, args->seed};
+        if (args->shard_index) {
+            app.SetTokenPrefix(router::MakeTokenPrefix(*args->shard_index));
+        }
 
         auto sl = std::make_shared<serialization::SerializingListener>(static_cast<unsigned>(args->saving_period), args->state_path, app);
 
         if (args->auto_save) {
-            app.SetAppListener(sl);
+            app.AddAppListener(sl);
         }
         
         if (!args->no_saving_file && std::filesystem::exists(args->state_path)) {
+            if (!args->record_path.empty()) {
+                throw std::runtime_error("Recording needs a game without saved state"s);
+            }
             serialization::Deserialize(args->state_path, app);
         }
 
+        std::shared_ptr<tick_budget::Controller> budget;
+        if (args->tick_budget.budget.count() != 0) {
+            if (!args->record_path.empty()) {
+                throw std::runtime_error("Recording needs ticks without a budget"s);
+            }
+            budget = std::make_shared<tick_budget::Controller>(args->tick_budget);
+            app.SetTickBudget(budget);
+        }
+
+        if (!args->record_path.empty()) {
+            app.SetInputListener(std::make_shared<replay::Recorder>(args->record_path, replay::Header{ *args->seed, args->randomize_spawn }));
+        }
+
         // 2. Инициализируем io_context
-        net::io_context ioc(num_threads);
+        // В режиме io-context-per-core в ioc живут strand игры и таймеры, а соединения
+        // делятся между ним и контекстами остальных ядер, каждый из которых работает в одном потоке
+        const unsigned io_threads = std::max(1u, num_threads);
+        net::io_context ioc(args->io_context_per_core ? 1 : io_threads);
+        std::vector<std::unique_ptr<net::io_context>> core_contexts;
+        std::vector<net::io_context*> contexts{ &ioc };
+        if (args->io_context_per_core) {
+            for (unsigned i = 1; i < io_threads; ++i) {
+                contexts.push_back(core_contexts.emplace_back(std::make_unique<net::io_context>(1)).get());
+            }
+        }
 
         // 3. Добавляем асинхронный обработчик сигналов SIGINT и SIGTERM
         net::signal_set signals(ioc, SIGINT, SIGTERM);
-        signals.async_wait([&ioc, &args, &app](const sys::error_code& ec, [[maybe_unused]] int signal_number) {
+        signals.async_wait([&contexts, &args, &app](const sys::error_code& ec, [[maybe_unused]] int signal_number) {
             if (!ec) {
                 std::cout << "Signal "sv << signal_number << " received"sv << std::endl;
-                ioc.stop();
+                for (auto* context : contexts) {
+                    context->stop();
+                }
             }
         });
 
+        net::signal_set trace_signals(ioc, SIGUSR1);
+        WaitTraceToggle(trace_signals, args->trace_path);
+
         // 4. Создаём обработчик HTTP-запросов и связываем его с моделью игры
         auto stat_provider = std::make_shared<database::StatProvider>(shared_pool);
         auto handler = std::make_shared<http_handler::RequestHandler>(app, args->static_path.data(), ioc, args->no_auto_tick, stat_provider);
         http_handler::LoggingRequestHandler log_handler{handler};
+        auto governor = std::make_shared<http_server::ConnectionGovernor>(args->connection_limits);
 
+        std::shared_ptr<ticker::Ticker> ticker;
         if (!args->no_auto_tick) {
             if (args->tick_time < 1) {
                 throw std::runtime_error("Wrong tick time");
             }
-            auto ticker = std::make_shared<ticker::Ticker>(handler->GetStrand(), std::chrono::milliseconds(args->tick_time),
+            ticker = std::make_shared<ticker::Ticker>(handler->GetStrand(), std::chrono::milliseconds(args->tick_time),
                 [&app](std::chrono::milliseconds delta) { app.Tick(delta.count()); }
             );
+            ticker->SetBudget(budget);
             ticker->Start();
         }
+        handler->SetOverloadControl(args->overload_limits, governor, ticker);
+        handler->SetTickBudget(budget);
+        if (args->metrics) {
+            handler->EnableMetrics();
+        }
 
         // 5. Запустить обработчик HTTP-запросов, делегируя их обработчику запросов
         const auto address = net::ip::make_address("0.0.0.0");
         constexpr net::ip::port_type port = 8080;
-        http_server::ServeHttp(ioc, {address, port}, [&log_handler](auto&& req, auto&& send, const net::ip::address& address) {
-            log_handler(std::forward<decltype(req)>(req), std::forward<decltype(send)>(send), address);
-        });
+        for (auto* context : contexts) {
+            http_server::ServeHttp(*context, {address, port}, governor, [&log_handler](auto&& req, auto&& send, const net::ip::address& address) {
+                log_handler(std::forward<decltype(req)>(req), std::forward<decltype(send)>(send), address);
+            }, { args->io_context_per_core });
+        }
 
         // Эта надпись сообщает тестам о том, что сервер запущен и готов обрабатывать запросы
         boost::json::value starting_data{ {"port"s, port}, {"address"s, address.to_string()} };
@@ -184,9 +366,14 @@ int main(int argc, const char* argv[]) {
             << "server started"sv;
 
         // 6. Запускаем обработку асинхронных операций
-        RunWorkers(std::max(1u, num_threads), [&ioc] {
-            ioc.run();
-        });
+        if (args->io_context_per_core) {
+            RunPerCoreWorkers(contexts);
+        }
+        else {
+            RunWorkers(io_threads, [&ioc] {
+                ioc.run();
+            });
+        }
 
         if (!args->no_saving_file) {
             serialization::Serialize(args->state_path, app);
@@ -1,5 +1,6 @@
 #include "model.h"
 
+#include <algorithm>
 #include <cmath>
 #include <stdexcept>
 #include <unordered_set>
@@ -26,6 +27,22 @@ namespace model {
         }
     }
 
+    void Game::KeepMaps(const std::vector<Map::Id>& ids) {
+        std::vector<Map> kept;
+        MapIdToIndex index;
+        for (const auto& id : ids) {
+            auto it = map_id_to_index_.find(id);
+            if (it == map_id_to_index_.end()) {
+                throw std::invalid_argument("Map with id "s + *id + " doesn't exist"s);
+            }
+            if (index.emplace(id, kept.size()).second) {
+                kept.push_back(std::move(maps_[it->second]));
+            }
+        }
+        maps_ = std::move(kept);
+        map_id_to_index_ = std::move(index);
+    }
+
     void Game::AddMap(Map map) {
         const size_t index = maps_.size();
         if (auto [it, inserted] = map_id_to_index_.emplace(map.GetId(), index); !inserted) {
@@ -44,44 +61,180 @@ namespace model {
 
     std::vector<const Dog*> GameSession::GetDogs() const {
         std::vector<const Dog*> result;
-        for (const auto& [id, dog] : dogs_) {
+        result.reserve(dogs_.Size());
+        for (const auto& dog : dogs_) {
             result.emplace_back(&dog);
         }
         return result;
     }
 
-    Dog* GameSession::AddDog(Dog&& dog) {
-        auto roads = map_->GetRoads();
+    GameSession::DogHandle GameSession::SpawnDog(Dog&& dog) {
         if (randomize_spawn_) {
-            std::default_random_engine generator(roads.size());
-            std::uniform_int_distribution rand_road{ 0, static_cast<int>(roads.size()) - 1 };
-            auto& road = roads[rand_road(generator)];
-            if (road.IsHorizontal()) {
-                std::uniform_real_distribution rand_pos{ static_cast<double>(road.GetStart().x), static_cast<double>(road.GetEnd().x) };
-                dog.SetPosition({ rand_pos(generator), static_cast<double>(road.GetStart().y) });
-            }
-            else {
-                std::uniform_real_distribution rand_pos{ static_cast<double>(road.GetStart().y), static_cast<double>(road.GetEnd().y) };
-                dog.SetPosition({ static_cast<double>(road.GetStart().x), rand_pos(generator) });
-            }
+            dog.SetPosition(road_sampler_.SamplePoint(random_));
         }
         else {
-            const auto& road_start = roads[0].GetStart();
+            const auto& road_start = map_->GetRoads()[0].GetStart();
             dog.SetPosition({ static_cast<double>(road_start.x), static_cast<double>(road_start.y) });
         }
         dog.SetObserver(this);
         dog.ResetDirection();
         dog.Stop();
         auto id = dog.GetId();
-        dogs_.insert({id, std::move(dog)});
-        dogs_playtime_[id];
-        return &dogs_.at(id);
+        auto handle = dogs_.Insert(std::move(dog));
+        dog_handles_[id] = handle;
+        joined_at_[id] = clock_;
+        changes_.DogChanged(id);
+        return handle;
+    }
+
+    namespace {
+
+    template <typename Id>
+    void SortUnique(std::vector<Id>& ids) {
+        std::sort(ids.begin(), ids.end());
+        ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    }
+
+    template <typename Id>
+    void EraseSorted(std::vector<Id>& ids, const std::vector<Id>& sorted_to_erase) {
+        std::erase_if(ids, [&sorted_to_erase](Id id) {
+            return std::binary_search(sorted_to_erase.begin(), sorted_to_erase.end(), id);
+        });
+    }
+
+    void Normalize(ChangeSet& changes) {
+        SortUnique(changes.removed_dogs);
+        SortUnique(changes.removed_loot);
+        SortUnique(changes.dogs);
+        SortUnique(changes.loot);
+        EraseSorted(changes.dogs, changes.removed_dogs);
+        EraseSorted(changes.loot, changes.removed_loot);
+    }
+
+    void Append(ChangeSet& to, const ChangeSet& from) {
+        to.dogs.insert(to.dogs.end(), from.dogs.begin(), from.dogs.end());
+        to.removed_dogs.insert(to.removed_dogs.end(), from.removed_dogs.begin(), from.removed_dogs.end());
+        to.loot.insert(to.loot.end(), from.loot.begin(), from.loot.end());
+        to.removed_loot.insert(to.removed_loot.end(), from.removed_loot.begin(), from.removed_loot.end());
+    }
+
+    }  // namespace
+
+    void ChangeLog::Seal() {
+        ++generation_;
+        Normalize(open_);
+        // Меняем местами, чтобы открытый набор переиспользовал память вытесненного поколения
+        auto& sealed = ring_[generation_ % CAPACITY];
+        std::swap(sealed, open_);
+        open_.Clear();
+    }
+
+    bool ChangeLog::CollectSince(Generation since, ChangeSet& result) const {
+        result.Clear();
+        if (since > generation_ || generation_ - since > CAPACITY) {
+            return false;
+        }
+        for (Generation generation = since + 1; generation <= generation_; ++generation) {
+            Append(result, ring_[generation % CAPACITY]);
+        }
+        Append(result, open_);
+        Normalize(result);
+        return true;
     }
 
     size_t Dog::start_id_ = 0;
 
-    GameSession::GameSession(Map* map, bool randomize_spawn, unsigned dog_retirement_time, std::shared_ptr<model::StatSaver> stat_saver)
+    void LootStore::Insert(LootObject object) {
+        auto [index, inserted] = index_.try_emplace(object.id, objects_.size());
+        if (inserted) {
+            objects_.push_back(object);
+        }
+        else {
+            objects_[index->second] = object;
+        }
+    }
+
+    bool LootStore::Erase(unsigned id) {
+        auto index = index_.find(id);
+        if (index == index_.end()) {
+            return false;
+        }
+        const size_t position = index->second;
+        index_.erase(index);
+        if (position != objects_.size() - 1) {
+            objects_[position] = objects_.back();
+            index_[objects_[position].id] = position;
+        }
+        objects_.pop_back();
+        return true;
+    }
+
+    RoadSampler::RoadSampler(const Map::Roads& roads) {
+        const size_t count = roads.size();
+        segments_.reserve(count);
+        double total_length = 0.;
+        for (const auto& road : roads) {
+            auto start = road.GetStart();
+            auto end = road.GetEnd();
+            Position from{ static_cast<double>(std::min(start.x, end.x)), static_cast<double>(std::min(start.y, end.y)) };
+            double length = road.IsHorizontal() ? std::abs(end.x - start.x) : std::abs(end.y - start.y);
+            segments_.push_back({ from, length, road.IsHorizontal() });
+            total_length += length;
+        }
+        columns_.resize(count);
+        if (count == 0 || total_length == 0.) {
+            // Только точки - выбираем их равновероятно
+            return;
+        }
+        std::vector<double> scaled(count);
+        std::vector<size_t> small;
+        std::vector<size_t> large;
+        for (size_t i = 0; i < count; ++i) {
+            scaled[i] = segments_[i].length * count / total_length;
+            (scaled[i] < 1. ? small : large).push_back(i);
+        }
+        while (!small.empty() && !large.empty()) {
+            auto less = small.back();
+            small.pop_back();
+            auto more = large.back();
+            large.pop_back();
+            columns_[less] = { scaled[less], more };
+            scaled[more] -= 1. - scaled[less];
+            (scaled[more] < 1. ? small : large).push_back(more);
+        }
+        // Остатки из-за погрешности округления - полные столбцы
+        for (auto i : small) {
+            columns_[i] = { 1., i };
+        }
+        for (auto i : large) {
+            columns_[i] = { 1., i };
+        }
+    }
+
+    size_t RoadSampler::SampleRoad(Random& random) const {
+        std::uniform_int_distribution<size_t> column{ 0, columns_.size() - 1 };
+        std::uniform_real_distribution<double> coin{ 0., 1. };
+        const auto index = column(random);
+        return coin(random) < columns_[index].probability ? index : columns_[index].alias;
+    }
+
+    Position RoadSampler::SamplePoint(Random& random, double max_deviation) const {
+        const auto& segment = segments_[SampleRoad(random)];
+        std::uniform_real_distribution<double> along{ 0., segment.length };
+        std::uniform_real_distribution<double> across{ -max_deviation, max_deviation };
+        const double offset = along(random);
+        const double deviation = max_deviation > 0. ? across(random) : 0.;
+        if (segment.horizontal) {
+            return { segment.start.x + offset, segment.start.y + deviation };
+        }
+        return { segment.start.x + deviation, segment.start.y + offset };
+    }
+
+    GameSession::GameSession(Map* map, bool randomize_spawn, unsigned dog_retirement_time, std::shared_ptr<model::StatSaver> stat_saver,
+                             std::optional<std::uint64_t> seed)
         : map_(map)
+        , road_sampler_(map->GetRoads())
+        , random_(seed ? *seed : std::random_device{}())
         , randomize_spawn_(randomize_spawn)
         , dog_retirement_time_(dog_retirement_time)
         , stat_saver_(stat_saver)
@@ -171,6 +324,24 @@ namespace model {
         return 0.;
     }
 
+    void GameSession::ApplyPendingActions() {
+        pending_actions_.TakeInto(applied_actions_);
+        for (const auto& action : applied_actions_) {
+            auto handle = dog_handles_.find(action.dog_id);
+            if (handle == dog_handles_.end()) {
+                continue;
+            }
+            auto& dog = *dogs_.Find(handle->second);
+            if (action.move) {
+                dog.Move(*action.move, map_->GetSpeed());
+            }
+            else {
+                dog.Stop();
+            }
+            changes_.DogChanged(action.dog_id);
+        }
+    }
+
     std::pair<bool, Position> GameSession::CalculateMove(Position pos, Speed speed, unsigned delta) const {
         double in_seconds = static_cast<double>(delta) / MILLISECONDS_IN_SECOND;
         Position end_pos = { pos.x + speed.vx * in_seconds, pos.y + speed.vy * in_seconds };
@@ -203,12 +374,12 @@ namespace model {
     std::pair<std::unordered_map<size_t, Position>, std::vector<size_t>> GameSession::CalculatePositions(unsigned delta) const {
         std::unordered_map<size_t, Position> new_positions;
         std::vector<size_t> dogs_to_stop;
-        for (auto& [id, dog] : dogs_) {
+        for (const auto& dog : dogs_) {
             if (dog.GetSpeed() != Speed{}) {
                 auto [stop, new_pos] = CalculateMove(dog.GetPosition(), dog.GetSpeed(), delta);
-                new_positions[id] = new_pos;
+                new_positions[dog.GetId()] = new_pos;
                 if (stop) {
-                    dogs_to_stop.push_back(id);
+                    dogs_to_stop.push_back(dog.GetId());
                 }
             }
         }
@@ -220,7 +391,7 @@ namespace model {
         std::unordered_map<size_t, size_t> gatherer_id_to_dog_id;
         size_t i = 0;
         for (const auto [id, pos] : calculated_positions) {
-            auto temp_start = dogs_.at(id).GetPosition();
+            auto temp_start = DogAt(id).GetPosition();
             geom::Point2D start{ temp_start.x, temp_start.y };
             auto temp_end = calculated_positions.at(id);
             geom::Point2D end{ temp_end.x, temp_end.y };
@@ -233,16 +404,23 @@ namespace model {
 
     void GameSession::UpdateDogsPositions(const std::unordered_map<size_t, Position>& positions, const std::vector<size_t>& dogs_to_stop) {
         for (const auto [id, pos] : positions) {
-            dogs_.at(id).SetPosition(pos);
+            auto& dog = DogAt(id);
+            if (dog.GetPosition() != pos) {
+                dog.SetPosition(pos);
+                changes_.DogChanged(id);
+            }
         }
         for (const auto id : dogs_to_stop) {
-            dogs_.at(id).Stop();
+            DogAt(id).Stop();
+            changes_.DogChanged(id);
         }
     }
 
     std::pair<std::vector<collision_detector::Item>, std::unordered_map<size_t, GameSession::ItemData>> GameSession::PrepareCollisionItems() const {
         std::vector<collision_detector::Item> items;
         std::unordered_map<size_t, GameSession::ItemData> item_data;
+        items.reserve(map_->GetOffices().size() + loot_.Size());
+        item_data.reserve(map_->GetOffices().size() + loot_.Size());
         size_t i = 0;
         for (const auto& office : map_->GetOffices()) {
             auto pos = office.GetPosition();
@@ -254,11 +432,11 @@ namespace model {
             item_data[i] = {ItemType::OFFICE, i};
             ++i;
         }
-        for (const auto& [id, data] : loot_map_) {
-            geom::Point2D position{ data.second.x, data.second.y };
+        for (const auto& loot : loot_) {
+            geom::Point2D position{ loot.position.x, loot.position.y };
             collision_detector::Item item{ position, CollisionWidths::ITEM_WIDTH };
             items.emplace_back(std::move(item));
-            item_data[i] = {ItemType::LOOT, id};
+            item_data[i] = {ItemType::LOOT, loot.id};
             ++i;
         }
         return {items, item_data};
@@ -270,15 +448,20 @@ namespace model {
         std::unordered_set<size_t> taken_loot;
         for (const auto& event : events) {
             auto& item_data = items_data.at(event.item_id);
-            auto& dog = dogs_.at(gatherer_id_to_dog_id.at(event.gatherer_id));
+            auto& dog = DogAt(gatherer_id_to_dog_id.at(event.gatherer_id));
             if (item_data.type == GameSession::ItemType::LOOT) {
                 if (!taken_loot.contains(item_data.outer_id) && dog.CanTakeLoot()) {
-                    dog.TakeLoot({ item_data.outer_id, loot_map_.at(item_data.outer_id).first });
+                    dog.TakeLoot({ item_data.outer_id, loot_.Find(item_data.outer_id)->type });
                     taken_loot.insert(item_data.outer_id);
-                    loot_map_.erase(item_data.outer_id);
+                    loot_.Erase(item_data.outer_id);
+                    changes_.DogChanged(dog.GetId());
+                    changes_.LootRemoved(item_data.outer_id);
                 }
             }
             else {
+                if (!dog.GetItems().empty()) {
+                    changes_.DogChanged(dog.GetId());
+                }
                 auto items = dog.TransferItems();
                 for (const auto& item : items) {
                     dog.AddScore(map_->GetValue(item.type));
@@ -288,60 +471,71 @@ namespace model {
     }
 
     void GameSession::SpawnLoot(unsigned loot_count) {
-        auto roads = map_->GetRoads();
-        std::default_random_engine generator(roads.size());
-        std::uniform_int_distribution rand_road{ 0, static_cast<int>(roads.size()) - 1 };
-        std::uniform_int_distribution rand_type{ 0, static_cast<int>(map_->GetLootTypesCount() - 1) };
+        if (loot_count == 0) {
+            return;
+        }
+        std::uniform_int_distribution rand_type{ 0u, map_->GetLootTypesCount() - 1 };
+        loot_.Reserve(loot_.Size() + loot_count);
         for (unsigned i = 0; i < loot_count; ++i) {
-            auto& road = roads[rand_road(generator)];
-            std::uniform_real_distribution deviation{-MAX_DELTA, MAX_DELTA};
-            Position loot_pos;
-            if (road.IsHorizontal()) {
-                double max = static_cast<double>(std::max(road.GetStart().x, road.GetEnd().x));
-                double min = static_cast<double>(std::min(road.GetStart().x, road.GetEnd().x));
-                std::uniform_real_distribution rand_pos{ min, max };
-                loot_pos = { rand_pos(generator), road.GetStart().y + deviation(generator)};
-            }
-            else {
-                double max = static_cast<double>(std::max(road.GetStart().y, road.GetEnd().y));
-                double min = static_cast<double>(std::min(road.GetStart().y, road.GetEnd().y));
-                std::uniform_real_distribution rand_pos{ min, max };
-                loot_pos = { road.GetStart().x + deviation(generator), rand_pos(generator) };
-            }
-            loot_map_[GetNextLootId()] = {rand_type(generator), loot_pos};
+            auto loot_pos = road_sampler_.SamplePoint(random_, MAX_DELTA);
+            auto id = GetNextLootId();
+            loot_.Insert({ id, rand_type(random_), loot_pos });
+            changes_.LootSpawned(id);
         }
-        loot_count_ += loot_count;
     }
 
     unsigned GameSession::GetNextLootId() {
         return loot_id_++;
     }
 
-    std::unordered_set<size_t> GameSession::ObserveAFKAndPlaytime(unsigned delta) {
+    void GameSession::OnAFK(size_t id) {
+        afk_since_[id] = clock_;
+        retirement_deadlines_.emplace(clock_ + dog_retirement_time_, id);
+        if (retirement_deadlines_.size() > 2 * afk_since_.size() + 64) {
+            CompactRetirementDeadlines();
+        }
+    }
+
+    std::unordered_set<size_t> GameSession::AdvanceClock(unsigned delta, bool scan_afk) {
+        clock_ += delta;
         std::unordered_set<size_t> result;
-        for (auto& [id, time] : afk_dogs_) {
-            time += delta;
-            if (time >= dog_retirement_time_) {
-                result.insert(id);
-            }
+        if (!scan_afk) {
+            return result;
         }
-        for (const auto id : result) {
-            afk_dogs_.erase(id);
+        while (!retirement_deadlines_.empty() && retirement_deadlines_.top().first <= clock_) {
+            auto [deadline, id] = retirement_deadlines_.top();
+            retirement_deadlines_.pop();
+            auto afk = afk_since_.find(id);
+            // Собака успела подвигаться или снова остановилась позже
+            if (afk == afk_since_.end() || afk->second + dog_retirement_time_ != deadline) {
+                continue;
+            }
+            afk_since_.erase(afk);
+            result.insert(id);
         }
+        return result;
+    }
 
-        for (auto& [id, time] : dogs_playtime_) {
-            time += delta;
+    // Drops stale deadlines left by dogs that keep stopping and moving
+    void GameSession::CompactRetirementDeadlines() {
+        std::vector<RetirementDeadline> deadlines;
+        deadlines.reserve(afk_since_.size());
+        for (const auto& [id, since] : afk_since_) {
+            deadlines.emplace_back(since + dog_retirement_time_, id);
         }
-
-        return result;
+        retirement_deadlines_ = decltype(retirement_deadlines_)(std::greater<>{}, std::move(deadlines));
     }
 
     void GameSession::RetireDogs(const std::unordered_set<size_t>& ids) {
         std::vector<SaveStat> stats;
         for (const auto id : ids) {
-            auto& dog = dogs_.at(id);
-            stats.emplace_back(dog.GetName(), dog.GetScore(), dogs_playtime_.at(dog.GetId()));
-            dogs_.erase(id);
+            auto handle = dog_handles_.at(id);
+            const auto& dog = *dogs_.Find(handle);
+            stats.emplace_back(dog.GetName(), dog.GetScore(), static_cast<unsigned>(clock_ - joined_at_.at(id)));
+            dogs_.Erase(handle);
+            dog_handles_.erase(id);
+            joined_at_.erase(id);
+            changes_.DogRemoved(id);
         }
         if (stats.size() != 0) {
             stat_saver_->Save(stats);
@@ -355,53 +549,107 @@ namespace app {
     Token TokensGen::GetToken() {
         std::stringstream ss;
         ss << std::hex << std::setw(16) << std::setfill('0') << generator1_() << std::setw(16) << generator2_();
-        return Token(ss.str());
+        auto token = ss.str();
+        token.replace(0, std::min(prefix_.size(), token.size()), prefix_);
+        return Token(std::move(token));
     }
 
-    Player::Player(Token&& token, model::GameSession* session, model::Dog* dog)
-        : id_(GetNextId()), session_(session), dog_(dog), token_(std::move(token)) {
+    Player::Player(Token&& token, model::GameSession* session, model::GameSession::DogHandle dog)
+        : id_(GetNextId()), session_(session), dog_(dog), dog_id_(session->GetDog(dog)->GetId()), token_(std::move(token)) {
     }
 
-    Player::Player(size_t id, Token&& token, model::GameSession* session, model::Dog* dog) 
-        : id_(id), session_(session), dog_(dog), token_(std::move(token)) {
+    Player::Player(size_t id, Token&& token, model::GameSession* session, model::GameSession::DogHandle dog)
+        : id_(id), session_(session), dog_(dog), dog_id_(session->GetDog(dog)->GetId()), token_(std::move(token)) {
             ++start_id_;
     }
 
     Player& Players::AddPlayer(model::Dog&& dog, model::GameSession* session) {
-        auto* doggy = session->AddDog(std::move(dog));
+        auto doggy = session->SpawnDog(std::move(dog));
         auto token = token_gen_.GetToken();
-        while (tokens_to_players_.contains(token)) {
+        while (GetShard(token).players.contains(token)) {
             token = token_gen_.GetToken();
         }
-        auto token_copy = token;
-        Player player(std::move(token_copy), session, doggy);
-        tokens_to_players_.emplace(token, std::move(player));
-        dogs_id_to_players_[doggy->GetId()] = &tokens_to_players_.at(token);
-        return tokens_to_players_.at(token);
+        return Insert(Player(std::move(token), session, doggy));
     }
 
     void Players::AddPlayer(size_t id, Token&& token, model::Dog&& dog, model::GameSession* session) {
-        auto* doggy = session->AddDog(std::move(dog));
-        auto token_copy = token;
-        Player player(id, std::move(token_copy), session, doggy);
-        tokens_to_players_.emplace(std::move(token), std::move(player));
-        dogs_id_to_players_[doggy->GetId()] = &tokens_to_players_.at(token);
+        auto doggy = session->SpawnDog(std::move(dog));
+        Insert(Player(id, std::move(token), session, doggy));
+    }
+
+    Player& Players::Insert(Player&& player) {
+        auto token = player.GetToken();
+        auto& shard = GetShard(token);
+        const auto dog_id = player.GetDogId();
+        auto* session = player.GetSession();
+        auto handle = players_.Insert(std::move(player));
+        dogs_id_to_players_[dog_id] = handle;
+        {
+            std::unique_lock lock{ shard.mutex };
+            shard.players.emplace(std::move(token), PlayerRef{ handle, session, dog_id });
+        }
+        return *players_.Find(handle);
     }
 
     Player* Players::FindByToken(const Token& token) {
-        auto player = tokens_to_players_.find(token);
-        if (auto player = tokens_to_players_.find(token); player != tokens_to_players_.end()) {
-            return &player->second;
+        auto& players = GetShard(token).players;
+        if (auto player = players.find(token); player != players.end()) {
+            return players_.Find(player->second.handle);
         }
         return nullptr;
     }
 
+    bool Players::HasPlayer(const Token& token) const {
+        const auto& shard = GetShard(token);
+        std::shared_lock lock{ shard.mutex };
+        return shard.players.contains(token);
+    }
+
+    bool Players::QueueAction(const Token& token, std::optional<model::Direction> move) {
+        auto& shard = GetShard(token);
+        std::shared_lock lock{ shard.mutex };
+        auto player = shard.players.find(token);
+        if (player == shard.players.end()) {
+            return false;
+        }
+        player->second.session->QueueAction({ player->second.dog_id, move });
+        return true;
+    }
+
+    void Players::RemovePlayers(const std::vector<size_t>& dogs_ids) {
+        for (const auto id : dogs_ids) {
+            auto handle = dogs_id_to_players_.at(id);
+            auto token = players_.Find(handle)->GetToken();
+            dogs_id_to_players_.erase(id);
+            auto& shard = GetShard(token);
+            {
+                std::unique_lock lock{ shard.mutex };
+                shard.players.erase(token);
+            }
+            players_.Erase(handle);
+        }
+    }
+
     size_t Player::start_id_ = 0;
 
-    Application::Application(model::Game&& game, bool randomize_spawn, std::shared_ptr<model::StatSaver> stat_saver)
+    Application::Application(model::Game&& game, bool randomize_spawn, std::shared_ptr<model::StatSaver> stat_saver,
+                             std::optional<std::uint64_t> seed)
         :game_(std::move(game))
     {
-        game_.StartSessions(randomize_spawn, stat_saver);
+        game_.StartSessions(randomize_spawn, stat_saver, seed);
+        if (seed) {
+            players_.SeedTokens(*seed);
+        }
+    }
+
+    void Application::RecordTick(unsigned millisec) {
+        const auto& sessions = game_.GetSessions();
+        for (size_t i = 0; i < sessions.size(); ++i) {
+            if (!sessions[i].GetAppliedActions().empty()) {
+                input_listener_->OnActionsApplied(i, sessions[i].GetAppliedActions());
+            }
+        }
+        input_listener_->OnTick(millisec);
     }
 
     void Application::AddPlayer(size_t player_id, Token&& token, model::Dog&& dog, const model::Map::Id& map_id) {
@@ -1,11 +1,20 @@
 #pragma once
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <compare>
+#include <cstdint>
 #include <deque>
 #include <forward_list>
+#include <functional>
 #include <iomanip>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <queue>
 #include <random>
+#include <shared_mutex>
 #include <sstream>
 #include <string>
 #include <string_view>
@@ -15,8 +24,10 @@
 #include <vector>
 
 #include "collision_detector.h"
+#include "slot_map.h"
 #include "tagged.h"
 #include "loot_generator.h"
+#include "trace.h"
 
 namespace model {
 
@@ -274,6 +285,45 @@ namespace model {
         Offices offices_;
     };
 
+    /*
+     *  Случайные точки на дорогах карты, равномерно по их длине.
+     *  Дорога выбирается по таблице псевдонимов (метод Уолкера) за O(1) с вероятностью,
+     *  пропорциональной её длине, затем точка выбирается равномерно вдоль дороги.
+     *  Дороги нулевой длины не выбираются, если на карте есть другие.
+     */
+    class RoadSampler {
+    public:
+        using Random = std::mt19937_64;
+
+        RoadSampler() = default;
+        explicit RoadSampler(const Map::Roads& roads);
+
+        bool Empty() const noexcept {
+            return columns_.empty();
+        }
+
+        //Index in the roads the sampler was built from
+        size_t SampleRoad(Random& random) const;
+
+        //Point on the road axis, shifted across the road by up to max_deviation
+        Position SamplePoint(Random& random, double max_deviation = 0.) const;
+
+    private:
+        struct Column {
+            double probability = 1.;
+            size_t alias = 0;
+        };
+
+        struct Segment {
+            Position start;
+            double length;
+            bool horizontal;
+        };
+
+        std::vector<Column> columns_;
+        std::vector<Segment> segments_;
+    };
+
     struct Item {
         size_t id;
         size_t type;
@@ -442,7 +492,8 @@ namespace model {
         }
 
     private:
-        const size_t id_;
+        // Не const, чтобы собак можно было перемещать внутри SlotMap
+        size_t id_;
         std::string name_;
         Position position_ = { 0., 0. };
         Speed speed_ = { 0., 0. };
@@ -512,9 +563,216 @@ namespace model {
         virtual void Save(const std::vector<SaveStat>& stat) = 0;
     };
 
+    //Empty move means stop
+    struct PlayerAction {
+        size_t dog_id;
+        std::optional<Direction> move;
+    };
+
+    //Collects actions from any thread, only the latest action of each dog is kept
+    class ActionBuffer {
+    public:
+        ActionBuffer() = default;
+
+        ActionBuffer(ActionBuffer&& other) {
+            std::lock_guard lock{ other.mutex_ };
+            actions_ = std::move(other.actions_);
+            dog_to_slot_ = std::move(other.dog_to_slot_);
+        }
+
+        void Push(PlayerAction action) {
+            std::lock_guard lock{ mutex_ };
+            if (auto slot = dog_to_slot_.find(action.dog_id); slot != dog_to_slot_.end()) {
+                actions_[slot->second] = action;
+                return;
+            }
+            dog_to_slot_[action.dog_id] = actions_.size();
+            actions_.push_back(action);
+        }
+
+        //Swaps buffered actions into result, capacity of both vectors is reused
+        void TakeInto(std::vector<PlayerAction>& result) {
+            result.clear();
+            std::lock_guard lock{ mutex_ };
+            actions_.swap(result);
+            dog_to_slot_.clear();
+        }
+
+    private:
+        std::mutex mutex_;
+        std::vector<PlayerAction> actions_;
+        std::unordered_map<size_t, size_t> dog_to_slot_;
+    };
+
+    //Ids of entities that changed in a game session, removed ones are listed only as removed
+    struct ChangeSet {
+        std::vector<size_t> dogs;
+        std::vector<size_t> removed_dogs;
+        std::vector<unsigned> loot;
+        std::vector<unsigned> removed_loot;
+
+        bool Empty() const {
+            return dogs.empty() && removed_dogs.empty() && loot.empty() && removed_loot.empty();
+        }
+
+        void Clear() {
+            dogs.clear();
+            removed_dogs.clear();
+            loot.clear();
+            removed_loot.clear();
+        }
+    };
+
+    /*
+     *  Кольцо изменений игровой сессии за последние CAPACITY поколений.
+     *  Каждый тик закрывает открытый набор изменений под следующим номером поколения.
+     *  Изменения между тиками (например, вход игрока) попадают в открытый набор.
+     */
+    class ChangeLog {
+    public:
+        using Generation = std::uint64_t;
+        constexpr static size_t CAPACITY = 64;
+
+        Generation GetGeneration() const {
+            return generation_;
+        }
+
+        void DogChanged(size_t id) {
+            open_.dogs.push_back(id);
+        }
+
+        void DogRemoved(size_t id) {
+            open_.removed_dogs.push_back(id);
+        }
+
+        void LootSpawned(unsigned id) {
+            open_.loot.push_back(id);
+        }
+
+        void LootRemoved(unsigned id) {
+            open_.removed_loot.push_back(id);
+        }
+
+        //Closes the open change set as the next generation
+        void Seal();
+
+        //Merges changes made after generation since, including the open set. False if the ring no longer covers since
+        bool CollectSince(Generation since, ChangeSet& result) const;
+
+    private:
+        Generation generation_ = 0;
+        //Changes of generation g are at g % CAPACITY
+        std::array<ChangeSet, CAPACITY> ring_;
+        ChangeSet open_;
+    };
+
+    struct LootObject {
+        unsigned id;
+        unsigned type;
+        Position position;
+    };
+
+    /*
+     *  Потерянные предметы сессии, лежат подряд в одном векторе.
+     *  Удаление переносит последний предмет на место удалённого, номер по id ищется в отдельной таблице.
+     *  Порядок обхода меняется при удалении.
+     */
+    class LootStore {
+    public:
+        using const_iterator = std::vector<LootObject>::const_iterator;
+
+        void Reserve(size_t size) {
+            objects_.reserve(size);
+            index_.reserve(size);
+        }
+
+        //Replaces loot with the same id
+        void Insert(LootObject object);
+
+        //False if there is no such loot
+        bool Erase(unsigned id);
+
+        const LootObject* Find(unsigned id) const {
+            auto index = index_.find(id);
+            return index == index_.end() ? nullptr : &objects_[index->second];
+        }
+
+        bool Contains(unsigned id) const {
+            return index_.contains(id);
+        }
+
+        size_t Size() const {
+            return objects_.size();
+        }
+
+        const_iterator begin() const {
+            return objects_.begin();
+        }
+
+        const_iterator end() const {
+            return objects_.end();
+        }
+
+    private:
+        std::vector<LootObject> objects_;
+        std::unordered_map<unsigned, size_t> index_;
+    };
+
+    //Time spent in the phases of GameSession::Tick, summed over ticks
+    struct TickProfile {
+        using Duration = std::chrono::steady_clock::duration;
+
+        Duration actions{};
+        Duration movement{};
+        Duration collision{};
+        Duration events{};
+        Duration spawn{};
+        Duration afk{};
+        size_t ticks = 0;
+    };
+
+    //Parts of the tick which can be put off while ticks run over their budget
+    struct TickOptions {
+        bool spawn_loot = true;
+        bool scan_afk = true;
+    };
+
+    // Без профиля и трассировки ничего не измеряет
+    class PhaseTimer {
+    public:
+        explicit PhaseTimer(TickProfile* profile)
+            : profile_(profile)
+            , traced_(trace::IsEnabled()) {
+            if (profile_ || traced_) {
+                last_ = std::chrono::steady_clock::now();
+            }
+        }
+
+        //Adds the time since the previous lap to the phase and records it as a trace span
+        void Lap(TickProfile::Duration TickProfile::* phase, const char* name) {
+            if (profile_ || traced_) {
+                auto now = std::chrono::steady_clock::now();
+                if (profile_) {
+                    profile_->*phase += now - last_;
+                }
+                if (traced_) {
+                    trace::Record({ "game", name, last_, now - last_ });
+                }
+                last_ = now;
+            }
+        }
+
+    private:
+        TickProfile* profile_;
+        bool traced_;
+        std::chrono::steady_clock::time_point last_;
+    };
+
     class GameSession : public AFKObserver {
     public:
-        explicit GameSession(Map* map, bool randomize_spawn, unsigned dog_retirement_time, std::shared_ptr<StatSaver> stat_saver);
+        //Without a seed spawn and loot positions come from std::random_device
+        explicit GameSession(Map* map, bool randomize_spawn, unsigned dog_retirement_time, std::shared_ptr<StatSaver> stat_saver,
+                             std::optional<std::uint64_t> seed = std::nullopt);
 
         using LootType = unsigned;
         using LootId = unsigned;
@@ -529,52 +787,101 @@ namespace model {
             size_t outer_id;
         };
 
-        void OnAFK(size_t id) override {
-            afk_dogs_[id] = 0;
-        }
+        void OnAFK(size_t id) override;
 
         void OnNotAFK(size_t id) override {
-            if (afk_dogs_.contains(id)) {
-                afk_dogs_.erase(id);
-            }
+            afk_since_.erase(id);
         }
 
+        using DogHandle = util::SlotMap<Dog>::Handle;
+
         std::vector<const Dog*> GetDogs() const;
 
-        Dog* AddDog(Dog&& dog);
+        const Dog* FindDog(size_t id) const {
+            auto handle = dog_handles_.find(id);
+            return handle == dog_handles_.end() ? nullptr : dogs_.Find(handle->second);
+        }
+
+        //nullptr once the dog has retired
+        Dog* GetDog(DogHandle handle) {
+            return dogs_.Find(handle);
+        }
+
+        const Dog* GetDog(DogHandle handle) const {
+            return dogs_.Find(handle);
+        }
+
+        DogHandle SpawnDog(Dog&& dog);
+
+        //The pointer is valid until dogs join or retire, keep the handle from SpawnDog for longer
+        Dog* AddDog(Dog&& dog) {
+            return dogs_.Find(SpawnDog(std::move(dog)));
+        }
 
         double GetSpeed() const {
             return map_->GetSpeed();
         }
 
-        std::unordered_set<size_t> Tick(unsigned delta, unsigned loot_count) {
+        //Thread safe, the action is applied at the beginning of the next tick
+        void QueueAction(PlayerAction action) {
+            pending_actions_.Push(action);
+        }
+
+        std::unordered_set<size_t> Tick(unsigned delta, unsigned loot_count, TickOptions options = {}) {
+            PhaseTimer timer{ profile_ };
+            ApplyPendingActions();
+            timer.Lap(&TickProfile::actions, "actions");
             auto [new_positions, dogs_to_stop] = CalculatePositions(delta);
+            timer.Lap(&TickProfile::movement, "movement");
             CollisionActorsProvider provider;
             auto [gatherers, gatherer_id_to_dog_id] = PrepareDogs(new_positions);
             provider.SetGatherers(std::move(gatherers));
             auto [items, data] = PrepareCollisionItems();
             provider.SetItems(std::move(items));
             auto events = collision_detector::FindGatherEvents(provider);
+            timer.Lap(&TickProfile::collision, "collision");
             ProcessEvents(events, data, gatherer_id_to_dog_id);
             UpdateDogsPositions(new_positions, dogs_to_stop);
+            timer.Lap(&TickProfile::events, "events");
             SpawnLoot(loot_count);
-            auto dogs_to_retire = ObserveAFKAndPlaytime(delta);
+            timer.Lap(&TickProfile::spawn, "spawn");
+            auto dogs_to_retire = AdvanceClock(delta, options.scan_afk);
             if (dogs_to_retire.size() != 0) {
                 RetireDogs(dogs_to_retire);
             }
+            timer.Lap(&TickProfile::afk, "afk");
+            changes_.Seal();
+            if (profile_) {
+                ++profile_->ticks;
+            }
             return dogs_to_retire;
         }
 
-        const std::unordered_map<LootId, std::pair<LootType, Position>>& GetLootMap() const {
-            return loot_map_;
+        //Tick adds the time of its phases to the profile, nullptr turns profiling off
+        void SetTickProfile(TickProfile* profile) noexcept {
+            profile_ = profile;
+        }
+
+        //Incremented by each tick
+        ChangeLog::Generation GetGeneration() const {
+            return changes_.GetGeneration();
+        }
+
+        //False if the generation is too old or unknown, a full state is needed then
+        bool GetChangesSince(ChangeLog::Generation since, ChangeSet& changes) const {
+            return changes_.CollectSince(since, changes);
+        }
+
+        const LootStore& GetLoot() const {
+            return loot_;
         }
 
         unsigned GetLootCount() const {
-            return loot_count_;
+            return loot_.Size();
         }
 
         unsigned GetDogsCount() const {
-            return dogs_.size();
+            return dogs_.Size();
         }
 
         unsigned GetPocketsSize() {
@@ -582,27 +889,56 @@ namespace model {
         }
 
         void AddLoot(LootId id, LootType type, Position pos) {
-            loot_map_.insert({id, {type, pos}});
-            ++loot_count_;
-            ++loot_id_;
+            loot_.Insert({id, type, pos});
+            changes_.LootSpawned(id);
+            loot_id_ = std::max(loot_id_, id + 1);
         }
 
         Map::Id GetMapId() const {
             return map_->GetId();
         }
 
+        //Actions applied by the last tick, at most one per dog
+        const std::vector<PlayerAction>& GetAppliedActions() const {
+            return applied_actions_;
+        }
+
     private:
-        std::unordered_map<size_t, Dog> dogs_;
+        // Собаки лежат подряд, снаружи на них ссылаются через DogHandle
+        util::SlotMap<Dog> dogs_;
+        std::unordered_map<size_t, DogHandle> dog_handles_;
         Map* map_;
         std::unordered_map<Point, std::vector<const Road*>, PointHash> roads_graph_;
+        RoadSampler road_sampler_;
+        // Один генератор на сессию, чтобы точки появления не повторялись от вызова к вызову
+        RoadSampler::Random random_;
         bool randomize_spawn_;
-        std::unordered_map<LootId, std::pair<LootType, Position>> loot_map_;
-        std::unordered_map<size_t, unsigned> afk_dogs_;
-        std::unordered_map<size_t, unsigned> dogs_playtime_;
-        unsigned loot_count_ = 0;
+        LootStore loot_;
+        // Время сессии в миллисекундах, складывается из дельт тиков
+        std::uint64_t clock_ = 0;
+        std::unordered_map<size_t, std::uint64_t> joined_at_;
+        std::unordered_map<size_t, std::uint64_t> afk_since_;
+        // Сроки ухода на пенсию в виде min-кучи. Записи не удаляются, когда собака снова начинает двигаться,
+        // поэтому при извлечении запись сверяется с afk_since_
+        using RetirementDeadline = std::pair<std::uint64_t, size_t>;
+        std::priority_queue<RetirementDeadline, std::vector<RetirementDeadline>, std::greater<>> retirement_deadlines_;
         unsigned loot_id_ = 0;
         unsigned dog_retirement_time_;
         std::shared_ptr<model::StatSaver> stat_saver_;
+        ActionBuffer pending_actions_;
+        std::vector<PlayerAction> applied_actions_;
+        ChangeLog changes_;
+        TickProfile* profile_ = nullptr;
+
+        Dog& DogAt(size_t id) {
+            return *dogs_.Find(dog_handles_.at(id));
+        }
+
+        const Dog& DogAt(size_t id) const {
+            return *dogs_.Find(dog_handles_.at(id));
+        }
+
+        void ApplyPendingActions();
 
         std::pair<bool, Position> CalculateMove(Position pos, Speed speed, unsigned delta) const;
 
@@ -622,8 +958,10 @@ namespace model {
             , const std::unordered_map<size_t, ItemData>& items_data
             , const std::unordered_map<size_t, size_t>& gatherer_id_to_dog_id);
 
-        //Returns dog ids to retire
-        std::unordered_set<size_t> ObserveAFKAndPlaytime(unsigned delta);
+        //Returns ids of dogs whose retirement deadline has come. Without scan_afk only moves the clock, the next scan finds them
+        std::unordered_set<size_t> AdvanceClock(unsigned delta, bool scan_afk);
+
+        void CompactRetirementDeadlines();
 
         void RetireDogs(const std::unordered_set<size_t>& ids);
     };
@@ -633,12 +971,15 @@ namespace model {
         using Maps = std::vector<Map>;
 
         explicit Game(loot_gen::LootGenerator&& loot_gen, unsigned dog_retirement_time)
-            : loot_generator_(std::move(loot_gen)) 
+            : loot_generator_(loot_gen.GetBaseInterval(), loot_gen.GetProbability())
             , dog_retirement_time_(dog_retirement_time)
         { }
 
         void AddMap(Map map);
 
+        //Drops the other maps before sessions start, throws std::invalid_argument if an id is unknown
+        void KeepMaps(const std::vector<Map::Id>& ids);
+
         const Maps& GetMaps() const noexcept {
             return maps_;
         }
@@ -657,19 +998,44 @@ namespace model {
             return nullptr;
         }
 
-        void StartSessions(bool randomize_spawn, std::shared_ptr<model::StatSaver> stat_saver) {
+        //Sessions go in the order of the maps
+        std::vector<GameSession>& GetSessions() noexcept {
+            return sessions_;
+        }
+
+        //Session i gets seed + i and the loot stream BatchLootGenerator::MakeStream(seed, i)
+        void StartSessions(bool randomize_spawn, std::shared_ptr<model::StatSaver> stat_saver, std::optional<std::uint64_t> seed = std::nullopt) {
             sessions_.clear();
             sessions_.reserve(maps_.size());
             for (auto& map : maps_) {
-                sessions_.push_back(GameSession{ &map, randomize_spawn, dog_retirement_time_, stat_saver });
+                auto session_seed = seed ? std::optional{ *seed + sessions_.size() } : std::nullopt;
+                sessions_.push_back(GameSession{ &map, randomize_spawn, dog_retirement_time_, stat_saver, session_seed });
+            }
+            // Трофеи каждой сессии тоже повторяются при том же seed
+            loot_generator_.Seed(seed);
+            loot_generator_.Resize(sessions_.size());
+            loot_counts_.resize(sessions_.size());
+            looter_counts_.resize(sessions_.size());
+            generated_loot_.resize(sessions_.size());
+        }
+
+        //Loot put off by options is generated for the whole time it was put off
+        std::vector<size_t> Tick(unsigned delta, TickOptions options = {}) {
+            loot_time_ += delta;
+            if (options.spawn_loot) {
+                for (size_t i = 0; i < sessions_.size(); ++i) {
+                    loot_counts_[i] = sessions_[i].GetLootCount();
+                    looter_counts_[i] = sessions_[i].GetDogsCount();
+                }
+                loot_generator_.Generate(loot_gen::LootGenerator::TimeInterval(loot_time_), loot_counts_, looter_counts_, generated_loot_);
+                loot_time_ = 0;
+            }
+            else {
+                std::ranges::fill(generated_loot_, 0u);
             }
-        }
-
-        std::vector<size_t> Tick(unsigned delta) {
-            loot_gen::LootGenerator::TimeInterval ms_duration(delta);
             std::vector<size_t> retired_dogs;
-            for (auto& session : sessions_) {
-                auto dogs_to_retire = session.Tick(delta, loot_generator_.Generate(ms_duration, session.GetLootCount(), session.GetDogsCount()));
+            for (size_t i = 0; i < sessions_.size(); ++i) {
+                auto dogs_to_retire = sessions_[i].Tick(delta, generated_loot_[i], options);
                 for (const auto dog_id : dogs_to_retire) {
                     retired_dogs.push_back(dog_id);
                 }
@@ -681,12 +1047,19 @@ namespace model {
             FindSession(map_id)->AddLoot(loot_id, type, pos);
         }
 
+        //All sessions add the time of their tick phases to the profile
+        void SetTickProfile(TickProfile* profile) noexcept {
+            for (auto& session : sessions_) {
+                session.SetTickProfile(profile);
+            }
+        }
+
         std::unordered_map<std::string, std::vector<LostItem>> GetLostItems() const {
             std::unordered_map<std::string, std::vector<LostItem>> result;
             for (const auto& session : sessions_) {
                 std::string map_id = *session.GetMapId();
-                for (const auto& loot : session.GetLootMap()) {
-                    result[map_id].emplace_back(loot.first, loot.second.first, loot.second.second);
+                for (const auto& loot : session.GetLoot()) {
+                    result[map_id].emplace_back(loot.id, loot.type, loot.position);
                 }
             }
             return result;
@@ -699,7 +1072,13 @@ namespace model {
         std::vector<Map> maps_;
         MapIdToIndex map_id_to_index_;
         std::vector<GameSession> sessions_;
-        loot_gen::LootGenerator loot_generator_;
+        loot_gen::BatchLootGenerator loot_generator_;
+        // По одному элементу на сессию, чтобы не выделять память на каждом тике
+        std::vector<unsigned> loot_counts_;
+        std::vector<unsigned> looter_counts_;
+        std::vector<unsigned> generated_loot_;
+        // Время, за которое трофеи ещё не сгенерированы
+        std::uint64_t loot_time_ = 0;
         unsigned dog_retirement_time_;
     };
 
@@ -717,7 +1096,19 @@ namespace app {
     public:
         Token GetToken();
 
+        //Makes the sequence of tokens reproducible
+        void Seed(std::uint64_t seed) {
+            generator1_.seed(seed);
+            generator2_.seed(~seed);
+        }
+
+        //Tokens start with the prefix instead of their first characters
+        void SetPrefix(std::string prefix) {
+            prefix_ = std::move(prefix);
+        }
+
     private:
+        std::string prefix_;
         std::random_device random_device_;
         std::mt19937_64 generator1_{ [this] {
             std::uniform_int_distribution<std::mt19937_64::result_type> dist;
@@ -735,8 +1126,8 @@ namespace app {
 
     class Player {
     public:
-        explicit Player(Token&& token, model::GameSession* session, model::Dog* dog);
-        explicit Player(size_t id, Token&& token, model::GameSession* session, model::Dog* dog);
+        explicit Player(Token&& token, model::GameSession* session, model::GameSession::DogHandle dog);
+        explicit Player(size_t id, Token&& token, model::GameSession* session, model::GameSession::DogHandle dog);
 
         bool operator==(const Player& other) {
             return this->id_ == other.id_;
@@ -762,18 +1153,27 @@ namespace app {
             return session_;
         }
 
+        model::GameSession* GetSession() noexcept {
+            return session_;
+        }
+
+        size_t GetDogId() const noexcept {
+            return dog_id_;
+        }
+
         model::Dog* GetDog() noexcept {
-            return dog_;
+            return session_->GetDog(dog_);
         }
 
         const model::Dog& GetDog() const noexcept {
-            return *dog_;
+            return *session_->GetDog(dog_);
         }
 
     private:
         size_t id_;
         model::GameSession* session_;
-        model::Dog* dog_;
+        model::GameSession::DogHandle dog_;
+        size_t dog_id_;
         Token token_;
         static size_t start_id_;
 
@@ -782,37 +1182,80 @@ namespace app {
         }
     };
 
+    /*
+     *  Реестр игроков, разбитый на SHARDS_COUNT частей по хешу токена, у каждой части своя блокировка.
+     *  Добавляют и удаляют игроков только в strand игры, поэтому чтение из strand обходится без блокировок.
+     *  Поиск по токену из других потоков блокирует на чтение лишь одну часть
+     *  и не ждёт входа или ухода игроков, токены которых попали в другие части.
+     *  Сами игроки лежат подряд в SlotMap, части хранят дескрипторы и то,
+     *  что нужно поиску вне strand, чтобы ему не приходилось читать SlotMap.
+     */
     class Players {
     public:
+        static constexpr size_t SHARDS_COUNT = 64;
+
+        void SeedTokens(std::uint64_t seed) {
+            token_gen_.Seed(seed);
+        }
+
+        void SetTokenPrefix(std::string prefix) {
+            token_gen_.SetPrefix(std::move(prefix));
+        }
+
+        //The reference is valid until players join or retire
         Player& AddPlayer(model::Dog&& dog, model::GameSession* session);
 
         void AddPlayer(size_t id, Token&& token, model::Dog&& dog, model::GameSession* session);
 
+        //Players are mutated only in the strand, so lookups from the strand need no lock.
+        //The pointer is valid until players join or retire
         Player* FindByToken(const Token& token);
 
+        //Thread safe
+        bool HasPlayer(const Token& token) const;
+
+        //Thread safe, returns false if token is unknown
+        bool QueueAction(const Token& token, std::optional<model::Direction> move);
+
         const std::vector<Player> GetPlayers() const {
-            std::vector<Player> result;
-            for (const auto& [token, player] : tokens_to_players_) {
-                result.push_back(player);
-            }
-            return result;
+            return std::vector<Player>(players_.begin(), players_.end());
         }
 
-        void RemovePlayers(const std::vector<size_t>& dogs_ids) {
-            for (const auto id : dogs_ids) {
-                auto token = dogs_id_to_players_.at(id)->GetToken();
-                dogs_id_to_players_.erase(id);
-                tokens_to_players_.erase(token);
-            }
-        }
+        void RemovePlayers(const std::vector<size_t>& dogs_ids);
 
     private:
+        using PlayerHandle = util::SlotMap<Player>::Handle;
+
+        struct PlayerRef {
+            PlayerHandle handle;
+            model::GameSession* session;
+            size_t dog_id;
+        };
+
         using TokenHasher = util::TaggedHasher<Token>;
-        using TokensToPlayers = std::unordered_map<Token, Player, TokenHasher>;
+        using TokensToPlayers = std::unordered_map<Token, PlayerRef, TokenHasher>;
 
-        TokensToPlayers tokens_to_players_;
+        // Своя кеш-линия, чтобы блокировки соседних частей не мешали друг другу
+        struct alignas(64) Shard {
+            mutable std::shared_mutex mutex;
+            TokensToPlayers players;
+        };
+
+        std::array<Shard, SHARDS_COUNT> shards_;
+        util::SlotMap<Player> players_;
         TokensGen token_gen_;
-        std::unordered_map<size_t, Player*> dogs_id_to_players_;
+        std::unordered_map<size_t, PlayerHandle> dogs_id_to_players_;
+
+        Player& Insert(Player&& player);
+
+        Shard& GetShard(const Token& token) {
+            // Старшие биты хеша, младшие выбирают корзину внутри части
+            return shards_[(TokenHasher{}(token) >> 32) % SHARDS_COUNT];
+        }
+
+        const Shard& GetShard(const Token& token) const {
+            return const_cast<Players*>(this)->GetShard(token);
+        }
     };
 
     class ApplicationListener {
@@ -820,9 +1263,34 @@ namespace app {
         virtual void OnTick(unsigned delta) = 0;
     };
 
+    /*
+     *  Получает входные данные игры в том порядке, в котором их применяет модель:
+     *  вход игроков, действия, применённые тиком, и сам тик. Вызывается в strand игры.
+     *  Вход восстановленных из файла игроков сюда не попадает.
+     */
+    class InputListener {
+    public:
+        virtual void OnJoin(const model::Map::Id& map_id, const model::Dog& dog) = 0;
+        //session_index is the position of the session in the game, i.e. of its map in the config
+        virtual void OnActionsApplied(size_t session_index, const std::vector<model::PlayerAction>& actions) = 0;
+        virtual void OnTick(unsigned delta) = 0;
+    };
+
+    /*
+     *  Следит за временем тиков: до тика решает, какие его части отложить, после тика получает
+     *  его длительность вместе со слушателями и время фаз тика всех сессий. Вызывается в strand игры.
+     */
+    class TickBudget {
+    public:
+        virtual model::TickOptions BeforeTick() = 0;
+        virtual void AfterTick(std::chrono::steady_clock::duration duration, const model::TickProfile& profile) = 0;
+    };
+
     class Application {
     public:
-        explicit Application(model::Game&& game, bool randomize_spawn, std::shared_ptr<model::StatSaver> stat_saver);
+        //With a seed spawn points, loot positions and tokens are reproducible
+        explicit Application(model::Game&& game, bool randomize_spawn, std::shared_ptr<model::StatSaver> stat_saver,
+                             std::optional<std::uint64_t> seed = std::nullopt);
 
         const model::Map* FindMap(const model::Map::Id& id) const {
             return game_.FindMap(id);
@@ -837,6 +1305,9 @@ namespace app {
         }
 
         Player& AddPlayer(model::Dog&& dog, model::GameSession* session) {
+            if (input_listener_) {
+                input_listener_->OnJoin(session->GetMapId(), dog);
+            }
             return players_.AddPlayer(std::move(dog), session);
         }
 
@@ -848,26 +1319,60 @@ namespace app {
             return player->GetSession()->GetDogs();
         }
 
-        void Move(Player* player, model::Direction dir) {
-            player->GetDog()->Move(dir, player->GetSession()->GetSpeed());
+        bool HasPlayer(const Token& token) const {
+            return players_.HasPlayer(token);
         }
 
-        void Stop(Player* player) {
-            player->GetDog()->Stop();
+        //Can be called outside the strand
+        bool QueueAction(const Token& token, std::optional<model::Direction> move) {
+            return players_.QueueAction(token, move);
         }
 
         void Tick(unsigned millisec) {
-            auto dog_ids_to_retire = game_.Tick(millisec);
+            trace::Span span{ "game", "tick" };
+            model::TickOptions options;
+            std::chrono::steady_clock::time_point start;
+            if (tick_budget_) {
+                options = tick_budget_->BeforeTick();
+                tick_profile_ = {};
+                start = std::chrono::steady_clock::now();
+            }
+            auto dog_ids_to_retire = game_.Tick(millisec, options);
             if (dog_ids_to_retire.size() != 0) {
                 players_.RemovePlayers(dog_ids_to_retire);
             }
-            if (listener_) {
-                listener_->OnTick(millisec);
+            if (input_listener_) {
+                RecordTick(millisec);
             }
+            for (const auto& listener : listeners_) {
+                listener->OnTick(millisec);
+            }
+            if (tick_budget_) {
+                tick_budget_->AfterTick(std::chrono::steady_clock::now() - start, tick_profile_);
+            }
+        }
+
+        //Listeners are called after each tick in the order they were added
+        void AddAppListener(std::shared_ptr<ApplicationListener> listener) {
+            listeners_.push_back(std::move(listener));
+        }
+
+        void SetInputListener(std::shared_ptr<InputListener> listener) {
+            input_listener_ = std::move(listener);
         }
 
-        void SetAppListener(std::shared_ptr<ApplicationListener> listener) {
-            listener_ = listener;
+        //Lets a router find the shard of a player by the token
+        void SetTokenPrefix(std::string prefix) {
+            players_.SetTokenPrefix(std::move(prefix));
+        }
+
+        void SetTickBudget(std::shared_ptr<TickBudget> budget) {
+            tick_budget_ = std::move(budget);
+            game_.SetTickProfile(tick_budget_ ? &tick_profile_ : nullptr);
+        }
+
+        std::vector<model::GameSession>& GetSessions() {
+            return game_.GetSessions();
         }
 
         void AddPlayer(size_t player_id, Token&& token, model::Dog&& dog, const model::Map::Id& map_id);
@@ -887,7 +1392,12 @@ namespace app {
     private:
         model::Game game_;
         Players players_;
-        std::shared_ptr<ApplicationListener> listener_;
+        std::vector<std::shared_ptr<ApplicationListener>> listeners_;
+        std::shared_ptr<InputListener> input_listener_;
+        std::shared_ptr<TickBudget> tick_budget_;
+        model::TickProfile tick_profile_;
+
+        void RecordTick(unsigned millisec);
     };
 
 }  // namespace app
\ No newline at end of file
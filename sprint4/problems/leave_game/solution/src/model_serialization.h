@@ -166,6 +166,7 @@ private:
 };
 
 void Serialize(const std::string& filename, const app::Application& app) {
+    trace::Span span{ "serialization", "save state" };
     auto temp_name = filename + ".temp";
     std::ofstream file{ temp_name };
     boost::archive::text_oarchive archive{file};
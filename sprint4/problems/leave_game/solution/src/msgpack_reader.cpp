@@ -0,0 +1,201 @@
+#include "msgpack_reader.h"
+
+#include <bit>
+#include <boost/beast/core/buffers_to_string.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <cstdint>
+
+#include "json_writer.h"
+
+namespace msgpack_reader {
+
+namespace {
+
+using namespace std::literals;
+
+// Same limit as json_reader
+constexpr int MAX_DEPTH = 32;
+
+using JsonWriter = json_writer::Writer<boost::beast::flat_buffer>;
+
+class Reader {
+public:
+    Reader(std::string_view data, JsonWriter& writer)
+        : pos_(reinterpret_cast<const std::uint8_t*>(data.data()))
+        , end_(pos_ + data.size())
+        , writer_(writer) {
+    }
+
+    bool ReadTopValue() {
+        return ReadValue(0, false) && pos_ == end_;
+    }
+
+private:
+    const std::uint8_t* pos_;
+    const std::uint8_t* end_;
+    JsonWriter& writer_;
+
+    bool ReadBigEndian(int bytes, std::uint64_t& value) {
+        if (end_ - pos_ < bytes) {
+            return false;
+        }
+        value = 0;
+        for (int i = 0; i < bytes; ++i) {
+            value = (value << 8) | *pos_++;
+        }
+        return true;
+    }
+
+    bool ReadSize(int bytes, size_t& size) {
+        std::uint64_t value;
+        if (!ReadBigEndian(bytes, value)) {
+            return false;
+        }
+        size = value;
+        return true;
+    }
+
+    //Sign-extends a big-endian value of the given width
+    bool ReadInt(int bytes, std::int64_t& value) {
+        std::uint64_t raw;
+        if (!ReadBigEndian(bytes, raw)) {
+            return false;
+        }
+        const int unused = 64 - bytes * 8;
+        value = static_cast<std::int64_t>(raw << unused) >> unused;
+        return true;
+    }
+
+    bool ReadString(size_t size, bool as_key) {
+        if (static_cast<size_t>(end_ - pos_) < size) {
+            return false;
+        }
+        std::string_view value(reinterpret_cast<const char*>(pos_), size);
+        pos_ += size;
+        as_key ? writer_.Key(value) : writer_.String(value);
+        return true;
+    }
+
+    bool WriteUint(std::uint64_t value, bool as_key) {
+        as_key ? writer_.Key(std::to_string(value)) : writer_.Uint(value);
+        return true;
+    }
+
+    bool WriteInt(std::int64_t value, bool as_key) {
+        as_key ? writer_.Key(std::to_string(value)) : writer_.Int(value);
+        return true;
+    }
+
+    //Keys may be strings or integers only
+    bool WriteScalar(std::string_view json, bool as_key) {
+        if (as_key) {
+            return false;
+        }
+        writer_.Raw(json);
+        return true;
+    }
+
+    bool ReadArray(size_t size, int depth, bool as_key) {
+        if (as_key || depth >= MAX_DEPTH) {
+            return false;
+        }
+        writer_.BeginArray();
+        for (size_t i = 0; i < size; ++i) {
+            if (!ReadValue(depth + 1, false)) {
+                return false;
+            }
+        }
+        writer_.EndArray();
+        return true;
+    }
+
+    bool ReadMap(size_t size, int depth, bool as_key) {
+        if (as_key || depth >= MAX_DEPTH) {
+            return false;
+        }
+        writer_.BeginObject();
+        for (size_t i = 0; i < size; ++i) {
+            if (!ReadValue(depth + 1, true) || !ReadValue(depth + 1, false)) {
+                return false;
+            }
+        }
+        writer_.EndObject();
+        return true;
+    }
+
+    bool ReadValue(int depth, bool as_key) {
+        if (pos_ == end_) {
+            return false;
+        }
+        const std::uint8_t format = *pos_++;
+        if (format < 0x80) {
+            return WriteUint(format, as_key);
+        }
+        if (format >= 0xe0) {
+            return WriteInt(static_cast<std::int8_t>(format), as_key);
+        }
+        if ((format & 0xf0) == 0x80) {
+            return ReadMap(format & 0x0f, depth, as_key);
+        }
+        if ((format & 0xf0) == 0x90) {
+            return ReadArray(format & 0x0f, depth, as_key);
+        }
+        if ((format & 0xe0) == 0xa0) {
+            return ReadString(format & 0x1f, as_key);
+        }
+        std::uint64_t raw;
+        std::int64_t value;
+        size_t size;
+        switch (format) {
+        case 0xc0: return WriteScalar("null"sv, as_key);
+        case 0xc2: return WriteScalar("false"sv, as_key);
+        case 0xc3: return WriteScalar("true"sv, as_key);
+        case 0xca:
+            if (as_key || !ReadBigEndian(4, raw)) {
+                return false;
+            }
+            writer_.Double(std::bit_cast<float>(static_cast<std::uint32_t>(raw)));
+            return true;
+        case 0xcb:
+            if (as_key || !ReadBigEndian(8, raw)) {
+                return false;
+            }
+            writer_.Double(std::bit_cast<double>(raw));
+            return true;
+        case 0xcc: return ReadBigEndian(1, raw) && WriteUint(raw, as_key);
+        case 0xcd: return ReadBigEndian(2, raw) && WriteUint(raw, as_key);
+        case 0xce: return ReadBigEndian(4, raw) && WriteUint(raw, as_key);
+        case 0xcf: return ReadBigEndian(8, raw) && WriteUint(raw, as_key);
+        case 0xd0: return ReadInt(1, value) && WriteInt(value, as_key);
+        case 0xd1: return ReadInt(2, value) && WriteInt(value, as_key);
+        case 0xd2: return ReadInt(4, value) && WriteInt(value, as_key);
+        case 0xd3: return ReadInt(8, value) && WriteInt(value, as_key);
+        case 0xd9: return ReadSize(1, size) && ReadString(size, as_key);
+        case 0xda: return ReadSize(2, size) && ReadString(size, as_key);
+        case 0xdb: return ReadSize(4, size) && ReadString(size, as_key);
+        case 0xdc: return ReadSize(2, size) && ReadArray(size, depth, as_key);
+        case 0xdd: return ReadSize(4, size) && ReadArray(size, depth, as_key);
+        case 0xde: return ReadSize(2, size) && ReadMap(size, depth, as_key);
+        case 0xdf: return ReadSize(4, size) && ReadMap(size, depth, as_key);
+        default:
+            // bin, ext and the unused 0xc1
+            return false;
+        }
+    }
+};
+
+}  // namespace
+
+bool ToJson(std::string_view data, std::string& json) {
+    boost::beast::flat_buffer buffer;
+    {
+        JsonWriter writer{ buffer };
+        if (!Reader(data, writer).ReadTopValue()) {
+            return false;
+        }
+    }
+    json = boost::beast::buffers_to_string(buffer.data());
+    return true;
+}
+
+}  // namespace msgpack_reader
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+namespace msgpack_reader {
+
+/*
+ * Переводит MessagePack-тело, записанное msgpack_writer, в JSON-текст.
+ * Целые ключи словарей становятся строковыми, float - JSON-числами,
+ * поэтому результат совпадает с JSON-телом того же ответа байт в байт.
+ * Поддерживаются nil, bool, целые, float32/64, строки, массивы и словари.
+ * Возвращает false, если data не является одним корректным значением.
+ */
+bool ToJson(std::string_view data, std::string& json);
+
+}  // namespace msgpack_reader
@@ -0,0 +1,302 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <boost/asio/buffer.hpp>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#include "json_writer.h"
+#include "model.h"
+
+namespace msgpack_writer {
+
+using namespace std::literals;
+
+/*
+ *  MessagePack-представление тел /game/state и /game/players (application/msgpack).
+ *  Поля и вложенность те же, что у JSON, отличия:
+ *  - id собак и предметов - ключи-целые (uint), а не строки;
+ *  - координаты и скорости - всегда float64, целые - в самом коротком формате;
+ *  - числа многобайтовых форматов записаны в big-endian, как требует MessagePack.
+ *
+ *  state    {"players": {id: dog}, "lostObjects": {id: loot}}
+ *  snapshot {"type": "snapshot", "generation": uint, "players": {id: dog}, "lostObjects": {id: loot}}
+ *  delta    {"type": "delta", "generation": uint, "players": {id: dog}, "removedPlayers": [id],
+ *            "lostObjects": {id: loot}, "removedObjects": [id]}
+ *  players  {id: ["name", str]}
+ *  dog      {"pos": [x, y], "speed": [vx, vy], "dir": "U"|"D"|"L"|"R", "bag": [{"id": uint, "type": uint}], "score": uint}
+ *  loot     {"type": uint, "pos": [x, y]}
+ */
+template <typename DynamicBuffer>
+class Packer {
+public:
+    explicit Packer(DynamicBuffer& buffer)
+        : buffer_(buffer) {
+    }
+
+    Packer(const Packer&) = delete;
+    Packer& operator=(const Packer&) = delete;
+
+    ~Packer() {
+        Flush();
+    }
+
+    void Flush() {
+        if (size_ == 0) {
+            return;
+        }
+        auto buffer = buffer_.prepare(size_);
+        boost::asio::buffer_copy(buffer, boost::asio::buffer(chunk_, size_));
+        buffer_.commit(size_);
+        size_ = 0;
+    }
+
+    Packer& MapHeader(size_t size) {
+        return Header(size, 0x80, 0xde, 0xdf);
+    }
+
+    Packer& ArrayHeader(size_t size) {
+        return Header(size, 0x90, 0xdc, 0xdd);
+    }
+
+    Packer& Nil() {
+        Put(0xc0);
+        return *this;
+    }
+
+    Packer& Bool(bool value) {
+        Put(value ? 0xc3 : 0xc2);
+        return *this;
+    }
+
+    Packer& Uint(std::uint64_t value) {
+        if (value < 0x80) {
+            Put(static_cast<std::uint8_t>(value));
+        }
+        else if (value <= 0xff) {
+            PutBigEndian(0xcc, value, 1);
+        }
+        else if (value <= 0xffff) {
+            PutBigEndian(0xcd, value, 2);
+        }
+        else if (value <= 0xffffffff) {
+            PutBigEndian(0xce, value, 4);
+        }
+        else {
+            PutBigEndian(0xcf, value, 8);
+        }
+        return *this;
+    }
+
+    Packer& Int(std::int64_t value) {
+        if (value >= 0) {
+            return Uint(value);
+        }
+        if (value >= -32) {
+            Put(static_cast<std::uint8_t>(value));
+        }
+        else if (value >= INT8_MIN) {
+            PutBigEndian(0xd0, value, 1);
+        }
+        else if (value >= INT16_MIN) {
+            PutBigEndian(0xd1, value, 2);
+        }
+        else if (value >= INT32_MIN) {
+            PutBigEndian(0xd2, value, 4);
+        }
+        else {
+            PutBigEndian(0xd3, value, 8);
+        }
+        return *this;
+    }
+
+    //Always float64, so the value reads back exactly
+    Packer& Double(double value) {
+        PutBigEndian(0xcb, std::bit_cast<std::uint64_t>(value), 8);
+        return *this;
+    }
+
+    Packer& String(std::string_view value) {
+        if (value.size() < 32) {
+            Put(static_cast<std::uint8_t>(0xa0 | value.size()));
+        }
+        else if (value.size() <= 0xff) {
+            PutBigEndian(0xd9, value.size(), 1);
+        }
+        else if (value.size() <= 0xffff) {
+            PutBigEndian(0xda, value.size(), 2);
+        }
+        else {
+            PutBigEndian(0xdb, value.size(), 4);
+        }
+        Put(value);
+        return *this;
+    }
+
+private:
+    static constexpr size_t CHUNK_SIZE = 4096;
+
+    DynamicBuffer& buffer_;
+    std::uint8_t chunk_[CHUNK_SIZE];
+    size_t size_ = 0;
+
+    Packer& Header(size_t size, std::uint8_t fix, std::uint8_t format16, std::uint8_t format32) {
+        if (size < 16) {
+            Put(static_cast<std::uint8_t>(fix | size));
+        }
+        else if (size <= 0xffff) {
+            PutBigEndian(format16, size, 2);
+        }
+        else {
+            PutBigEndian(format32, size, 4);
+        }
+        return *this;
+    }
+
+    void Reserve(size_t size) {
+        if (CHUNK_SIZE - size_ < size) {
+            Flush();
+        }
+    }
+
+    void Put(std::uint8_t byte) {
+        Reserve(1);
+        chunk_[size_++] = byte;
+    }
+
+    void PutBigEndian(std::uint8_t format, std::uint64_t value, int bytes) {
+        Reserve(bytes + 1);
+        chunk_[size_++] = format;
+        for (int shift = (bytes - 1) * 8; shift >= 0; shift -= 8) {
+            chunk_[size_++] = static_cast<std::uint8_t>(value >> shift);
+        }
+    }
+
+    void Put(std::string_view data) {
+        if (data.size() > CHUNK_SIZE) {
+            Flush();
+            auto buffer = buffer_.prepare(data.size());
+            boost::asio::buffer_copy(buffer, boost::asio::buffer(data.data(), data.size()));
+            buffer_.commit(data.size());
+            return;
+        }
+        Reserve(data.size());
+        std::memcpy(chunk_ + size_, data.data(), data.size());
+        size_ += data.size();
+    }
+};
+
+constexpr size_t DOG_STATE_SIZE_HINT = 96;
+constexpr size_t LOOT_STATE_SIZE_HINT = 32;
+
+template <typename DynamicBuffer>
+void WriteDogState(Packer<DynamicBuffer>& packer, const model::Dog& dog) {
+    auto pos = dog.GetPosition();
+    auto speed = dog.GetSpeed();
+    packer.MapHeader(5);
+    packer.String("pos"sv).ArrayHeader(2).Double(pos.x).Double(pos.y);
+    packer.String("speed"sv).ArrayHeader(2).Double(speed.vx).Double(speed.vy);
+    packer.String("dir"sv).String(json_writer::DirectionToString(dog.GetDirection()));
+    packer.String("bag"sv).ArrayHeader(dog.GetItems().size());
+    for (const auto& item : dog.GetItems()) {
+        packer.MapHeader(2).String("id"sv).Uint(item.id).String("type"sv).Uint(item.type);
+    }
+    packer.String("score"sv).Uint(dog.GetScore());
+}
+
+template <typename DynamicBuffer>
+void WriteLootState(Packer<DynamicBuffer>& packer, model::GameSession::LootType type, model::Position pos) {
+    packer.MapHeader(2);
+    packer.String("type"sv).Uint(type);
+    packer.String("pos"sv).ArrayHeader(2).Double(pos.x).Double(pos.y);
+}
+
+template <typename DynamicBuffer>
+void WriteStateFields(Packer<DynamicBuffer>& packer, const std::vector<const model::Dog*>& dogs, const model::GameSession& session) {
+    packer.String("players"sv).MapHeader(dogs.size());
+    for (const auto* dog : dogs) {
+        packer.Uint(dog->GetId());
+        WriteDogState(packer, *dog);
+    }
+    const auto& loot = session.GetLoot();
+    packer.String("lostObjects"sv).MapHeader(loot.Size());
+    for (const auto& object : loot) {
+        packer.Uint(object.id);
+        WriteLootState(packer, object.type, object.position);
+    }
+}
+
+//Body of /api/v1/game/state
+template <typename DynamicBuffer>
+void WriteState(DynamicBuffer& buffer, const std::vector<const model::Dog*>& dogs, const model::GameSession& session) {
+    buffer.prepare(dogs.size() * DOG_STATE_SIZE_HINT + session.GetLoot().Size() * LOOT_STATE_SIZE_HINT);
+    Packer packer{ buffer };
+    packer.MapHeader(2);
+    WriteStateFields(packer, dogs, session);
+}
+
+template <typename DynamicBuffer>
+void WriteStateSnapshot(DynamicBuffer& buffer, const model::GameSession& session) {
+    auto dogs = session.GetDogs();
+    buffer.prepare(dogs.size() * DOG_STATE_SIZE_HINT + session.GetLoot().Size() * LOOT_STATE_SIZE_HINT);
+    Packer packer{ buffer };
+    packer.MapHeader(4);
+    packer.String("type"sv).String("snapshot"sv);
+    packer.String("generation"sv).Uint(session.GetGeneration());
+    WriteStateFields(packer, dogs, session);
+}
+
+//Ids which are already gone are skipped, as in json_writer::WriteStateDelta
+template <typename DynamicBuffer>
+void WriteStateDelta(DynamicBuffer& buffer, const model::GameSession& session, const model::ChangeSet& changes) {
+    buffer.prepare(changes.dogs.size() * DOG_STATE_SIZE_HINT + changes.loot.size() * LOOT_STATE_SIZE_HINT);
+    const auto& loot = session.GetLoot();
+    auto dogs_count = std::count_if(changes.dogs.begin(), changes.dogs.end(), [&session](size_t id) {
+        return session.FindDog(id) != nullptr;
+    });
+    auto loot_count = std::count_if(changes.loot.begin(), changes.loot.end(), [&loot](unsigned id) {
+        return loot.Contains(id);
+    });
+    Packer packer{ buffer };
+    packer.MapHeader(6);
+    packer.String("type"sv).String("delta"sv);
+    packer.String("generation"sv).Uint(session.GetGeneration());
+    packer.String("players"sv).MapHeader(dogs_count);
+    for (auto id : changes.dogs) {
+        if (const auto* dog = session.FindDog(id)) {
+            packer.Uint(id);
+            WriteDogState(packer, *dog);
+        }
+    }
+    packer.String("removedPlayers"sv).ArrayHeader(changes.removed_dogs.size());
+    for (auto id : changes.removed_dogs) {
+        packer.Uint(id);
+    }
+    packer.String("lostObjects"sv).MapHeader(loot_count);
+    for (auto id : changes.loot) {
+        if (const auto* object = loot.Find(id)) {
+            packer.Uint(id);
+            WriteLootState(packer, object->type, object->position);
+        }
+    }
+    packer.String("removedObjects"sv).ArrayHeader(changes.removed_loot.size());
+    for (auto id : changes.removed_loot) {
+        packer.Uint(id);
+    }
+}
+
+//Body of /api/v1/game/players
+template <typename DynamicBuffer>
+void WritePlayers(DynamicBuffer& buffer, const std::vector<const model::Dog*>& dogs) {
+    Packer packer{ buffer };
+    packer.MapHeader(dogs.size());
+    for (const auto* dog : dogs) {
+        packer.Uint(dog->GetId());
+        packer.ArrayHeader(2).String("name"sv).String(dog->GetName());
+    }
+}
+
+}  // namespace msgpack_writer
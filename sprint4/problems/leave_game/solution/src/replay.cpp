@@ -0,0 +1,221 @@
+#include "replay.h"
+
+#include <bit>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace replay {
+
+using namespace std::literals;
+
+namespace {
+
+constexpr std::string_view MAGIC = "GRPL"sv;
+constexpr char VERSION = 1;
+constexpr char JOIN = 'J';
+constexpr char ACTIONS = 'A';
+constexpr char TICK = 'T';
+constexpr std::uint8_t STOP = 4;
+constexpr std::uint64_t FNV_OFFSET = 14695981039346656037ull;
+constexpr std::uint64_t FNV_PRIME = 1099511628211ull;
+
+void WriteUint(std::ostream& out, std::uint64_t value) {
+    while (value >= 0x80) {
+        out.put(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.put(static_cast<char>(value));
+}
+
+void WriteString(std::ostream& out, std::string_view value) {
+    WriteUint(out, value.size());
+    out.write(value.data(), value.size());
+}
+
+std::uint64_t ReadUint(std::istream& in) {
+    std::uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        auto byte = in.get();
+        if (byte == std::istream::traits_type::eof()) {
+            throw std::runtime_error("Record is cut"s);
+        }
+        value |= std::uint64_t(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return value;
+        }
+    }
+    throw std::runtime_error("Record is damaged"s);
+}
+
+std::string ReadString(std::istream& in) {
+    std::string value(ReadUint(in), '\0');
+    if (!in.read(value.data(), value.size())) {
+        throw std::runtime_error("Record is cut"s);
+    }
+    return value;
+}
+
+void Mix(std::uint64_t& hash, std::uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+        hash = (hash ^ (value & 0xff)) * FNV_PRIME;
+        value >>= 8;
+    }
+}
+
+void Mix(std::uint64_t& hash, double value) {
+    Mix(hash, std::bit_cast<std::uint64_t>(value));
+}
+
+}  // namespace
+
+Recorder::Recorder(const std::filesystem::path& path, Header header)
+    : out_(path, std::ios::binary | std::ios::trunc) {
+    if (!out_) {
+        throw std::runtime_error("Can't create record file "s + path.string());
+    }
+    out_.write(MAGIC.data(), MAGIC.size());
+    out_.put(VERSION);
+    for (int i = 0; i < 8; ++i) {
+        out_.put(static_cast<char>(header.seed >> (8 * i)));
+    }
+    out_.put(header.randomize_spawn ? 1 : 0);
+}
+
+void Recorder::OnJoin(const model::Map::Id& map_id, const model::Dog& dog) {
+    out_.put(JOIN);
+    WriteString(out_, *map_id);
+    WriteString(out_, dog.GetName());
+    WriteUint(out_, dog.GetId());
+}
+
+void Recorder::OnActionsApplied(size_t session_index, const std::vector<model::PlayerAction>& actions) {
+    out_.put(ACTIONS);
+    WriteUint(out_, session_index);
+    WriteUint(out_, actions.size());
+    for (const auto& action : actions) {
+        WriteUint(out_, action.dog_id);
+        out_.put(static_cast<char>(action.move ? static_cast<std::uint8_t>(*action.move) : STOP));
+    }
+}
+
+void Recorder::OnTick(unsigned delta) {
+    out_.put(TICK);
+    WriteUint(out_, delta);
+}
+
+Reader::Reader(const std::filesystem::path& path)
+    : in_(path, std::ios::binary) {
+    if (!in_) {
+        throw std::runtime_error("Can't open record file "s + path.string());
+    }
+    char magic[MAGIC.size()];
+    char version;
+    if (!in_.read(magic, sizeof(magic)) || std::string_view(magic, sizeof(magic)) != MAGIC || !in_.get(version) || version != VERSION) {
+        throw std::runtime_error("Not a game record: "s + path.string());
+    }
+    unsigned char bytes[9];
+    if (!in_.read(reinterpret_cast<char*>(bytes), sizeof(bytes))) {
+        throw std::runtime_error("Record is cut"s);
+    }
+    for (int i = 0; i < 8; ++i) {
+        header_.seed |= std::uint64_t(bytes[i]) << (8 * i);
+    }
+    header_.randomize_spawn = bytes[8] != 0;
+}
+
+bool Reader::Next(Event& event) {
+    auto type = in_.get();
+    switch (type) {
+    case std::istream::traits_type::eof():
+        return false;
+    case JOIN: {
+        Join join;
+        join.map_id = ReadString(in_);
+        join.dog_name = ReadString(in_);
+        join.dog_id = ReadUint(in_);
+        event = std::move(join);
+        return true;
+    }
+    case ACTIONS: {
+        Actions actions;
+        actions.session_index = ReadUint(in_);
+        actions.actions.resize(ReadUint(in_));
+        for (auto& action : actions.actions) {
+            action.dog_id = ReadUint(in_);
+            auto move = in_.get();
+            if (move < 0 || move > STOP) {
+                throw std::runtime_error("Record is damaged"s);
+            }
+            action.move = move == STOP ? std::nullopt : std::optional{ static_cast<model::Direction>(move) };
+        }
+        event = std::move(actions);
+        return true;
+    }
+    case TICK:
+        event = Tick{ static_cast<unsigned>(ReadUint(in_)) };
+        return true;
+    default:
+        throw std::runtime_error("Record is damaged"s);
+    }
+}
+
+ReplayStats Replay(Reader& reader, app::Application& app) {
+    ReplayStats stats;
+    std::unordered_map<size_t, size_t> recorded_to_dog_id;
+    Event event;
+    while (reader.Next(event)) {
+        if (const auto* join = std::get_if<Join>(&event)) {
+            auto* session = app.FindSession(model::Map::Id{ join->map_id });
+            if (!session) {
+                throw std::runtime_error("Record refers to unknown map "s + join->map_id);
+            }
+            auto& player = app.AddPlayer(model::Dog{ std::string(join->dog_name), session->GetPocketsSize() }, session);
+            recorded_to_dog_id[join->dog_id] = player.GetDogId();
+            ++stats.joins;
+        }
+        else if (const auto* actions = std::get_if<Actions>(&event)) {
+            auto& sessions = app.GetSessions();
+            if (actions->session_index >= sessions.size()) {
+                throw std::runtime_error("Record refers to unknown session"s);
+            }
+            for (const auto& action : actions->actions) {
+                auto dog_id = recorded_to_dog_id.find(action.dog_id);
+                if (dog_id == recorded_to_dog_id.end()) {
+                    throw std::runtime_error("Record refers to unknown dog"s);
+                }
+                sessions[actions->session_index].QueueAction({ dog_id->second, action.move });
+            }
+            stats.actions += actions->actions.size();
+        }
+        else {
+            auto delta = std::get<Tick>(event).delta;
+            app.Tick(delta);
+            ++stats.ticks;
+            stats.game_time += delta;
+        }
+    }
+    return stats;
+}
+
+std::uint64_t StateChecksum(app::Application& app) {
+    std::uint64_t hash = FNV_OFFSET;
+    for (const auto& session : app.GetSessions()) {
+        for (const auto* dog : session.GetDogs()) {
+            Mix(hash, dog->GetPosition().x);
+            Mix(hash, dog->GetPosition().y);
+            Mix(hash, dog->GetSpeed().vx);
+            Mix(hash, dog->GetSpeed().vy);
+            Mix(hash, static_cast<std::uint64_t>(dog->GetScore()));
+            Mix(hash, std::uint64_t{ dog->GetItems().size() });
+        }
+        for (const auto& loot : session.GetLoot()) {
+            Mix(hash, std::uint64_t{ loot.id });
+            Mix(hash, std::uint64_t{ loot.type });
+            Mix(hash, loot.position.x);
+            Mix(hash, loot.position.y);
+        }
+    }
+    return hash;
+}
+
+}  // namespace replay
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include "model.h"
+
+namespace replay {
+
+/*
+ *  Запись входных данных игры в компактный двоичный файл и их повторное выполнение.
+ *  Файл начинается с заголовка: сигнатура "GRPL", версия, seed и флаг случайных точек появления.
+ *  Дальше идут события, целые числа записаны в LEB128, строки - длиной и байтами:
+ *  'J' <id карты> <имя собаки> <id собаки> - вход игрока,
+ *  'A' <номер сессии> <количество> (<id собаки> <направление, 4 - остановка>)... - действия, применённые следующим тиком,
+ *  'T' <миллисекунды> - тик.
+ *  Повтор воспроизводит игру, только если она начиналась без сохранённого состояния
+ *  и запущена с тем же конфигом и тем же seed. Собаки при повторе получают новые id,
+ *  действия переводятся на них по записанным id.
+ */
+
+struct Header {
+    std::uint64_t seed = 0;
+    bool randomize_spawn = false;
+};
+
+struct Join {
+    std::string map_id;
+    std::string dog_name;
+    size_t dog_id = 0;
+};
+
+struct Actions {
+    size_t session_index = 0;
+    std::vector<model::PlayerAction> actions;
+};
+
+struct Tick {
+    unsigned delta = 0;
+};
+
+using Event = std::variant<Join, Actions, Tick>;
+
+class Recorder : public app::InputListener {
+public:
+    //Throws std::runtime_error if the file can't be created
+    Recorder(const std::filesystem::path& path, Header header);
+
+    void OnJoin(const model::Map::Id& map_id, const model::Dog& dog) override;
+    void OnActionsApplied(size_t session_index, const std::vector<model::PlayerAction>& actions) override;
+    void OnTick(unsigned delta) override;
+
+private:
+    std::ofstream out_;
+};
+
+class Reader {
+public:
+    //Throws std::runtime_error if the file can't be opened or isn't a record
+    explicit Reader(const std::filesystem::path& path);
+
+    const Header& GetHeader() const noexcept {
+        return header_;
+    }
+
+    //False at the end of the record, throws std::runtime_error if the record is cut or damaged
+    bool Next(Event& event);
+
+private:
+    std::ifstream in_;
+    Header header_;
+};
+
+struct ReplayStats {
+    size_t joins = 0;
+    size_t actions = 0;
+    size_t ticks = 0;
+    std::uint64_t game_time = 0;
+};
+
+//Runs the rest of the record against app, which must be created with the header's seed
+ReplayStats Replay(Reader& reader, app::Application& app);
+
+//FNV-1a over dogs and loot of every session, equal for equal game states. Dog ids are left out as they differ between runs
+std::uint64_t StateChecksum(app::Application& app);
+
+}  // namespace replay
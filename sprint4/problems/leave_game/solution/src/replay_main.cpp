@@ -0,0 +1,84 @@
+#include <boost/program_options.hpp>
+#include <chrono>
+#include <iostream>
+#include <optional>
+
+#include "json_loader.h"
+#include "replay.h"
+
+using namespace std::literals;
+
+namespace {
+
+struct Args {
+    std::string config_path;
+    std::string record_path;
+};
+
+// Статистика ушедших на пенсию собак при повторе никуда не сохраняется
+class NullStatSaver : public model::StatSaver {
+public:
+    void Save(const std::vector<model::SaveStat>&) override {
+    }
+};
+
+[[nodiscard]] std::optional<Args> ParseCommandLine(int argc, const char* const argv[]) {
+    namespace po = boost::program_options;
+
+    po::options_description desc{ "All options"s };
+
+    Args args;
+    desc.add_options()
+        ("help,h", "produce help message")
+        ("config-file,c", po::value(&args.config_path)->value_name("path"s), "set config file path, the same as the recording server had")
+        ("record,r", po::value(&args.record_path)->value_name("path"s), "set record file path");
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.contains("help"s)) {
+        std::cout << desc;
+        return std::nullopt;
+    }
+    if (!vm.contains("config-file"s)) {
+        throw std::runtime_error("No path to config"s);
+    }
+    if (!vm.contains("record"s)) {
+        throw std::runtime_error("No path to record"s);
+    }
+    return args;
+}
+
+}  // namespace
+
+// Повторяет записанную игру без сети и таймеров, так быстро, как может
+int main(int argc, const char* argv[]) {
+    try {
+        auto args = ParseCommandLine(argc, argv);
+        if (!args) {
+            return EXIT_SUCCESS;
+        }
+
+        replay::Reader reader{ args->record_path };
+        const auto& header = reader.GetHeader();
+        app::Application app{ json_loader::LoadGame(args->config_path), header.randomize_spawn,
+                              std::make_shared<NullStatSaver>(), header.seed };
+
+        const auto start = std::chrono::steady_clock::now();
+        const auto stats = replay::Replay(reader, app);
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        std::cout << "seed: "sv << header.seed << '\n'
+                  << "joins: "sv << stats.joins << '\n'
+                  << "actions: "sv << stats.actions << '\n'
+                  << "ticks: "sv << stats.ticks << '\n'
+                  << "game time: "sv << stats.game_time << " ms"sv << '\n'
+                  << "wall time: "sv << elapsed.count() * 1000 << " ms"sv << '\n'
+                  << "ticks per second: "sv << (elapsed.count() > 0 ? stats.ticks / elapsed.count() : 0.) << '\n'
+                  << "state checksum: "sv << std::hex << replay::StateChecksum(app) << std::endl;
+    } catch (const std::exception& ex) {
+        std::cerr << ex.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+}
@@ -1,13 +1,16 @@
 #include "request_handler.h"
 
+#include <algorithm>
+#include <cctype>
+#include <charconv>
 #include <ranges>
 
 namespace http_handler {
 
 ExtensionToConetntTypeMapper Sender::mapper_;
 
-std::vector<std::string_view> SplitRequest(std::string_view body) {
-    std::vector<std::string_view> result;
+SplitResult SplitRequest(std::string_view body, http_server::ArenaAllocator<std::string_view> alloc) {
+    SplitResult result(alloc);
     size_t start = 0;
     if (auto params_start = body.find('?'); params_start != body.npos) {
         body = body.substr(0, params_start);
@@ -22,6 +25,80 @@ std::vector<std::string_view> SplitRequest(std::string_view body) {
     return result;
 }
 
+namespace {
+
+std::string_view Trim(std::string_view value) {
+    auto start = value.find_first_not_of(" \t"sv);
+    if (start == value.npos) {
+        return {};
+    }
+    return value.substr(start, value.find_last_not_of(" \t"sv) - start + 1);
+}
+
+bool EqualsNoCase(std::string_view lhs, std::string_view rhs) {
+    return std::ranges::equal(lhs, rhs, [](char l, char r) {
+        return std::tolower(static_cast<unsigned char>(l)) == std::tolower(static_cast<unsigned char>(r));
+    });
+}
+
+// q of a media range, 1 if absent and 0 if malformed
+double ParseQuality(std::string_view params) {
+    while (!params.empty()) {
+        auto param = params.substr(0, params.find(';'));
+        params.remove_prefix(std::min(params.size(), param.size() + 1));
+        param = Trim(param);
+        if (param.size() < 2 || (param[0] != 'q' && param[0] != 'Q') || param[1] != '=') {
+            continue;
+        }
+        double quality;
+        auto value = param.substr(2);
+        auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), quality);
+        return ec == std::errc{} && end == value.data() + value.size() ? quality : 0.;
+    }
+    return 1.;
+}
+
+}  // namespace
+
+// MessagePack only when it is explicitly preferred to JSON, wildcards keep the JSON default
+BodyEncoding ParseAccept(std::string_view accept) {
+    double json_quality = 0.;
+    double msgpack_quality = 0.;
+    while (!accept.empty()) {
+        auto range = accept.substr(0, accept.find(','));
+        accept.remove_prefix(std::min(accept.size(), range.size() + 1));
+        auto params_start = std::min(range.find(';'), range.size());
+        auto type = Trim(range.substr(0, params_start));
+        if (EqualsNoCase(type, ContentType::APP_JSON)) {
+            json_quality = std::max(json_quality, ParseQuality(range.substr(params_start)));
+        }
+        else if (EqualsNoCase(type, ContentType::APP_MSGPACK) || EqualsNoCase(type, "application/x-msgpack"sv)
+            || EqualsNoCase(type, "application/vnd.msgpack"sv)) {
+            msgpack_quality = std::max(msgpack_quality, ParseQuality(range.substr(params_start)));
+        }
+    }
+    return msgpack_quality > json_quality ? BodyEncoding::MSGPACK : BodyEncoding::JSON;
+}
+
+// gzip or * with a non-zero q, an explicit gzip;q=0 wins over *
+bool AcceptsGzip(std::string_view accept_encoding) {
+    double gzip_quality = -1.;
+    double any_quality = 0.;
+    while (!accept_encoding.empty()) {
+        auto coding = accept_encoding.substr(0, accept_encoding.find(','));
+        accept_encoding.remove_prefix(std::min(accept_encoding.size(), coding.size() + 1));
+        auto params_start = std::min(coding.find(';'), coding.size());
+        auto name = Trim(coding.substr(0, params_start));
+        if (EqualsNoCase(name, "gzip"sv) || EqualsNoCase(name, "x-gzip"sv)) {
+            gzip_quality = std::max(gzip_quality, ParseQuality(coding.substr(params_start)));
+        }
+        else if (name == "*"sv) {
+            any_quality = ParseQuality(coding.substr(params_start));
+        }
+    }
+    return gzip_quality < 0. ? any_quality > 0. : gzip_quality > 0.;
+}
+
 json::object MapToJSON(const model::Map* map) {
     json::object obj;
     obj[std::string(model::ModelLiterals::ID)] = *map->GetId();
@@ -76,6 +153,7 @@ json::array BuildingsToJson(const model::Map* map) {
 
 RequestHandler::RequestHandler(app::Application& app, const char* path_to_static, net::io_context& ioc, bool no_auto_tick, std::shared_ptr<database::StatProvider> stat_provider)
     : root_path_(path_to_static),
+    static_store_(root_path_),
     api_handler_(std::make_shared<APIRequestHandler>(app, ioc, no_auto_tick, stat_provider)){
 }
 
@@ -84,7 +162,9 @@ APIRequestHandler::APIRequestHandler(app::Application& app, net::io_context& ioc
     , strand_(net::make_strand(ioc))
     , auto_tick_(!no_auto_tick)
     , stat_provider_(stat_provider)
-{ }
+    , broadcaster_(std::make_shared<state_broadcaster::StateBroadcaster>(strand_)) {
+    app_.AddAppListener(broadcaster_);
+}
 
 json::array APIRequestHandler::ProcessMapsRequestBody() const {
     auto maps_body = json::array();
@@ -146,8 +226,8 @@ std::string_view ExtensionToConetntTypeMapper::operator()(std::string_view exten
     return ContentType::UNKNOWN;
 }
 
-std::string RequestHandler::DecodeURL(std::string_view url) const {
-    std::vector<char> text;
+http_server::ArenaString RequestHandler::DecodeURL(std::string_view url, http_server::ArenaAllocator<char> alloc) const {
+    http_server::ArenaString text(alloc);
     text.reserve(url.length());
     for (size_t i = 0; i < url.length(); ++i) {
         if (url[i] == '%') {
@@ -157,25 +237,25 @@ std::string RequestHandler::DecodeURL(std::string_view url) const {
 
                 if (isxdigit(hex1) && isxdigit(hex2)) {
                     int code = std::stoi(std::string() + hex1 + hex2, nullptr, 16);
-                    text.emplace_back(static_cast<char>(code));
+                    text.push_back(static_cast<char>(code));
                     i += 2;
                 }
                 else {
-                    text.emplace_back('%');
+                    text.push_back('%');
                 }
             }
             else {
-                text.emplace_back('%');
+                text.push_back('%');
             }
         }
         else if (url[i] == '+') {
-            text.emplace_back(' ');
+            text.push_back(' ');
         }
         else {
-            text.emplace_back(url[i]);
+            text.push_back(url[i]);
         }
     }
-    return std::string(text.data(), text.size());
+    return text;
 }
 
 void LoggingRequestHandler::LogResponse(const ResponseData& r, boost::chrono::system_clock::time_point start_time, const boost::beast::net::ip::address&& address) {
@@ -189,12 +269,94 @@ void LoggingRequestHandler::LogResponse(const ResponseData& r, boost::chrono::sy
 }
 
 bool APIRequestHandler::ParseBearer(const std::string_view auth_header, std::string& token_to_write) const {
-    std::vector<std::string_view> splitted;
-    boost::algorithm::split(splitted, auth_header, boost::is_any_of(" "));
-    if (splitted.size() != 2 || splitted[0] != "Bearer" || splitted[1].size() != 32) {
+    constexpr std::string_view BEARER = "Bearer "sv;
+    if (!auth_header.starts_with(BEARER)) {
+        return false;
+    }
+    auto token = auth_header.substr(BEARER.size());
+    if (token.size() != 32 || token.find(' ') != token.npos) {
+        return false;
+    }
+    token_to_write = token;
+    return true;
+}
+
+bool APIRequestHandler::CanBypassStrand(std::string_view target, http_server::ArenaAllocator<std::string_view> alloc) const {
+    auto splitted = SplitRequest(target.substr(1, target.length() - 1), alloc);
+    if (metrics_enabled_ && splitted.size() == 3 && splitted[2] == RestApiLiterals::METRICS) {
+        return true;
+    }
+    return splitted.size() == 5 && splitted[2] == RestApiLiterals::GAME
+        && splitted[3] == RestApiLiterals::PLAYER && splitted[4] == RestApiLiterals::ACTION;
+}
+
+void APIRequestHandler::SetOverloadControl(OverloadLimits limits, std::shared_ptr<http_server::ConnectionGovernor> governor, std::shared_ptr<ticker::Ticker> ticker) {
+    overload_limits_ = limits;
+    governor_ = std::move(governor);
+    ticker_ = std::move(ticker);
+}
+
+void APIRequestHandler::SetTickBudget(std::shared_ptr<tick_budget::Controller> budget) {
+    broadcaster_->SetTickBudget(budget);
+    tick_budget_ = std::move(budget);
+}
+
+bool APIRequestHandler::IsOverloaded() const {
+    if (overload_limits_.max_strand_queue != 0 && strand_queue_.load(std::memory_order_relaxed) >= overload_limits_.max_strand_queue) {
+        return true;
+    }
+    return ticker_ && overload_limits_.max_tick_lag.count() != 0 && ticker_->GetLag() > overload_limits_.max_tick_lag;
+}
+
+bool APIRequestHandler::ParseSince(std::string_view target, std::optional<model::ChangeLog::Generation>& since) const {
+    constexpr std::string_view SINCE = "since="sv;
+    since.reset();
+    auto query_start = target.find('?');
+    if (query_start == target.npos) {
+        return true;
+    }
+    auto query = target.substr(query_start + 1);
+    while (!query.empty()) {
+        auto param = query.substr(0, query.find('&'));
+        query.remove_prefix(std::min(query.size(), param.size() + 1));
+        if (!param.starts_with(SINCE)) {
+            continue;
+        }
+        auto value = param.substr(SINCE.size());
+        model::ChangeLog::Generation generation;
+        auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), generation);
+        if (ec != std::errc{} || end != value.data() + value.size()) {
+            return false;
+        }
+        since = generation;
+    }
+    return true;
+}
+
+bool APIRequestHandler::ParseMove(std::string_view body, std::optional<model::Direction>& move) const {
+    json_reader::Field json_move;
+    if (!json_reader::ReadObject(body, { {"move"sv, &json_move} }) || json_move.kind != json_reader::Field::STRING) {
+        return false;
+    }
+    std::string_view move_value = json_move.string;
+    if (move_value == "U") {
+        move = model::Direction::NORTH;
+    }
+    else if (move_value == "D") {
+        move = model::Direction::SOUTH;
+    }
+    else if (move_value == "L") {
+        move = model::Direction::WEST;
+    }
+    else if (move_value == "R") {
+        move = model::Direction::EAST;
+    }
+    else if (move_value == "") {
+        move = std::nullopt;
+    }
+    else {
         return false;
     }
-    token_to_write = splitted[1];
     return true;
 }
 
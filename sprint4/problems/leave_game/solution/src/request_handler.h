@@ -1,7 +1,16 @@
 #pragma once
+#include "compression.h"
 #include "extra_data.h"
 #include "http_server.h"
 #include "db.h"
+#include "json_reader.h"
+#include "json_writer.h"
+#include "msgpack_writer.h"
+#include "state_broadcaster.h"
+#include "static_store.h"
+#include "tick_budget.h"
+#include "ticker.h"
+#include "trace.h"
 
 #include <boost/asio/io_context.hpp>
 #include <boost/json.hpp>
@@ -12,6 +21,7 @@
 #include <boost/log/utility/setup/console.hpp>
 #include <boost/date_time.hpp>
 #include <boost/chrono.hpp>
+#include <atomic>
 #include <filesystem>
 #include <functional>
 #include <memory>
@@ -25,6 +35,7 @@ namespace http_handler {
     namespace beast = boost::beast;
     namespace json = boost::json;
     namespace http = beast::http;
+    namespace websocket = beast::websocket;
     namespace fs = std::filesystem;
     namespace sys = boost::system;
     namespace logging = boost::log;
@@ -34,6 +45,7 @@ namespace http_handler {
         ContentType() = delete;
         constexpr static std::string_view TEXT_HTML = "text/html"sv;
         constexpr static std::string_view APP_JSON = "application/json"sv;
+        constexpr static std::string_view APP_MSGPACK = "application/msgpack"sv;
         constexpr static std::string_view TEXT_CSS = "text/css"sv;
         constexpr static std::string_view TEXT_PLAIN = "text/plain"sv;
         constexpr static std::string_view TEXT_JAVASCRIPT = "text/javascript"sv;
@@ -81,15 +93,18 @@ namespace http_handler {
         constexpr static std::string_view JOIN = "join"sv;
         constexpr static std::string_view PLAYERS = "players"sv;
         constexpr static std::string_view STATE = "state"sv;
+        constexpr static std::string_view STREAM = "stream"sv;
         constexpr static std::string_view PLAYER = "player"sv;
         constexpr static std::string_view ACTION = "action"sv;
         constexpr static std::string_view TICK = "tick"sv;
         constexpr static std::string_view RECORDS = "records"sv;
+        constexpr static std::string_view METRICS = "metrics"sv;
     };
 
     struct HttpBodies {
         HttpBodies() = delete;
         constexpr static std::string_view BAD_REQUEST = R"({ "code": "badRequest", "message": "Bad request" })"sv;
+        constexpr static std::string_view WEBSOCKET_EXPECTED = R"({ "code": "badRequest", "message": "WebSocket upgrade expected" })"sv;
         constexpr static std::string_view RECORDS_REQUEST_INVALID_MAX_ITEMS = R"({ "code": "badRequest", "message": "Invalid max items" })"sv;
         constexpr static std::string_view MAP_NOT_FOUND = R"({ "code": "mapNotFound", "message": "Map not found" })"sv;
         constexpr static std::string_view FILE_NOT_FOUND = R"({ "code": "fileNotFound", "message": "File not found" })"sv;
@@ -100,10 +115,13 @@ namespace http_handler {
         constexpr static std::string_view METHOD_NOT_ALLOWED = R"({ "code": "invalidMethod", "message": "Another method expected" })"sv;
         constexpr static std::string_view INVALID_TOKEN = R"({ "code": "invalidToken", "message": "Authorization header is missing" })"sv;
         constexpr static std::string_view TOKEN_UNKNOWN = R"({ "code": "unknownToken", "message": "Player token has not been found" })"sv;
+        constexpr static std::string_view SERVICE_UNAVAILABLE = R"({ "code": "serviceUnavailable", "message": "Server is overloaded" })"sv;
         constexpr static std::string_view INVALID_CONTENT_TYPE = R"({"code": "invalidArgument", "message": "Invalid content type"} )"sv;
     };
 
-    std::vector<std::string_view> SplitRequest(std::string_view body);
+    using SplitResult = std::vector<std::string_view, http_server::ArenaAllocator<std::string_view>>;
+
+    SplitResult SplitRequest(std::string_view body, http_server::ArenaAllocator<std::string_view> alloc = {});
 
     json::object MapToJSON(const model::Map* map);
     json::array RoadsToJson(const model::Map* map);
@@ -115,6 +133,21 @@ namespace http_handler {
         std::string_view content_type;
     };
 
+    // Когда API-запросы, идущие в strand, получают 503. Нулевое значение отключает проверку
+    struct OverloadLimits {
+        size_t max_strand_queue = 0;
+        std::chrono::milliseconds max_tick_lag{ 0 };
+    };
+
+    // Encoding of state and players bodies, chosen by the Accept header
+    enum class BodyEncoding {
+        JSON,
+        MSGPACK
+    };
+
+    BodyEncoding ParseAccept(std::string_view accept);
+    bool AcceptsGzip(std::string_view accept_encoding);
+
     class ExtensionToConetntTypeMapper {
     public:
         ExtensionToConetntTypeMapper();
@@ -135,22 +168,82 @@ namespace http_handler {
             return { http::status::bad_request, ContentType::APP_JSON };
         }
 
-        template<typename Send>
-        static ResponseData SendFileResponseOr404(const fs::path root_path, std::string_view path, Send&& send, bool is_head_method = false) {
-            http::response<http::file_body> res;
-            res.version(11);
-            res.result(http::status::ok);
-            std::string full_path = root_path.string() + path.data();
+        /*
+         *  Файлы из хранилища отдаются без чтения с диска и копирования, при поддержке
+         *  клиентом - в сжатом виде. Совпавший If-None-Match (или If-Modified-Since)
+         *  даёт 304, Range с одним диапазоном - 206 из несжатого представления.
+         */
+        template<typename Request, typename Send>
+        static ResponseData SendFileResponseOr404(const static_store::StaticStore& store, const fs::path root_path, std::string_view path, const Request& req, Send&& send, bool is_head_method = false) {
+            trace::Span span{ "http", "static" };
             std::size_t ext_start = path.find_last_of('.', path.size());
             std::string_view type = ContentType::TEXT_HTML;
+            std::string_view file_path = "/index.html"sv;
             if (ext_start != path.npos) {
                 type = mapper_(path.substr(ext_start + 1, path.size() - ext_start + 1));
-                res.insert(http::field::content_type, type);
+                file_path = path;
+            }
+            const auto* file = store.Find(file_path);
+            if (!file) {
+                return SendFileFromDisk(root_path, file_path, type, std::move(send), is_head_method);
+            }
+            static_store::ByteRange range{ 0, file->data.size() };
+            auto range_status = static_store::RangeStatus::WHOLE;
+            if (auto if_range = req[http::field::if_range]; if_range.empty() || if_range == file->etag || if_range == file->last_modified) {
+                range_status = static_store::ParseRange(req[http::field::range], file->data.size(), range);
+            }
+            const bool gzip = range_status == static_store::RangeStatus::WHOLE && !file->gzip.empty() && send.IsGzipAccepted();
+            const auto& etag = gzip ? file->gzip_etag : file->etag;
+            auto status = http::status::ok;
+            std::string_view data = gzip ? std::string_view(file->gzip) : file->data;
+            auto if_none_match = req[http::field::if_none_match];
+            if (!if_none_match.empty() ? static_store::MatchesETag(if_none_match, etag) : req[http::field::if_modified_since] == file->last_modified) {
+                status = http::status::not_modified;
+                data = {};
+            }
+            else if (range_status == static_store::RangeStatus::PARTIAL) {
+                status = http::status::partial_content;
+                data = data.substr(range.offset, range.length);
+            }
+            else if (range_status == static_store::RangeStatus::UNSATISFIABLE) {
+                status = http::status::range_not_satisfiable;
+                data = {};
+            }
+            auto body = is_head_method ? ""sv : data;
+            http_server::HttpResponse<http::span_body<const char>> res(std::piecewise_construct, std::make_tuple(body.data(), body.size()), std::make_tuple(send.get_allocator()));
+            res.version(11);
+            res.result(status);
+            res.insert(http::field::content_type, type);
+            res.insert(http::field::etag, etag);
+            res.insert(http::field::last_modified, file->last_modified);
+            res.insert(http::field::accept_ranges, "bytes");
+            if (gzip) {
+                res.insert(http::field::content_encoding, "gzip");
             }
-            else {
-                full_path = root_path.string() + "/index.html";
-                res.insert(http::field::content_type, ContentType::TEXT_HTML);
+            if (!file->gzip.empty()) {
+                res.insert(http::field::vary, "Accept-Encoding");
             }
+            if (status == http::status::partial_content) {
+                res.insert(http::field::content_range, MakeContentRange(range.offset, range.offset + range.length - 1, file->data.size(), send));
+            }
+            else if (status == http::status::range_not_satisfiable) {
+                res.insert(http::field::content_range, MakeContentRange(0, 0, file->data.size(), send, true));
+            }
+            if (status != http::status::not_modified) {
+                res.prepare_payload();
+            }
+            send(res);
+            return { status, type };
+        }
+
+        // Файлы, которых нет в хранилище, читаются с диска при каждом запросе
+        template<typename Send>
+        static ResponseData SendFileFromDisk(const fs::path& root_path, std::string_view path, std::string_view type, Send&& send, bool is_head_method) {
+            http_server::HttpResponse<http::file_body> res(std::piecewise_construct, std::make_tuple(), std::make_tuple(send.get_allocator()));
+            res.version(11);
+            res.result(http::status::ok);
+            res.insert(http::field::content_type, type);
+            std::string full_path = root_path.string() + std::string(path);
 
             http::file_body::value_type file;
 
@@ -169,40 +262,140 @@ namespace http_handler {
 
         template<typename Send>
         static void SendResponse(http::status status, std::string_view body, Send&& send, std::string_view type, bool is_head_method = false) {
-            http::response<http::string_body> response(status, 11);
+            auto response = MakeStringResponse(status, is_head_method ? ""sv : body, send);
             response.insert(http::field::cache_control, "no-cache");
             response.insert(http::field::content_type, type);
-            if (!is_head_method) {
-                response.body() = body;
-            }
+            response.prepare_payload();
             send(response);
         }
 
         template<typename Send>
         static void SendAPIResponse(http::status status, std::string_view body, Send&& send, bool is_head_method = false) {
-            http::response<http::string_body> response(status, 11);
+            if (!is_head_method && ShouldCompress(body.size(), send)) {
+                return SendGzipped(status, body, ContentType::APP_JSON, false, send);
+            }
+            auto response = MakeStringResponse(status, is_head_method ? ""sv : body, send);
             response.insert(http::field::content_type, ContentType::APP_JSON);
             response.insert(http::field::cache_control, "no-cache");
-            if (!is_head_method) {
-                response.body() = body;
+            response.prepare_payload();
+            send(response);
+        }
+
+        //Body already written into the buffer by json_writer, no copy is made
+        template<typename Send>
+        static void SendAPIResponse(http::status status, http_server::ResponseBuffer&& body, Send&& send) {
+            if (ShouldCompress(body.size(), send)) {
+                return SendGzipped(status, ToStringView(body), ContentType::APP_JSON, false, send);
             }
+            http_server::HttpResponse<http_server::BufferBody> response(std::piecewise_construct, std::make_tuple(std::move(body)), std::make_tuple(send.get_allocator()));
+            response.result(status);
+            response.version(11);
+            response.insert(http::field::content_type, ContentType::APP_JSON);
+            response.insert(http::field::cache_control, "no-cache");
+            response.prepare_payload();
+            send(response);
+        }
+
+        //Same for bodies which have a binary form: the response varies by Accept
+        template<typename Send>
+        static ResponseData SendAPIResponse(http::status status, http_server::ResponseBuffer&& body, BodyEncoding encoding, Send&& send) {
+            auto type = encoding == BodyEncoding::MSGPACK ? ContentType::APP_MSGPACK : ContentType::APP_JSON;
+            if (ShouldCompress(body.size(), send)) {
+                SendGzipped(status, ToStringView(body), type, true, send);
+                return { status, type };
+            }
+            http_server::HttpResponse<http_server::BufferBody> response(std::piecewise_construct, std::make_tuple(std::move(body)), std::make_tuple(send.get_allocator()));
+            response.result(status);
+            response.version(11);
+            response.insert(http::field::content_type, type);
+            response.insert(http::field::cache_control, "no-cache");
+            response.insert(http::field::vary, "Accept");
+            response.prepare_payload();
+            send(response);
+            return { status, type };
+        }
+
+        template<typename Send>
+        static ResponseData SendServiceUnavailable(Send&& send) {
+            auto response = MakeStringResponse(http::status::service_unavailable, HttpBodies::SERVICE_UNAVAILABLE, send);
+            response.insert(http::field::content_type, ContentType::APP_JSON);
+            response.insert(http::field::cache_control, "no-cache");
+            response.insert(http::field::retry_after, "1");
             response.prepare_payload();
             send(response);
+            return { http::status::service_unavailable, ContentType::APP_JSON };
         }
 
         template<typename Send>
         static ResponseData SendMethodNotAllowed(Send&& send, std::string_view allow) {
-            http::response<http::string_body> response(http::status::method_not_allowed, 11);
+            auto response = MakeStringResponse(http::status::method_not_allowed, HttpBodies::METHOD_NOT_ALLOWED, send);
             response.insert(http::field::content_type, ContentType::APP_JSON);
             response.insert(http::field::cache_control, "no-cache");
             response.insert(http::field::allow, allow);
-            response.body() = HttpBodies::METHOD_NOT_ALLOWED;
+            response.prepare_payload();
             send(response);
             return { http::status::method_not_allowed, ContentType::APP_JSON };
         }
 
     private:
+        //Smaller bodies fit into a packet anyway
+        static constexpr size_t MIN_COMPRESSED_SIZE = 1024;
+
         static ExtensionToConetntTypeMapper mapper_;
+
+        template<typename Send>
+        static bool ShouldCompress(size_t size, const Send& send) {
+            return size >= MIN_COMPRESSED_SIZE && send.IsGzipAccepted();
+        }
+
+        // "bytes first-last/size", or "bytes */size" for an unsatisfiable range
+        template<typename Send>
+        static http_server::ArenaString MakeContentRange(std::uint64_t first, std::uint64_t last, std::uint64_t size, const Send& send, bool unsatisfiable = false) {
+            http_server::ArenaString result{ "bytes "sv, send.get_allocator() };
+            if (unsatisfiable) {
+                result += '*';
+            }
+            else {
+                result += std::to_string(first);
+                result += '-';
+                result += std::to_string(last);
+            }
+            result += '/';
+            result += std::to_string(size);
+            return result;
+        }
+
+        static std::string_view ToStringView(const http_server::ResponseBuffer& buffer) {
+            auto data = buffer.data();
+            return { static_cast<const char*>(data.data()), data.size() };
+        }
+
+        // Сжатие идёт в потоке обработчика контекстом zlib этого потока
+        template<typename Send>
+        static void SendGzipped(http::status status, std::string_view body, std::string_view type, bool vary_accept, const Send& send) {
+            trace::Span span{ "serialization", "gzip" };
+            http_server::ResponseBuffer compressed{ send.get_allocator() };
+            compression::GzipCompressor::ForThisThread().Compress(body, compressed);
+            http_server::HttpResponse<http_server::BufferBody> response(std::piecewise_construct, std::make_tuple(std::move(compressed)), std::make_tuple(send.get_allocator()));
+            response.result(status);
+            response.version(11);
+            response.insert(http::field::content_type, type);
+            response.insert(http::field::cache_control, "no-cache");
+            response.insert(http::field::content_encoding, "gzip");
+            response.insert(http::field::vary, vary_accept ? "Accept, Accept-Encoding" : "Accept-Encoding");
+            response.prepare_payload();
+            send(response);
+        }
+
+        // Ответ выделяется из арены соединения, которому он отправляется
+        template<typename Send>
+        static http_server::HttpResponse<http_server::StringBody> MakeStringResponse(http::status status, std::string_view body, const Send& send) {
+            auto alloc = send.get_allocator();
+            http_server::HttpResponse<http_server::StringBody> response(std::piecewise_construct, std::make_tuple(body, alloc), std::make_tuple(alloc));
+            response.result(status);
+            response.version(11);
+            return response;
+        }
     };
 
     class APIRequestHandler : public std::enable_shared_from_this<APIRequestHandler> {
@@ -217,7 +410,7 @@ namespace http_handler {
         template <typename Body, typename Allocator, typename Send>
         ResponseData ProcessRequest(std::string_view target, Send&& send, const http::request<Body, http::basic_fields<Allocator>>&& req) {
             auto unslashed = target.substr(1, target.length() - 1);
-            auto splitted = SplitRequest(unslashed);
+            auto splitted = SplitRequest(unslashed, send.get_allocator());
             std::string_view method = std::string_view(req.method_string().data());
             unsigned http_version = req.version();
             if (splitted.size() < 3) {
@@ -235,6 +428,12 @@ namespace http_handler {
                     return { http::status::ok , ContentType::APP_JSON };
                 }
             }
+            if (metrics_enabled_ && splitted[2] == RestApiLiterals::METRICS && splitted.size() == 3) {
+                if (method != "GET" && method != "HEAD") {
+                    return Sender::SendMethodNotAllowed(std::move(send), "GET, HEAD");
+                }
+                return MetricsRequest(std::move(send));
+            }
             if (splitted[2] == RestApiLiterals::MAP) {
                 if (splitted.size() != 4) {
                     return Sender::SendBadRequest(std::move(send));
@@ -271,7 +470,19 @@ namespace http_handler {
                         Sender::SendAPIResponse(http::status::unauthorized, HttpBodies::INVALID_TOKEN, std::move(send));
                         return { http::status::unauthorized, ContentType::APP_JSON };
                     }
-                    return PlayersRequest(std::move(token), std::move(send));
+                    return PlayersRequest(std::move(token), ParseAccept(req.base()[http::field::accept]), std::move(send));
+                }
+                if (splitted[3] == RestApiLiterals::STATE && splitted.size() == 5 && splitted[4] == RestApiLiterals::STREAM) {
+                    if (method != "GET") {
+                        return Sender::SendMethodNotAllowed(std::move(send), "GET");
+                    }
+                    std::string token = "";
+                    auto token_valid = ParseBearer(std::move(req.base()[http::field::authorization]), token);
+                    if (!token_valid) {
+                        Sender::SendAPIResponse(http::status::unauthorized, HttpBodies::INVALID_TOKEN, std::move(send));
+                        return { http::status::unauthorized, ContentType::APP_JSON };
+                    }
+                    return StreamRequest(std::move(token), req, std::move(send));
                 }
                 if (splitted[3] == RestApiLiterals::STATE) {
                     if (method != "GET" && method != "HEAD") {
@@ -283,7 +494,11 @@ namespace http_handler {
                         Sender::SendAPIResponse(http::status::unauthorized, HttpBodies::INVALID_TOKEN, std::move(send));
                         return { http::status::unauthorized, ContentType::APP_JSON };
                     }
-                    return StateRequest(std::move(token), std::move(send));
+                    std::optional<model::ChangeLog::Generation> since;
+                    if (!ParseSince(target, since)) {
+                        return Sender::SendBadRequest(std::move(send));
+                    }
+                    return StateRequest(std::move(token), since, ParseAccept(req.base()[http::field::accept]), std::move(send));
                 }
                 if (splitted[3] == RestApiLiterals::PLAYER) {
                     if (splitted.size() == 4) {
@@ -325,11 +540,54 @@ namespace http_handler {
             return strand_;
         }
 
+        // Requests which don't touch game state directly and can skip the strand
+        bool CanBypassStrand(std::string_view target, http_server::ArenaAllocator<std::string_view> alloc) const;
+
+        //ticker is null when ticks come from /api/v1/game/tick
+        void SetOverloadControl(OverloadLimits limits, std::shared_ptr<http_server::ConnectionGovernor> governor, std::shared_ptr<ticker::Ticker> ticker);
+
+        //The budget thins out state broadcasts and its counters go to metrics
+        void SetTickBudget(std::shared_ptr<tick_budget::Controller> budget);
+
+        //The API has no authentication for operator-only routes, so /api/v1/metrics is off until enabled
+        void EnableMetrics() noexcept {
+            metrics_enabled_ = true;
+        }
+
+        // Очередь strand слишком длинная или тик опаздывает: новый запрос в strand не ставим
+        bool IsOverloaded() const;
+
+        template<typename Send>
+        ResponseData ShedRequest(Send&& send) {
+            if (governor_) {
+                ++governor_->GetCounters().requests_shed;
+            }
+            return Sender::SendServiceUnavailable(std::move(send));
+        }
+
+        //Requests posted to the strand and not yet started
+        void EnterStrandQueue() {
+            strand_queue_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void LeaveStrandQueue() {
+            strand_queue_.fetch_sub(1, std::memory_order_relaxed);
+        }
+
     private:
         app::Application& app_;
         Strand strand_;
         bool auto_tick_;
         std::shared_ptr<database::StatProvider> stat_provider_;
+        std::shared_ptr<state_broadcaster::StateBroadcaster> broadcaster_;
+        //Used only in the strand, keeps its capacity between state requests
+        model::ChangeSet state_changes_;
+        OverloadLimits overload_limits_;
+        std::shared_ptr<http_server::ConnectionGovernor> governor_;
+        std::shared_ptr<ticker::Ticker> ticker_;
+        std::shared_ptr<tick_budget::Controller> tick_budget_;
+        bool metrics_enabled_ = false;
+        std::atomic<size_t> strand_queue_ = 0;
 
         json::array ProcessMapsRequestBody() const;
 
@@ -366,6 +624,7 @@ namespace http_handler {
 
         template<typename Send>
         ResponseData MapRequest(std::string id, Send&& send) {
+            trace::Span span{ "http", "map" };
             model::Map::Id map_id(id);
             const auto* map = app_.FindMap(map_id);
             if (map) {
@@ -378,56 +637,97 @@ namespace http_handler {
             }
         }
 
+        // Runs outside the strand, all counters are atomics
+        template<typename Send>
+        ResponseData MetricsRequest(Send&& send) {
+            http_server::ResponseBuffer body{ send.get_allocator() };
+            {
+                json_writer::Writer writer{ body };
+                writer.BeginObject();
+                if (governor_) {
+                    const auto& counters = governor_->GetCounters();
+                    writer.Key("connections"sv).BeginObject();
+                    writer.Key("active"sv).Uint(governor_->GetActiveSessions());
+                    writer.Key("accepted"sv).Uint(counters.sessions_accepted);
+                    writer.Key("rejected"sv).Uint(counters.sessions_rejected);
+                    writer.Key("rejectedPerIp"sv).Uint(counters.sessions_rejected_per_ip);
+                    writer.EndObject();
+                    writer.Key("timeouts"sv).BeginObject();
+                    writer.Key("idle"sv).Uint(counters.idle_timeouts);
+                    writer.Key("header"sv).Uint(counters.header_timeouts);
+                    writer.Key("body"sv).Uint(counters.body_timeouts);
+                    writer.EndObject();
+                }
+                writer.Key("requests"sv).BeginObject();
+                writer.Key("shed"sv).Uint(governor_ ? governor_->GetCounters().requests_shed.load() : 0);
+                writer.Key("strandQueue"sv).Uint(strand_queue_.load(std::memory_order_relaxed));
+                writer.EndObject();
+                writer.Key("tickLagMs"sv).Uint(ticker_ ? ticker_->GetLag().count() : 0);
+                if (tick_budget_) {
+                    const auto& counters = tick_budget_->GetCounters();
+                    writer.Key("tickBudget"sv).BeginObject();
+                    writer.Key("budgetUs"sv).Uint(tick_budget_->GetConfig().budget.count());
+                    writer.Key("level"sv).Uint(counters.level);
+                    writer.Key("lastTickUs"sv).Uint(counters.last_tick_us);
+                    writer.Key("averageTickUs"sv).Uint(counters.average_tick_us);
+                    writer.Key("phasesUs"sv).BeginObject();
+                    for (size_t i = 0; i < tick_budget::PHASES.size(); ++i) {
+                        writer.Key(tick_budget::PHASES[i].first).Uint(counters.phase_us[i]);
+                    }
+                    writer.EndObject();
+                    writer.Key("ticks"sv).Uint(counters.ticks);
+                    writer.Key("overBudgetTicks"sv).Uint(counters.over_budget_ticks);
+                    writer.Key("lootDeferrals"sv).Uint(counters.loot_deferrals);
+                    writer.Key("afkScansSkipped"sv).Uint(counters.afk_scans_skipped);
+                    writer.Key("broadcastsSkipped"sv).Uint(counters.broadcasts_skipped);
+                    writer.Key("periodStretchMs"sv).Uint(counters.period_stretch_ms);
+                    writer.EndObject();
+                }
+                writer.EndObject();
+            }
+            Sender::SendAPIResponse(http::status::ok, std::move(body), std::move(send));
+            return { http::status::ok, ContentType::APP_JSON };
+        }
+
         template<typename Send>
         ResponseData RecordsRequest(StatAdditionalInfo info, Send&& send) {
+            trace::Span span{ "http", "records" };
             if (info.max_items > 100) {
                 Sender::SendAPIResponse(http::status::bad_request, HttpBodies::RECORDS_REQUEST_INVALID_MAX_ITEMS, std::move(send));
                 return { http::status::bad_request, ContentType::APP_JSON };
             }
             auto stats = stat_provider_->GetStats(info.start, info.max_items);
-            json::array result;
-            for (const auto& stat : stats) {
-                json::object value;
-                value["name"] = stat.name;
-                value["score"] = stat.score;
-                value["playTime"] = stat.playtime;
-                result.emplace_back(std::move(value));
-            }
-            Sender::SendAPIResponse(http::status::ok, json::serialize(result), std::move(send));
+            http_server::ResponseBuffer body{ send.get_allocator() };
+            json_writer::WriteRecords(body, stats);
+            Sender::SendAPIResponse(http::status::ok, std::move(body), std::move(send));
             return { http::status::ok, ContentType::APP_JSON };
         }
 
         template<typename Send>
         ResponseData JoinRequest(std::string_view body, Send&& send) {
-            json::object json_body;
-            try {
-                json_body = json::parse(body.data()).as_object();
-            }
-            catch (std::exception& ex) {
+            trace::Span span{ "http", "join" };
+            json_reader::Field user_name;
+            json_reader::Field map_id;
+            if (!json_reader::ReadObject(body, { {"userName"sv, &user_name}, {"mapId"sv, &map_id} })
+                || user_name.kind != json_reader::Field::STRING) {
                 Sender::SendAPIResponse(http::status::bad_request, HttpBodies::JOIN_GAME_PARSE_ERROR, std::move(send));
                 return { http::status::bad_request, ContentType::APP_JSON };
             }
-            if (!json_body.contains("userName") || !json_body.at("userName").is_string()) {
-                Sender::SendAPIResponse(http::status::bad_request, HttpBodies::JOIN_GAME_PARSE_ERROR, std::move(send));
-                return { http::status::bad_request, ContentType::APP_JSON };
-            }
-            auto user_name = json_body.at("userName").get_string();
-            if (user_name.size() == 0) {
+            if (user_name.string.size() == 0) {
                 Sender::SendAPIResponse(http::status::bad_request, HttpBodies::INVALID_NAME, std::move(send));
                 return { http::status::bad_request, ContentType::APP_JSON };
             }
-            if (!json_body.contains("mapId") || !json_body.at("mapId").is_string()) {
+            if (map_id.kind != json_reader::Field::STRING) {
                 Sender::SendAPIResponse(http::status::bad_request, HttpBodies::JOIN_GAME_PARSE_ERROR, std::move(send));
                 return { http::status::bad_request, ContentType::APP_JSON };
             }
-            auto map_id = json_body.at("mapId").get_string();
-            auto id = model::Map::Id(map_id.data());
+            auto id = model::Map::Id(std::string(map_id.string));
             auto* session = app_.FindSession(id);
             if (!session) {
                 Sender::SendAPIResponse(http::status::not_found, HttpBodies::MAP_NOT_FOUND, std::move(send));
                 return { http::status::not_found, ContentType::APP_JSON };
             }
-            model::Dog dog{ std::move(std::string(user_name.data())), session->GetPocketsSize() };
+            model::Dog dog{ std::string(user_name.string), session->GetPocketsSize() };
             auto& player = app_.AddPlayer(std::move(dog), session);
             json::object result;
             app::Token token = player.GetToken();
@@ -439,146 +739,103 @@ namespace http_handler {
         }
 
         template<typename Send>
-        ResponseData PlayersRequest(std::string&& token, Send&& send) {
+        ResponseData PlayersRequest(std::string&& token, BodyEncoding encoding, Send&& send) {
+            trace::Span span{ "http", "players" };
             auto* player = app_.FindByToken(app::Token(token));
             if (!player) {
                 Sender::SendAPIResponse(http::status::unauthorized, HttpBodies::TOKEN_UNKNOWN, std::move(send));
                 return { http::status::unauthorized, ContentType::APP_JSON };
             }
-            json::object result;
-            for (const auto* dog : app_.GetDogs(player)) {
-                result[std::to_string(dog->GetId())] = json::array{ "name", dog->GetName() };
+            http_server::ResponseBuffer body{ send.get_allocator() };
+            {
+                trace::Span serialize_span{ "serialization", "players body" };
+                if (encoding == BodyEncoding::MSGPACK) {
+                    msgpack_writer::WritePlayers(body, app_.GetDogs(player));
+                }
+                else {
+                    json_writer::WritePlayers(body, app_.GetDogs(player));
+                }
             }
-            Sender::SendAPIResponse(http::status::ok, json::serialize(result), std::move(send));
-            return { http::status::ok, ContentType::APP_JSON };
+            return Sender::SendAPIResponse(http::status::ok, std::move(body), encoding, std::move(send));
         }
 
+        // With since the body holds only changes made after that generation, or the whole state if they are not kept anymore
         template<typename Send>
-        ResponseData StateRequest(std::string&& token, Send&& send) {
+        ResponseData StateRequest(std::string&& token, std::optional<model::ChangeLog::Generation> since, BodyEncoding encoding, Send&& send) {
+            trace::Span span{ "http", "state" };
             auto* player = app_.FindByToken(app::Token(token));
             if (!player) {
                 Sender::SendAPIResponse(http::status::unauthorized, HttpBodies::TOKEN_UNKNOWN, std::move(send));
                 return { http::status::unauthorized, ContentType::APP_JSON };
             }
-            json::object result;
-
-            json::object players;
-            for (const auto& dog : app_.GetDogs(player)) {
-                json::object data;
-                auto pos = dog->GetPosition();
-                auto speed = dog->GetSpeed();
-                data["pos"] = { pos.x, pos.y };
-                data["speed"] = { speed.vx, speed.vy };
-                switch (dog->GetDirection()) {
-                case model::Direction::NORTH:
-                    data["dir"] = "U";
-                    break;
-                case model::Direction::SOUTH:
-                    data["dir"] = "D";
-                    break;
-                case model::Direction::EAST:
-                    data["dir"] = "R";
-                    break;
-                case model::Direction::WEST:
-                    data["dir"] = "L";
-                    break;
+            const auto& session = *player->GetSession();
+            const bool msgpack = encoding == BodyEncoding::MSGPACK;
+            http_server::ResponseBuffer body{ send.get_allocator() };
+            {
+                trace::Span serialize_span{ "serialization", "state body" };
+                if (!since) {
+                    auto dogs = app_.GetDogs(player);
+                    msgpack ? msgpack_writer::WriteState(body, dogs, session) : json_writer::WriteState(body, dogs, session);
                 }
-
-                json::array bag;
-                for (const auto& item : dog->GetItems()) {
-                    bag.push_back(json::value{ 
-                        { "id", item.id },
-                        { "type", item.type } 
-                    });
+                else if (session.GetChangesSince(*since, state_changes_)) {
+                    msgpack ? msgpack_writer::WriteStateDelta(body, session, state_changes_) : json_writer::WriteStateDelta(body, session, state_changes_);
+                }
+                else {
+                    msgpack ? msgpack_writer::WriteStateSnapshot(body, session) : json_writer::WriteStateSnapshot(body, session);
                 }
-                data["bag"] = bag;
-
-                data["score"] = dog->GetScore();
-
-                players[std::to_string(dog->GetId())] = data;
-            }
-            result["players"] = players;
-
-            json::object lost_objects;
-            for (const auto& map_object : player->GetSession()->GetLootMap()) {
-                json::object obj;
-                obj["type"] = map_object.second.first;
-                auto& pos = map_object.second.second;
-                obj["pos"] = { pos.x, pos.y };
-                lost_objects[std::to_string(map_object.first)] = obj;
             }
-            result["lostObjects"] = lost_objects;
-
-            Sender::SendAPIResponse(http::status::ok, json::serialize(result), std::move(send));
-            return { http::status::ok, ContentType::APP_JSON };
+            return Sender::SendAPIResponse(http::status::ok, std::move(body), encoding, std::move(send));
         }
 
-        template<typename Send>
-        ResponseData ActionRequest(std::string&& token, std::string_view body, Send&& send) {
+        // After the WebSocket handshake the connection is handed to the broadcaster
+        template<typename Request, typename Send>
+        ResponseData StreamRequest(std::string&& token, const Request& req, Send&& send) {
+            if (!websocket::is_upgrade(req)) {
+                Sender::SendAPIResponse(http::status::bad_request, HttpBodies::WEBSOCKET_EXPECTED, std::move(send));
+                return { http::status::bad_request, ContentType::APP_JSON };
+            }
             auto* player = app_.FindByToken(app::Token(token));
             if (!player) {
                 Sender::SendAPIResponse(http::status::unauthorized, HttpBodies::TOKEN_UNKNOWN, std::move(send));
                 return { http::status::unauthorized, ContentType::APP_JSON };
             }
-            json::object json_body;
-            try {
-                json_body = json::parse(body.data()).as_object();
-            }
-            catch (std::exception& ex) {
+            send.AcceptWebSocket([broadcaster = broadcaster_, session = player->GetSession(), dog_id = player->GetDogId()](auto connection) {
+                broadcaster->Subscribe(session, dog_id, std::move(connection));
+            });
+            return { http::status::switching_protocols, ContentType::APP_JSON };
+        }
+
+        // Runs outside the strand: the action is buffered and applied on the next tick
+        template<typename Send>
+        ResponseData ActionRequest(std::string&& token, std::string_view body, Send&& send) {
+            trace::Span span{ "http", "action" };
+            app::Token app_token(std::move(token));
+            std::optional<model::Direction> move;
+            if (!ParseMove(body, move)) {
+                if (!app_.HasPlayer(app_token)) {
+                    Sender::SendAPIResponse(http::status::unauthorized, HttpBodies::TOKEN_UNKNOWN, std::move(send));
+                    return { http::status::unauthorized, ContentType::APP_JSON };
+                }
                 Sender::SendAPIResponse(http::status::bad_request, HttpBodies::ACTION_PARSE_ERROR, std::move(send));
                 return { http::status::bad_request, ContentType::APP_JSON };
             }
-            auto move = json_body.find("move");
-            if (move == json_body.end() || !move->value().is_string()) {
-                Sender::SendAPIResponse(http::status::bad_request, HttpBodies::ACTION_PARSE_ERROR, std::move(send));
-                return { http::status::bad_request, ContentType::APP_JSON };
+            if (!app_.QueueAction(app_token, move)) {
+                Sender::SendAPIResponse(http::status::unauthorized, HttpBodies::TOKEN_UNKNOWN, std::move(send));
+                return { http::status::unauthorized, ContentType::APP_JSON };
             }
-            std::string_view move_value = move->value().get_string();
-            if (move_value == "U") {
-                app_.Move(player, model::Direction::NORTH);
-                Sender::SendAPIResponse(http::status::ok, "{}"sv, std::move(send));
-                return { http::status::ok, ContentType::APP_JSON };
-            }
-            if (move_value == "D") {
-                app_.Move(player, model::Direction::SOUTH);
-                Sender::SendAPIResponse(http::status::ok, "{}"sv, std::move(send));
-                return { http::status::ok, ContentType::APP_JSON };
-            }
-            if (move_value == "L") {
-                app_.Move(player, model::Direction::WEST);
-                Sender::SendAPIResponse(http::status::ok, "{}"sv, std::move(send));
-                return { http::status::ok, ContentType::APP_JSON };
-            }
-            if (move_value == "R") {
-                app_.Move(player, model::Direction::EAST);
-                Sender::SendAPIResponse(http::status::ok, "{}"sv, std::move(send));
-                return { http::status::ok, ContentType::APP_JSON };
-            }
-            if (move_value == "") {
-                app_.Stop(player);
-                Sender::SendAPIResponse(http::status::ok, "{}"sv, std::move(send));
-                return { http::status::ok, ContentType::APP_JSON };
-            }
-            Sender::SendAPIResponse(http::status::bad_request, HttpBodies::ACTION_PARSE_ERROR, std::move(send));
-            return { http::status::bad_request, ContentType::APP_JSON };
+            Sender::SendAPIResponse(http::status::ok, "{}"sv, std::move(send));
+            return { http::status::ok, ContentType::APP_JSON };
         }
 
         template<typename Send>
         ResponseData TickRequest(std::string_view body, Send&& send) {
-            json::object json_body;
-            try {
-                json_body = json::parse(body.data()).as_object();
-            }
-            catch (std::exception&) {
-                Sender::SendAPIResponse(http::status::bad_request, HttpBodies::TICK_PARSE_ERROR, std::move(send));
-                return { http::status::bad_request, ContentType::APP_JSON };
-            }
-            auto tick = json_body.find("timeDelta");
-            if (tick == json_body.end() || !tick->value().is_int64()) {
+            trace::Span span{ "http", "tick" };
+            json_reader::Field tick;
+            if (!json_reader::ReadObject(body, { {"timeDelta"sv, &tick} }) || tick.kind != json_reader::Field::INT64) {
                 Sender::SendAPIResponse(http::status::bad_request, HttpBodies::TICK_PARSE_ERROR, std::move(send));
                 return { http::status::bad_request, ContentType::APP_JSON };
             }
-            int tick_val = tick->value().get_int64();
+            int tick_val = tick.int64;
             if (tick_val < 1) {
                 Sender::SendAPIResponse(http::status::bad_request, HttpBodies::TICK_PARSE_ERROR, std::move(send));
                 return { http::status::bad_request, ContentType::APP_JSON };
@@ -589,6 +846,9 @@ namespace http_handler {
         }
 
         bool ParseBearer(const std::string_view auth_header, std::string& token_to_write) const;
+        bool ParseMove(std::string_view body, std::optional<model::Direction>& move) const;
+        //Returns false if since is present but is not a generation number
+        bool ParseSince(std::string_view target, std::optional<model::ChangeLog::Generation>& since) const;
     };
 
     class RequestHandler : public std::enable_shared_from_this<RequestHandler> {
@@ -602,23 +862,41 @@ namespace http_handler {
             return api_handler_->GetStrand();
         }
 
-        template <typename Body, typename Allocator, typename Send>
-        void operator()(http::request<Body, http::basic_fields<Allocator>>&& req, Send&& send, std::function<void(ResponseData&&)> handle) {
-            auto string_target = DecodeURL(req.target());
+        void SetOverloadControl(OverloadLimits limits, std::shared_ptr<http_server::ConnectionGovernor> governor, std::shared_ptr<ticker::Ticker> ticker) {
+            api_handler_->SetOverloadControl(limits, std::move(governor), std::move(ticker));
+        }
+
+        void SetTickBudget(std::shared_ptr<tick_budget::Controller> budget) {
+            api_handler_->SetTickBudget(std::move(budget));
+        }
+
+        void EnableMetrics() noexcept {
+            api_handler_->EnableMetrics();
+        }
+
+        template <typename Body, typename Allocator, typename Send, typename Handle>
+        void operator()(http::request<Body, http::basic_fields<Allocator>>&& req, Send&& send, Handle&& handle) {
+            send.SetGzipAccepted(AcceptsGzip(req[http::field::accept_encoding]));
+            auto string_target = DecodeURL(req.target(), send.get_allocator());
             std::string_view target(string_target);
             switch (CheckRequest(target)) {
             case RequestType::API:
             {
-                net::dispatch(api_handler_->GetStrand(), [self = shared_from_this(), string_target_ = std::move(string_target)
-                    , req_ = std::move(req), send_ = std::move(send), api_handler__ = api_handler_->shared_from_this()
-                    , handle_ = std::move(handle)]() {
-                        handle_(api_handler__->ProcessRequest(std::string_view(string_target_), std::move(send_), std::move(req_)));
-                    });
+                if (api_handler_->CanBypassStrand(target, send.get_allocator())) {
+                    return handle(api_handler_->ProcessRequest(target, std::move(send), std::move(req)));
+                }
+                if (api_handler_->IsOverloaded()) {
+                    return handle(api_handler_->ShedRequest(std::move(send)));
+                }
+                using Request = http::request<Body, http::basic_fields<Allocator>>;
+                api_handler_->EnterStrandQueue();
+                net::dispatch(api_handler_->GetStrand(), StrandRequest<Request, std::decay_t<Send>, std::decay_t<Handle>>{
+                    std::move(send), std::move(req), std::move(string_target), std::move(handle), api_handler_->shared_from_this() });
                 return;
                 break;
             }
             case RequestType::FILE:
-                return handle(Sender::SendFileResponseOr404(root_path_, target, std::move(send)));
+                return handle(Sender::SendFileResponseOr404(static_store_, root_path_, target, req, std::move(send)));
                 break;
             case RequestType::BAD_REQUEST:
                 return handle(Sender::SendBadRequest(std::move(send)));
@@ -633,6 +911,7 @@ namespace http_handler {
         friend APIRequestHandler;
 
         const fs::path root_path_;
+        const static_store::StaticStore static_store_;
         std::shared_ptr<APIRequestHandler> api_handler_;
 
         enum RequestType {
@@ -641,8 +920,34 @@ namespace http_handler {
             BAD_REQUEST
         };
 
+        /*
+         *  Запрос, переданный в strand API.
+         *  Через allocator_type asio выделяет память под него из арены соединения.
+         *  send объявлен первым и поэтому уничтожается последним: он держит сессию,
+         *  в арене которой живут остальные поля.
+         */
+        template <typename Request, typename Send, typename Handle>
+        struct StrandRequest {
+            using allocator_type = http_server::ArenaAllocator<char>;
+
+            Send send;
+            Request req;
+            http_server::ArenaString target;
+            Handle handle;
+            std::shared_ptr<APIRequestHandler> api_handler;
+
+            allocator_type get_allocator() const {
+                return send.get_allocator();
+            }
+
+            void operator()() {
+                api_handler->LeaveStrandQueue();
+                handle(api_handler->ProcessRequest(std::string_view(target), std::move(send), std::move(req)));
+            }
+        };
+
         RequestType CheckRequest(std::string_view target) const;
-        std::string DecodeURL(std::string_view url) const;
+        http_server::ArenaString DecodeURL(std::string_view url, http_server::ArenaAllocator<char> alloc) const;
     };
 
     class LoggingRequestHandler {
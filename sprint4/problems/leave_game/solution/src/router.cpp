@@ -0,0 +1,230 @@
+#include "router.h"
+
+#include <algorithm>
+#include <charconv>
+#include <stdexcept>
+
+#include "json_reader.h"
+
+namespace router {
+
+using namespace std::literals;
+
+namespace {
+
+constexpr std::string_view API_V1 = "/api/v1/"sv;
+constexpr std::string_view BEARER = "Bearer "sv;
+constexpr std::string_view HEX_DIGITS = "0123456789abcdef"sv;
+
+int HexValue(char c) {
+    auto pos = HEX_DIGITS.find(c);
+    return pos == HEX_DIGITS.npos ? -1 : static_cast<int>(pos);
+}
+
+// "a/b/c" -> {"a", "b", "c"}
+std::vector<std::string_view> SplitPath(std::string_view path) {
+    std::vector<std::string_view> parts;
+    while (!path.empty()) {
+        auto part = path.substr(0, path.find('/'));
+        parts.push_back(part);
+        path.remove_prefix(std::min(path.size(), part.size() + 1));
+    }
+    return parts;
+}
+
+bool ParseSize(std::string_view text, size_t& value) {
+    auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+    return ec == std::errc{} && end == text.data() + text.size();
+}
+
+}  // namespace
+
+std::string MakeTokenPrefix(size_t shard) {
+    if (shard >= MAX_SHARDS) {
+        throw std::out_of_range("Shard index must be less than "s + std::to_string(MAX_SHARDS));
+    }
+    return { HEX_DIGITS[shard / 16], HEX_DIGITS[shard % 16] };
+}
+
+std::vector<std::string> SplitList(std::string_view list) {
+    std::vector<std::string> items;
+    while (!list.empty()) {
+        auto item = list.substr(0, list.find(','));
+        if (!item.empty()) {
+            items.emplace_back(item);
+        }
+        list.remove_prefix(std::min(list.size(), item.size() + 1));
+    }
+    return items;
+}
+
+Shard ParseShard(std::string_view spec) {
+    auto equals = spec.find('=');
+    auto address = spec.substr(0, equals);
+    auto colon = address.rfind(':');
+    if (equals == spec.npos || colon == address.npos || colon == 0 || colon + 1 == address.size()) {
+        throw std::invalid_argument("Wrong shard "s + std::string(spec) + ", expected host:port=map1,map2"s);
+    }
+    Shard shard{ std::string(address.substr(0, colon)), std::string(address.substr(colon + 1)), SplitList(spec.substr(equals + 1)) };
+    if (shard.map_ids.empty()) {
+        throw std::invalid_argument("Shard "s + std::string(address) + " has no maps"s);
+    }
+    return shard;
+}
+
+Directory::Directory(std::vector<Shard> shards)
+    : shards_(std::move(shards)) {
+    if (shards_.empty() || shards_.size() > MAX_SHARDS) {
+        throw std::invalid_argument("Wrong number of shards"s);
+    }
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        for (const auto& map_id : shards_[i].map_ids) {
+            if (!map_to_shard_.emplace(map_id, i).second) {
+                throw std::invalid_argument("Map "s + map_id + " belongs to two shards"s);
+            }
+        }
+    }
+}
+
+std::optional<size_t> Directory::FindByMap(std::string_view map_id) const {
+    if (auto it = map_to_shard_.find(std::string(map_id)); it != map_to_shard_.end()) {
+        return it->second;
+    }
+    return std::nullopt;
+}
+
+std::optional<size_t> Directory::FindByAuthorization(std::string_view authorization) const {
+    if (!authorization.starts_with(BEARER) || authorization.size() < BEARER.size() + 2) {
+        return std::nullopt;
+    }
+    const int high = HexValue(authorization[BEARER.size()]);
+    const int low = HexValue(authorization[BEARER.size() + 1]);
+    if (high < 0 || low < 0 || static_cast<size_t>(high * 16 + low) >= shards_.size()) {
+        return std::nullopt;
+    }
+    return static_cast<size_t>(high * 16 + low);
+}
+
+Route Classify(std::string_view target) {
+    auto path = target.substr(0, target.find('?'));
+    if (!path.starts_with(API_V1)) {
+        return {};
+    }
+    auto parts = SplitPath(path.substr(API_V1.size()));
+    if (parts.empty()) {
+        return {};
+    }
+    if (parts[0] == "maps"sv && parts.size() == 1) {
+        return { RouteKind::MAPS };
+    }
+    if ((parts[0] == "maps"sv || parts[0] == "map"sv) && parts.size() == 2) {
+        return { RouteKind::MAP, parts[1] };
+    }
+    if (parts[0] != "game"sv || parts.size() < 2) {
+        return {};
+    }
+    if (parts[1] == "records"sv) {
+        return { RouteKind::RECORDS };
+    }
+    if (parts[1] == "join"sv) {
+        return { RouteKind::JOIN };
+    }
+    if (parts[1] == "tick"sv) {
+        return { RouteKind::TICK };
+    }
+    if (parts[1] == "players"sv || parts[1] == "state"sv || parts[1] == "player"sv) {
+        return { RouteKind::PLAYER };
+    }
+    return {};
+}
+
+bool ParseRecordsQuery(std::string_view target, size_t& start, size_t& max_items) {
+    start = 0;
+    max_items = RECORDS_PAGE;
+    auto query_start = target.find('?');
+    if (query_start == target.npos) {
+        return true;
+    }
+    auto query = target.substr(query_start + 1);
+    while (!query.empty()) {
+        auto param = query.substr(0, query.find('&'));
+        query.remove_prefix(std::min(query.size(), param.size() + 1));
+        auto equals = param.find('=');
+        if (equals == param.npos) {
+            continue;
+        }
+        auto key = param.substr(0, equals);
+        auto value = param.substr(equals + 1);
+        if (key == "start"sv && !ParseSize(value, start)) {
+            return false;
+        }
+        if (key == "maxItems"sv && !ParseSize(value, max_items)) {
+            return false;
+        }
+    }
+    return max_items <= RECORDS_PAGE;
+}
+
+bool ReadRecords(std::string_view body, std::vector<Record>& records) {
+    return json_reader::ReadArray(body, [&records](std::string_view element) {
+        json_reader::Field name;
+        json_reader::Field score;
+        json_reader::Field playtime;
+        if (!json_reader::ReadObject(element, { {"name"sv, &name}, {"score"sv, &score}, {"playTime"sv, &playtime} })
+            || name.kind != json_reader::Field::STRING || score.kind != json_reader::Field::INT64
+            || playtime.kind == json_reader::Field::ABSENT) {
+            return false;
+        }
+        Record record{ std::string(name.string), score.int64, 0., std::string(element) };
+        auto [end, ec] = std::from_chars(playtime.raw.data(), playtime.raw.data() + playtime.raw.size(), record.playtime);
+        if (ec != std::errc{} || end != playtime.raw.data() + playtime.raw.size()) {
+            return false;
+        }
+        records.push_back(std::move(record));
+        return true;
+    });
+}
+
+std::string MergeRecords(std::vector<Record> records, size_t start, size_t max_items) {
+    // Тот же порядок, что и в запросе к базе
+    std::ranges::sort(records, [](const Record& lhs, const Record& rhs) {
+        if (lhs.score != rhs.score) {
+            return lhs.score > rhs.score;
+        }
+        if (lhs.playtime != rhs.playtime) {
+            return lhs.playtime < rhs.playtime;
+        }
+        return lhs.name < rhs.name;
+    });
+    std::string result = "["s;
+    for (size_t i = start; i < records.size() && i - start < max_items; ++i) {
+        if (i != start) {
+            result += ',';
+        }
+        result += records[i].json;
+    }
+    result += ']';
+    return result;
+}
+
+bool JoinArrays(const std::vector<std::string>& bodies, std::string& result) {
+    result = "["s;
+    bool first = true;
+    for (const auto& body : bodies) {
+        bool valid = json_reader::ReadArray(body, [&result, &first](std::string_view element) {
+            if (!first) {
+                result += ',';
+            }
+            result += element;
+            first = false;
+            return true;
+        });
+        if (!valid) {
+            return false;
+        }
+    }
+    result += ']';
+    return true;
+}
+
+}  // namespace router
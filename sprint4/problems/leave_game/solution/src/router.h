@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace router {
+
+/*
+ *  Распределение карт между процессами game_server (шардами) для game_router.
+ *  Шард i запускается с --shard-index i и --shard-maps со списком своих карт,
+ *  у каждой карты ровно один шард. Токены игроков шарда начинаются с двух hex-цифр его номера,
+ *  по ним роутер находит шард игрока. Запросы без карты и токена уходят шарду 0.
+ */
+
+constexpr size_t MAX_SHARDS = 256;
+// Столько рекордов шард отдаёт за один запрос
+constexpr size_t RECORDS_PAGE = 100;
+
+//Throws std::out_of_range if the index is MAX_SHARDS or more
+std::string MakeTokenPrefix(size_t shard);
+
+//Splits "map1,map2", empty items are skipped
+std::vector<std::string> SplitList(std::string_view list);
+
+struct Shard {
+    std::string host;
+    std::string port;
+    std::vector<std::string> map_ids;
+};
+
+//Parses "host:port=map1,map2", throws std::invalid_argument if the spec is wrong
+Shard ParseShard(std::string_view spec);
+
+class Directory {
+public:
+    //Shard i is the i-th one. Throws std::invalid_argument if there are no shards, too many or a map has two shards
+    explicit Directory(std::vector<Shard> shards);
+
+    size_t GetShardsCount() const noexcept {
+        return shards_.size();
+    }
+
+    const Shard& GetShard(size_t index) const {
+        return shards_.at(index);
+    }
+
+    std::optional<size_t> FindByMap(std::string_view map_id) const;
+
+    //authorization is the value of the Authorization header
+    std::optional<size_t> FindByAuthorization(std::string_view authorization) const;
+
+private:
+    std::vector<Shard> shards_;
+    std::unordered_map<std::string, size_t> map_to_shard_;
+};
+
+enum class RouteKind {
+    //Merged from all shards
+    MAPS,
+    RECORDS,
+    //Sent to every shard
+    TICK,
+    //Sent to the shard of the map
+    MAP,
+    JOIN,
+    //Sent to the shard of the token
+    PLAYER,
+    FIRST_SHARD
+};
+
+struct Route {
+    RouteKind kind = RouteKind::FIRST_SHARD;
+    //Set for MAP
+    std::string_view map_id{};
+};
+
+//target is the request target with the query
+Route Classify(std::string_view target);
+
+//Reads start and maxItems the way the game server does, false if they are wrong or maxItems is over RECORDS_PAGE
+bool ParseRecordsQuery(std::string_view target, size_t& start, size_t& max_items);
+
+struct Record {
+    std::string name;
+    std::int64_t score = 0;
+    double playtime = 0.;
+    //The record object as the shard sent it
+    std::string json;
+};
+
+//Appends records of a /api/v1/game/records body, false if the body isn't one
+bool ReadRecords(std::string_view body, std::vector<Record>& records);
+
+//Sorts records of shards with their own databases as the leaderboard does and returns the page as a JSON array
+std::string MergeRecords(std::vector<Record> records, size_t start, size_t max_items);
+
+//Joins JSON arrays into one, false if a body isn't an array
+bool JoinArrays(const std::vector<std::string>& bodies, std::string& result);
+
+}  // namespace router
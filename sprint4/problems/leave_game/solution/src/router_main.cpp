@@ -0,0 +1,473 @@
+#include "sdk.h"
+// boost.beast будет использовать std::string_view вместо boost::string_view
+#define BOOST_BEAST_USE_STD_STRING_VIEW
+
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/signal_set.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/websocket/rfc6455.hpp>
+#include <boost/program_options.hpp>
+#include <array>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "json_reader.h"
+#include "router.h"
+
+/*
+ *  Роутер шардированного развёртывания: принимает запросы клиентов и пересылает их
+ *  процессам game_server по keep-alive соединениям, по одному на шард у каждого клиентского соединения.
+ *  Вход в игру идёт по mapId, запросы игрока - по префиксу токена, карта - по её id.
+ *  Список карт собирается со всех шардов, ручной тик рассылается всем.
+ *  Шарды по умолчанию пишут рекорды в одну базу (GAME_DB_URL у всех одинаковый), поэтому таблицу рекордов
+ *  отдаёт шард 0. С --per-shard-database у каждого шарда своя база и таблица собирается со всех.
+ *  После ответа 101 соединение становится туннелем до шарда, так работает WebSocket.
+ *  Остальное, в том числе статические файлы, обслуживает шард 0.
+ */
+
+using namespace std::literals;
+namespace net = boost::asio;
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace websocket = beast::websocket;
+namespace sys = boost::system;
+using tcp = net::ip::tcp;
+
+namespace {
+
+using Request = http::request<http::string_body>;
+using Response = http::response<http::string_body>;
+
+constexpr size_t MAX_REQUEST_BODY = 1024 * 1024;
+// Через роутер идут и статические файлы
+constexpr size_t MAX_RESPONSE_BODY = 256 * 1024 * 1024;
+constexpr auto IDLE_TIMEOUT = 60s;
+constexpr auto SHARD_TIMEOUT = 30s;
+constexpr auto ACCEPT_RETRY_DELAY = 100ms;
+constexpr std::string_view BAD_GATEWAY = R"({ "code": "badGateway", "message": "Shard is unavailable" })"sv;
+
+struct Args {
+    std::string address = "0.0.0.0"s;
+    unsigned short port = 8080;
+    std::vector<std::string> shards;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    bool per_shard_database = false;
+};
+
+struct Context {
+    router::Directory directory;
+    std::vector<tcp::resolver::results_type> endpoints;
+    bool per_shard_database;
+};
+
+[[nodiscard]] std::optional<Args> ParseCommandLine(int argc, const char* const argv[]) {
+    namespace po = boost::program_options;
+
+    po::options_description desc{ "All options"s };
+
+    Args args;
+    desc.add_options()
+        ("help,h", "produce help message")
+        ("address", po::value(&args.address)->value_name("address"s), "set listening address, 0.0.0.0 by default")
+        ("port", po::value(&args.port)->value_name("port"s), "set listening port, 8080 by default")
+        ("shard", po::value(&args.shards)->value_name("host:port=map1,map2"s), "add a shard with its maps, the n-th one runs with --shard-index n")
+        ("threads", po::value(&args.threads)->value_name("count"s), "set number of threads")
+        ("per-shard-database", "merge records of all shards as each one keeps them in its own database");
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.contains("help"s)) {
+        std::cout << desc;
+        return std::nullopt;
+    }
+    if (args.shards.empty()) {
+        throw std::runtime_error("No shards"s);
+    }
+    if (args.threads == 0) {
+        throw std::runtime_error("Wrong number of threads"s);
+    }
+    args.per_shard_database = vm.contains("per-shard-database"s);
+    return args;
+}
+
+// Keep-alive соединение с шардом, после ошибки переподключается
+class Upstream {
+public:
+    Upstream(net::any_io_executor executor, const tcp::resolver::results_type& endpoints)
+        : stream_(executor)
+        , endpoints_(endpoints) {
+    }
+
+    //Returns nullopt if the shard can't be reached
+    net::awaitable<std::optional<Response>> Send(const Request& request) {
+        // Шард мог закрыть простаивавшее соединение, тогда запрос повторяется по новому
+        for (int attempt = 0; attempt < 2; ++attempt) {
+            const bool reused = connected_;
+            sys::error_code ec;
+            if (!connected_) {
+                stream_.expires_after(SHARD_TIMEOUT);
+                co_await stream_.async_connect(endpoints_, net::redirect_error(net::use_awaitable, ec));
+                if (ec) {
+                    co_return std::nullopt;
+                }
+                connected_ = true;
+            }
+            stream_.expires_after(SHARD_TIMEOUT);
+            co_await http::async_write(stream_, request, net::redirect_error(net::use_awaitable, ec));
+            http::response_parser<http::string_body> parser;
+            parser.body_limit(MAX_RESPONSE_BODY);
+            parser.skip(request.method() == http::verb::head);
+            if (!ec) {
+                co_await http::async_read(stream_, buffer_, parser, net::redirect_error(net::use_awaitable, ec));
+            }
+            if (!ec) {
+                stream_.expires_never();
+                auto response = parser.release();
+                if (response.need_eof()) {
+                    Close();
+                }
+                co_return response;
+            }
+            Close();
+            const bool closed_by_shard = ec == http::error::end_of_stream || ec == net::error::connection_reset || ec == net::error::broken_pipe;
+            if (!reused || !closed_by_shard) {
+                break;
+            }
+        }
+        co_return std::nullopt;
+    }
+
+    beast::tcp_stream& GetStream() {
+        return stream_;
+    }
+
+    //Bytes read past the last response
+    beast::flat_buffer& GetBuffer() {
+        return buffer_;
+    }
+
+private:
+    beast::tcp_stream stream_;
+    const tcp::resolver::results_type& endpoints_;
+    beast::flat_buffer buffer_;
+    bool connected_ = false;
+
+    void Close() {
+        sys::error_code ec;
+        stream_.socket().close(ec);
+        buffer_.clear();
+        connected_ = false;
+    }
+};
+
+Response MakeJsonResponse(http::status status, std::string body, unsigned version) {
+    Response response{ status, version };
+    response.set(http::field::content_type, "application/json"sv);
+    response.set(http::field::cache_control, "no-cache"sv);
+    response.body() = std::move(body);
+    response.prepare_payload();
+    return response;
+}
+
+// Копирует данные в одну сторону, пока одна из сторон не закроется, и закрывает обе
+net::awaitable<void> Pipe(std::shared_ptr<beast::tcp_stream> from, std::shared_ptr<beast::tcp_stream> to) {
+    std::array<char, 16 * 1024> data;
+    sys::error_code ec;
+    while (true) {
+        auto size = co_await from->async_read_some(net::buffer(data), net::redirect_error(net::use_awaitable, ec));
+        if (ec) {
+            break;
+        }
+        co_await net::async_write(*to, net::buffer(data, size), net::redirect_error(net::use_awaitable, ec));
+        if (ec) {
+            break;
+        }
+    }
+    from->socket().close(ec);
+    to->socket().close(ec);
+}
+
+class ClientSession {
+public:
+    ClientSession(tcp::socket&& socket, const Context& context)
+        : client_(std::move(socket))
+        , context_(context)
+        , upstreams_(context.directory.GetShardsCount()) {
+    }
+
+    net::awaitable<void> Run() {
+        while (true) {
+            http::request_parser<http::string_body> parser;
+            parser.body_limit(MAX_REQUEST_BODY);
+            client_.expires_after(IDLE_TIMEOUT);
+            sys::error_code ec;
+            co_await http::async_read(client_, buffer_, parser, net::redirect_error(net::use_awaitable, ec));
+            if (ec) {
+                break;
+            }
+            client_.expires_never();
+            auto request = parser.release();
+            const bool keep_alive = request.keep_alive();
+            std::optional<size_t> tunnel_shard;
+            auto response = co_await Process(request, tunnel_shard);
+            if (tunnel_shard) {
+                co_await StartTunnel(std::move(response), *tunnel_shard);
+                co_return;
+            }
+            response.keep_alive(keep_alive);
+            co_await http::async_write(client_, response, net::redirect_error(net::use_awaitable, ec));
+            if (ec || !keep_alive) {
+                break;
+            }
+        }
+        sys::error_code ec;
+        client_.socket().shutdown(tcp::socket::shutdown_send, ec);
+    }
+
+private:
+    beast::tcp_stream client_;
+    beast::flat_buffer buffer_;
+    const Context& context_;
+    std::vector<std::unique_ptr<Upstream>> upstreams_;
+
+    Upstream& GetUpstream(size_t shard) {
+        if (!upstreams_[shard]) {
+            upstreams_[shard] = std::make_unique<Upstream>(client_.get_executor(), context_.endpoints[shard]);
+        }
+        return *upstreams_[shard];
+    }
+
+    net::awaitable<Response> Forward(size_t shard, Request request, std::optional<size_t>& tunnel_shard) {
+        const unsigned version = request.version();
+        const bool upgrade = websocket::is_upgrade(request);
+        if (!upgrade) {
+            request.keep_alive(true);
+        }
+        auto response = co_await GetUpstream(shard).Send(request);
+        if (!response) {
+            co_return MakeJsonResponse(http::status::bad_gateway, std::string(BAD_GATEWAY), version);
+        }
+        if (upgrade && response->result() == http::status::switching_protocols) {
+            tunnel_shard = shard;
+        }
+        co_return std::move(*response);
+    }
+
+    // Тело без сжатия, чтобы его можно было разобрать
+    net::awaitable<std::optional<Response>> Fetch(size_t shard, const Request& original, std::string_view target) {
+        Request request{ http::verb::get, target, original.version() };
+        request.set(http::field::host, original[http::field::host]);
+        request.keep_alive(true);
+        co_return co_await GetUpstream(shard).Send(request);
+    }
+
+    net::awaitable<Response> Process(const Request& request, std::optional<size_t>& tunnel_shard) {
+        const auto& directory = context_.directory;
+        const auto route = router::Classify(request.target());
+        switch (route.kind) {
+        case router::RouteKind::MAPS:
+            if (request.method() == http::verb::get) {
+                co_return co_await MergeMaps(request);
+            }
+            break;
+        case router::RouteKind::RECORDS: {
+            size_t start;
+            size_t max_items;
+            // Неверные параметры отклонит шард 0
+            if (context_.per_shard_database && request.method() == http::verb::get && router::ParseRecordsQuery(request.target(), start, max_items)) {
+                co_return co_await MergeRecords(request, start, max_items);
+            }
+            break;
+        }
+        case router::RouteKind::TICK:
+            co_return co_await BroadcastTick(request);
+        case router::RouteKind::MAP:
+            co_return co_await Forward(directory.FindByMap(route.map_id).value_or(0), request, tunnel_shard);
+        case router::RouteKind::JOIN: {
+            json_reader::Field map_id;
+            size_t shard = 0;
+            if (json_reader::ReadObject(request.body(), { {"mapId"sv, &map_id} }) && map_id.kind == json_reader::Field::STRING) {
+                shard = directory.FindByMap(map_id.string).value_or(0);
+            }
+            co_return co_await Forward(shard, request, tunnel_shard);
+        }
+        case router::RouteKind::PLAYER:
+            co_return co_await Forward(directory.FindByAuthorization(request[http::field::authorization]).value_or(0), request, tunnel_shard);
+        case router::RouteKind::FIRST_SHARD:
+            break;
+        }
+        co_return co_await Forward(0, request, tunnel_shard);
+    }
+
+    net::awaitable<Response> MergeMaps(const Request& request) {
+        std::vector<std::string> bodies;
+        for (size_t shard = 0; shard < upstreams_.size(); ++shard) {
+            auto response = co_await Fetch(shard, request, request.target());
+            if (!response) {
+                co_return MakeJsonResponse(http::status::bad_gateway, std::string(BAD_GATEWAY), request.version());
+            }
+            if (response->result() != http::status::ok) {
+                co_return std::move(*response);
+            }
+            bodies.push_back(std::move(response->body()));
+        }
+        std::string maps;
+        if (!router::JoinArrays(bodies, maps)) {
+            co_return MakeJsonResponse(http::status::bad_gateway, std::string(BAD_GATEWAY), request.version());
+        }
+        co_return MakeJsonResponse(http::status::ok, std::move(maps), request.version());
+    }
+
+    // С каждого шарда берутся первые start + max_items рекордов, больше на странице быть не может
+    net::awaitable<Response> MergeRecords(const Request& request, size_t start, size_t max_items) {
+        std::vector<router::Record> records;
+        for (size_t shard = 0; shard < upstreams_.size(); ++shard) {
+            for (size_t offset = 0; offset < start + max_items; offset += router::RECORDS_PAGE) {
+                const auto target = "/api/v1/game/records?start="s + std::to_string(offset) + "&maxItems="s + std::to_string(router::RECORDS_PAGE);
+                auto response = co_await Fetch(shard, request, target);
+                if (!response) {
+                    co_return MakeJsonResponse(http::status::bad_gateway, std::string(BAD_GATEWAY), request.version());
+                }
+                if (response->result() != http::status::ok) {
+                    co_return std::move(*response);
+                }
+                const size_t before = records.size();
+                if (!router::ReadRecords(response->body(), records)) {
+                    co_return MakeJsonResponse(http::status::bad_gateway, std::string(BAD_GATEWAY), request.version());
+                }
+                if (records.size() - before < router::RECORDS_PAGE) {
+                    break;
+                }
+            }
+        }
+        co_return MakeJsonResponse(http::status::ok, router::MergeRecords(std::move(records), start, max_items), request.version());
+    }
+
+    // Ответ первого шарда, отклонившего тик, иначе ответ последнего
+    net::awaitable<Response> BroadcastTick(const Request& request) {
+        std::optional<Response> last;
+        for (size_t shard = 0; shard < upstreams_.size(); ++shard) {
+            Request copy = request;
+            copy.keep_alive(true);
+            last = co_await GetUpstream(shard).Send(copy);
+            if (!last) {
+                co_return MakeJsonResponse(http::status::bad_gateway, std::string(BAD_GATEWAY), request.version());
+            }
+            if (last->result() != http::status::ok) {
+                break;
+            }
+        }
+        co_return std::move(*last);
+    }
+
+    net::awaitable<void> StartTunnel(Response response, size_t shard) {
+        auto& upstream = GetUpstream(shard);
+        sys::error_code ec;
+        co_await http::async_write(client_, response, net::redirect_error(net::use_awaitable, ec));
+        // Кадры, прочитанные вместе с ответом или запросом, отправляются первыми
+        if (!ec && upstream.GetBuffer().size() != 0) {
+            co_await net::async_write(client_, upstream.GetBuffer().data(), net::redirect_error(net::use_awaitable, ec));
+        }
+        if (!ec && buffer_.size() != 0) {
+            co_await net::async_write(upstream.GetStream(), buffer_.data(), net::redirect_error(net::use_awaitable, ec));
+        }
+        if (ec) {
+            co_return;
+        }
+        auto client = std::make_shared<beast::tcp_stream>(std::move(client_));
+        auto shard_stream = std::make_shared<beast::tcp_stream>(std::move(upstream.GetStream()));
+        client->expires_never();
+        shard_stream->expires_never();
+        auto executor = co_await net::this_coro::executor;
+        net::co_spawn(executor, Pipe(shard_stream, client), net::detached);
+        net::co_spawn(executor, Pipe(client, shard_stream), net::detached);
+    }
+};
+
+net::awaitable<void> Serve(tcp::socket socket, const Context& context) {
+    ClientSession session{ std::move(socket), context };
+    co_await session.Run();
+}
+
+net::awaitable<void> Listen(tcp::acceptor acceptor, const Context& context) {
+    while (true) {
+        sys::error_code ec;
+        // Каждое соединение работает в своём strand, туннель читает и пишет его сокет из двух корутин
+        auto socket = co_await acceptor.async_accept(net::make_strand(acceptor.get_executor()), net::redirect_error(net::use_awaitable, ec));
+        if (ec) {
+            if (ec == net::error::operation_aborted) {
+                co_return;
+            }
+            // Без паузы нехватка дескрипторов (EMFILE, ENFILE) превратит цикл в холостой
+            std::cerr << "accept failed: "sv << ec.message() << std::endl;
+            net::steady_timer timer{ acceptor.get_executor(), ACCEPT_RETRY_DELAY };
+            co_await timer.async_wait(net::redirect_error(net::use_awaitable, ec));
+            if (ec == net::error::operation_aborted) {
+                co_return;
+            }
+            continue;
+        }
+        auto executor = socket.get_executor();
+        net::co_spawn(executor, Serve(std::move(socket), context), net::detached);
+    }
+}
+
+}  // namespace
+
+int main(int argc, const char* argv[]) {
+    try {
+        auto args = ParseCommandLine(argc, argv);
+        if (!args) {
+            return EXIT_SUCCESS;
+        }
+
+        std::vector<router::Shard> shards;
+        for (const auto& spec : args->shards) {
+            shards.push_back(router::ParseShard(spec));
+        }
+        net::io_context ioc(static_cast<int>(args->threads));
+        tcp::resolver resolver{ ioc };
+        std::vector<tcp::resolver::results_type> endpoints;
+        for (const auto& shard : shards) {
+            endpoints.push_back(resolver.resolve(shard.host, shard.port));
+        }
+        Context context{ router::Directory{ std::move(shards) }, std::move(endpoints), args->per_shard_database };
+
+        net::signal_set signals(ioc, SIGINT, SIGTERM);
+        signals.async_wait([&ioc](const sys::error_code& ec, [[maybe_unused]] int signal_number) {
+            if (!ec) {
+                ioc.stop();
+            }
+        });
+
+        const tcp::endpoint endpoint{ net::ip::make_address(args->address), args->port };
+        tcp::acceptor acceptor{ ioc, endpoint };
+        net::co_spawn(ioc, Listen(std::move(acceptor), context), net::detached);
+        std::cout << "router started on "sv << endpoint << " with "sv << context.directory.GetShardsCount() << " shards"sv << std::endl;
+
+        std::vector<std::jthread> workers;
+        for (unsigned i = 1; i < args->threads; ++i) {
+            workers.emplace_back([&ioc] {
+                ioc.run();
+            });
+        }
+        ioc.run();
+    } catch (const std::exception& ex) {
+        std::cerr << ex.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+}
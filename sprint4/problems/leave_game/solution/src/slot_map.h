@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace util {
+
+/*
+ *  Хранилище объектов с доступом по дескриптору за O(1).
+ *  Значения лежат подряд в одном векторе, удаление переносит последнее значение на место удалённого,
+ *  поэтому адреса значений меняются при вставке и удалении, а дескрипторы - нет.
+ *  Дескриптор хранит номер ячейки и её поколение; после удаления поколение ячейки растёт,
+ *  и устаревший дескриптор больше ничего не находит, даже если ячейка занята заново.
+ */
+template <typename T>
+class SlotMap {
+public:
+    struct Handle {
+        static constexpr std::uint32_t INVALID_INDEX = std::numeric_limits<std::uint32_t>::max();
+
+        std::uint32_t index = INVALID_INDEX;
+        std::uint32_t generation = 0;
+
+        bool operator==(const Handle&) const = default;
+    };
+
+    using iterator = typename std::vector<T>::iterator;
+    using const_iterator = typename std::vector<T>::const_iterator;
+
+    Handle Insert(T&& value) {
+        std::uint32_t index;
+        if (free_head_ != Handle::INVALID_INDEX) {
+            index = free_head_;
+            free_head_ = slots_[index].position;
+        }
+        else {
+            index = static_cast<std::uint32_t>(slots_.size());
+            slots_.push_back({});
+        }
+        slots_[index].position = static_cast<std::uint32_t>(values_.size());
+        values_.push_back(std::move(value));
+        value_slots_.push_back(index);
+        return { index, slots_[index].generation };
+    }
+
+    //False if the handle is stale
+    bool Erase(Handle handle) {
+        if (!Contains(handle)) {
+            return false;
+        }
+        auto& slot = slots_[handle.index];
+        const std::uint32_t position = slot.position;
+        const std::uint32_t last = static_cast<std::uint32_t>(values_.size() - 1);
+        if (position != last) {
+            values_[position] = std::move(values_[last]);
+            value_slots_[position] = value_slots_[last];
+            slots_[value_slots_[position]].position = position;
+        }
+        values_.pop_back();
+        value_slots_.pop_back();
+        ++slot.generation;
+        slot.position = free_head_;
+        free_head_ = handle.index;
+        return true;
+    }
+
+    bool Contains(Handle handle) const {
+        return handle.index < slots_.size() && slots_[handle.index].generation == handle.generation;
+    }
+
+    //nullptr if the handle is stale. The pointer is valid until the next Insert or Erase
+    T* Find(Handle handle) {
+        return Contains(handle) ? &values_[slots_[handle.index].position] : nullptr;
+    }
+
+    const T* Find(Handle handle) const {
+        return Contains(handle) ? &values_[slots_[handle.index].position] : nullptr;
+    }
+
+    //Handle of the value at the given position of the dense storage
+    Handle GetHandle(size_t position) const {
+        const std::uint32_t index = value_slots_[position];
+        return { index, slots_[index].generation };
+    }
+
+    void Reserve(size_t size) {
+        values_.reserve(size);
+        value_slots_.reserve(size);
+        slots_.reserve(size);
+    }
+
+    size_t Size() const {
+        return values_.size();
+    }
+
+    bool Empty() const {
+        return values_.empty();
+    }
+
+    // Порядок обхода меняется при удалении
+    iterator begin() {
+        return values_.begin();
+    }
+
+    iterator end() {
+        return values_.end();
+    }
+
+    const_iterator begin() const {
+        return values_.begin();
+    }
+
+    const_iterator end() const {
+        return values_.end();
+    }
+
+private:
+    struct Slot {
+        // Позиция значения в values_, а у свободной ячейки - номер следующей свободной
+        std::uint32_t position = Handle::INVALID_INDEX;
+        std::uint32_t generation = 0;
+    };
+
+    std::vector<T> values_;
+    // Ячейка каждого значения, параллельно values_
+    std::vector<std::uint32_t> value_slots_;
+    std::vector<Slot> slots_;
+    std::uint32_t free_head_ = Handle::INVALID_INDEX;
+};
+
+}  // namespace util
@@ -2,6 +2,7 @@
 
 #include "db.h"
 #include "model.h"
+#include "trace.h"
 
 namespace model {
 
@@ -12,6 +13,7 @@ public:
     { }
 
     void Save(const std::vector<SaveStat>& stats) override {
+        trace::Span span{ "db", "save stats" };
         auto conn = pool_->GetConnection();
         pqxx::work work {*conn};
         for (const auto& stat : stats) {
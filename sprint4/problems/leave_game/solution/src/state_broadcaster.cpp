@@ -0,0 +1,97 @@
+#include "state_broadcaster.h"
+
+#include <string>
+#include <utility>
+
+#include "json_writer.h"
+
+namespace state_broadcaster {
+
+void StateBroadcaster::Subscribe(model::GameSession* session, size_t dog_id, std::shared_ptr<Connection> connection) {
+    net::dispatch(strand_, [self = shared_from_this(), session, dog_id, connection = std::move(connection)] {
+        // Игрок мог покинуть игру, пока шло рукопожатие
+        if (!session->FindDog(dog_id)) {
+            connection->Close();
+            return;
+        }
+        auto [channel, inserted] = self->channels_.try_emplace(session);
+        if (inserted) {
+            // Следующая дельта считается от текущего поколения
+            channel->second.generation = session->GetGeneration();
+        }
+        connection->Send(self->MakeSnapshot(*session));
+        channel->second.subscribers.push_back({ connection, dog_id, false, 0 });
+    });
+}
+
+void StateBroadcaster::OnTick(unsigned delta) {
+    pending_delta_ += delta;
+    if (budget_ && !budget_->ShouldBroadcast()) {
+        return;
+    }
+    delta = std::exchange(pending_delta_, 0u);
+    for (auto it = channels_.begin(); it != channels_.end();) {
+        auto& [session, channel] = *it;
+        std::erase_if(channel.subscribers, [session](const Subscriber& subscriber) {
+            auto connection = subscriber.connection.lock();
+            if (connection && !session->FindDog(subscriber.dog_id)) {
+                connection->Close();
+                return true;
+            }
+            return !connection || !connection->IsOpen();
+        });
+        if (channel.subscribers.empty()) {
+            it = channels_.erase(it);
+            continue;
+        }
+
+        bool covered = true;
+        auto changes = MakeDelta(channel.generation, *session, covered);
+        channel.generation = session->GetGeneration();
+        Connection::Message snapshot;
+        for (auto& subscriber : channel.subscribers) {
+            auto connection = subscriber.connection.lock();
+            if (connection->Backlog() != 0) {
+                // Прошлое сообщение ещё не ушло: не копим очередь, а потом отправим снимок
+                subscriber.needs_snapshot = true;
+                subscriber.lag += delta;
+                if (subscriber.lag > MAX_LAG) {
+                    connection->Close();
+                }
+                continue;
+            }
+            subscriber.lag = 0;
+            if (subscriber.needs_snapshot || !covered) {
+                if (!snapshot) {
+                    snapshot = MakeSnapshot(*session);
+                }
+                connection->Send(snapshot);
+                subscriber.needs_snapshot = false;
+            }
+            else if (changes) {
+                connection->Send(changes);
+            }
+        }
+        ++it;
+    }
+}
+
+StateBroadcaster::Connection::Message StateBroadcaster::MakeSnapshot(const model::GameSession& session) {
+    std::string text;
+    auto buffer = net::dynamic_buffer(text);
+    json_writer::WriteStateSnapshot(buffer, session);
+    return std::make_shared<const std::string>(std::move(text));
+}
+
+StateBroadcaster::Connection::Message StateBroadcaster::MakeDelta(model::ChangeLog::Generation since, const model::GameSession& session, bool& covered) {
+    covered = session.GetChangesSince(since, changes_);
+    if (!covered || changes_.Empty()) {
+        return nullptr;
+    }
+    std::string text;
+    auto buffer = net::dynamic_buffer(text);
+    json_writer::WriteStateDelta(buffer, session, changes_);
+    return std::make_shared<const std::string>(std::move(text));
+}
+
+}  // namespace state_broadcaster
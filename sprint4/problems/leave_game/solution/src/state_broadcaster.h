@@ -0,0 +1,72 @@
+#pragma once
+
+#include <boost/asio/strand.hpp>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "http_server.h"
+#include "model.h"
+#include "tick_budget.h"
+
+namespace state_broadcaster {
+
+namespace net = boost::asio;
+
+/*
+ *  Рассылает подписчикам по WebSocket изменения состояния их игровой сессии после каждого тика.
+ *  Изменения берутся из журнала изменений сессии, сериализуются один раз и уходят всем её подписчикам.
+ *  Подписчик, который ещё не получил прошлое сообщение, пропускает изменения,
+ *  а догнав, получает снимок всего состояния. Отстающий дольше MAX_LAG отключается,
+ *  как и подписчик, чей игрок покинул игру.
+ *  OnTick вызывается в strand приложения, Subscribe - из любого потока.
+ */
+class StateBroadcaster : public app::ApplicationListener, public std::enable_shared_from_this<StateBroadcaster> {
+public:
+    using Strand = net::strand<net::io_context::executor_type>;
+    using Connection = http_server::WebSocketSession;
+
+    explicit StateBroadcaster(Strand strand)
+        : strand_{ strand } {
+    }
+
+    //The subscriber gets a snapshot right away and deltas after each tick until the dog retires
+    void Subscribe(model::GameSession* session, size_t dog_id, std::shared_ptr<Connection> connection);
+
+    void OnTick(unsigned delta) override;
+
+    //When the budget thins out broadcasts, skipped ticks go out with the next broadcast
+    void SetTickBudget(std::shared_ptr<tick_budget::Controller> budget) {
+        budget_ = std::move(budget);
+    }
+
+private:
+    constexpr static unsigned MAX_LAG = 5000;
+
+    struct Subscriber {
+        std::weak_ptr<Connection> connection;
+        size_t dog_id;
+        bool needs_snapshot;
+        unsigned lag;
+    };
+
+    //Subscribers of one game session and the generation they were last sent
+    struct Channel {
+        std::vector<Subscriber> subscribers;
+        model::ChangeLog::Generation generation;
+    };
+
+    Strand strand_;
+    std::unordered_map<const model::GameSession*, Channel> channels_;
+    model::ChangeSet changes_;
+    std::shared_ptr<tick_budget::Controller> budget_;
+    // Время тиков, пропущенных с последней рассылки
+    unsigned pending_delta_ = 0;
+
+    static Connection::Message MakeSnapshot(const model::GameSession& session);
+
+    //Returns nullptr if nothing changed since the generation
+    Connection::Message MakeDelta(model::ChangeLog::Generation since, const model::GameSession& session, bool& covered);
+};
+
+}  // namespace state_broadcaster
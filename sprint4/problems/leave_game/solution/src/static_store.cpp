@@ -0,0 +1,208 @@
+#include "static_store.h"
+
+#include <boost/beast/core/flat_buffer.hpp>
+#include <charconv>
+#include <chrono>
+#include <ctime>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "compression.h"
+
+namespace static_store {
+
+using namespace std::literals;
+namespace fs = std::filesystem;
+
+namespace {
+
+// The gzip variant is kept only if it saves at least 1/8 of the size
+constexpr size_t MIN_SAVING_DIVISOR = 8;
+
+std::string ReadFile(const fs::path& path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+// Отображение только для чтения, снимается вместе с последним владельцем
+std::shared_ptr<const char> MapFile(const fs::path& path, size_t size) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+    void* data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        return nullptr;
+    }
+    return std::shared_ptr<const char>(static_cast<const char*>(data), [size](const char* data) {
+        ::munmap(const_cast<char*>(data), size);
+    });
+}
+
+//Size and modification time in nanoseconds, false if the file is gone
+bool StatFile(const std::string& path, std::uint64_t& size, std::int64_t& mtime_ns) {
+    struct stat info;
+    if (::stat(path.c_str(), &info) != 0) {
+        return false;
+    }
+    size = static_cast<std::uint64_t>(info.st_size);
+    mtime_ns = static_cast<std::int64_t>(info.st_mtim.tv_sec) * 1'000'000'000 + info.st_mtim.tv_nsec;
+    return true;
+}
+
+std::chrono::system_clock::time_point ToSystemTime(fs::file_time_type time) {
+    return std::chrono::time_point_cast<std::chrono::system_clock::duration>(std::chrono::file_clock::to_sys(time));
+}
+
+std::string FormatHttpDate(std::chrono::system_clock::time_point time) {
+    std::time_t seconds = std::chrono::system_clock::to_time_t(time);
+    std::tm tm;
+    gmtime_r(&seconds, &tm);
+    char buffer[32];
+    auto size = std::strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return std::string(buffer, size);
+}
+
+// Size and modification time in hex, as nginx does
+std::string MakeETag(std::uint64_t size, std::chrono::system_clock::time_point time, std::string_view suffix) {
+    char buffer[64];
+    char* end = buffer;
+    *end++ = '"';
+    end = std::to_chars(end, buffer + sizeof(buffer), size, 16).ptr;
+    *end++ = '-';
+    auto seconds = std::chrono::duration_cast<std::chrono::seconds>(time.time_since_epoch()).count();
+    end = std::to_chars(end, buffer + sizeof(buffer), seconds, 16).ptr;
+    return std::string(buffer, end) + std::string(suffix) + '"';
+}
+
+std::string_view Trim(std::string_view value) {
+    auto start = value.find_first_not_of(" \t"sv);
+    if (start == value.npos) {
+        return {};
+    }
+    return value.substr(start, value.find_last_not_of(" \t"sv) - start + 1);
+}
+
+bool ParseNumber(std::string_view value, std::uint64_t& number) {
+    auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), number);
+    return !value.empty() && ec == std::errc{} && end == value.data() + value.size();
+}
+
+}  // namespace
+
+StaticStore::StaticStore(const fs::path& root, size_t max_in_memory_size) {
+    if (!fs::is_directory(root)) {
+        return;
+    }
+    auto& compressor = compression::GzipCompressor::ForThisThread();
+    for (const auto& entry : fs::recursive_directory_iterator(root, fs::directory_options::skip_permission_denied)) {
+        if (!entry.is_regular_file()) {
+            continue;
+        }
+        const auto size = entry.file_size();
+        const auto modified = ToSystemTime(entry.last_write_time());
+        Entry stored;
+        if (size <= max_in_memory_size) {
+            stored.content = ReadFile(entry.path());
+            boost::beast::flat_buffer gzip;
+            compressor.Compress(stored.content, gzip);
+            if (gzip.size() + stored.content.size() / MIN_SAVING_DIVISOR <= stored.content.size()) {
+                stored.file.gzip.assign(static_cast<const char*>(gzip.data().data()), gzip.size());
+                stored.file.gzip_etag = MakeETag(size, modified, "-gz"sv);
+            }
+        }
+        else {
+            stored.disk_path = entry.path().string();
+            std::uint64_t mapped_size;
+            // Время изменения берётся до отображения: изменение во время mmap заметит первая проверка
+            if (!StatFile(stored.disk_path, mapped_size, stored.mtime_ns) || mapped_size != size
+                || !(stored.mapping = MapFile(entry.path(), size))) {
+                continue;
+            }
+        }
+        stored.file.etag = MakeETag(size, modified, ""sv);
+        stored.file.last_modified = FormatHttpDate(modified);
+        auto it = files_.emplace("/" + entry.path().lexically_relative(root).generic_string(), std::move(stored)).first;
+        // The view is taken after the move, short strings keep their data inline
+        auto& placed = it->second;
+        placed.file.data = placed.mapping ? std::string_view(placed.mapping.get(), size) : std::string_view(placed.content);
+    }
+}
+
+const StaticStore::File* StaticStore::Find(std::string_view path) const {
+    auto file = files_.find(path);
+    if (file == files_.end()) {
+        return nullptr;
+    }
+    const auto& entry = file->second;
+    if (entry.mapping) {
+        std::uint64_t size;
+        std::int64_t mtime_ns;
+        if (!StatFile(entry.disk_path, size, mtime_ns) || size != entry.file.data.size() || mtime_ns != entry.mtime_ns) {
+            return nullptr;
+        }
+    }
+    return &entry.file;
+}
+
+RangeStatus ParseRange(std::string_view header, std::uint64_t size, ByteRange& range) {
+    constexpr std::string_view BYTES = "bytes="sv;
+    if (!header.starts_with(BYTES) || header.find(',') != header.npos) {
+        return RangeStatus::WHOLE;
+    }
+    auto spec = Trim(header.substr(BYTES.size()));
+    auto dash = spec.find('-');
+    if (dash == spec.npos) {
+        return RangeStatus::WHOLE;
+    }
+    std::uint64_t first;
+    std::uint64_t last;
+    if (dash == 0) {
+        if (!ParseNumber(spec.substr(1), last)) {
+            return RangeStatus::WHOLE;
+        }
+        if (last == 0 || size == 0) {
+            return RangeStatus::UNSATISFIABLE;
+        }
+        range.length = std::min(last, size);
+        range.offset = size - range.length;
+        return RangeStatus::PARTIAL;
+    }
+    if (!ParseNumber(spec.substr(0, dash), first)) {
+        return RangeStatus::WHOLE;
+    }
+    if (dash + 1 == spec.size()) {
+        last = size - 1;
+    }
+    else if (!ParseNumber(spec.substr(dash + 1), last) || last < first) {
+        return RangeStatus::WHOLE;
+    }
+    if (first >= size) {
+        return RangeStatus::UNSATISFIABLE;
+    }
+    range.offset = first;
+    range.length = std::min(last, size - 1) - first + 1;
+    return RangeStatus::PARTIAL;
+}
+
+bool MatchesETag(std::string_view if_none_match, std::string_view etag) {
+    while (!if_none_match.empty()) {
+        auto candidate = if_none_match.substr(0, if_none_match.find(','));
+        if_none_match.remove_prefix(std::min(if_none_match.size(), candidate.size() + 1));
+        candidate = Trim(candidate);
+        if (candidate.starts_with("W/"sv)) {
+            candidate.remove_prefix(2);
+        }
+        if (candidate == "*"sv || candidate == etag) {
+            return true;
+        }
+    }
+    return false;
+}
+
+}  // namespace static_store
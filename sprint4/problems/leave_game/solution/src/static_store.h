@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace static_store {
+
+/*
+ *  Статические файлы, загруженные при запуске сервера.
+ *  Небольшие файлы копируются в память, для них заранее готовится gzip-вариант,
+ *  если он заметно меньше. Большие файлы отображаются в память через mmap
+ *  и отдаются как есть, страницы подгружает ядро.
+ *  Небольшие файлы - снимок на момент запуска. У отображённого файла перед выдачей сверяются
+ *  размер и время изменения: изменённый файл хранилище больше не отдаёт, его читают с диска.
+ *  Файл, который урезают на месте во время отправки, может привести к SIGBUS, поэтому
+ *  файлы в корне обновляются заменой (rename), а не перезаписью.
+ *  Появившиеся после запуска файлы в хранилище не попадают и тоже читаются с диска.
+ */
+class StaticStore {
+public:
+    static constexpr size_t MAX_IN_MEMORY_SIZE = 1024 * 1024;
+
+    struct File {
+        //Points into memory owned by the store
+        std::string_view data;
+        //Empty if compression doesn't pay off or the file is mapped
+        std::string gzip;
+        //Strong validators, quoted as sent in the ETag header
+        std::string etag;
+        std::string gzip_etag;
+        //HTTP-date of the modification time
+        std::string last_modified;
+    };
+
+    StaticStore() = default;
+    explicit StaticStore(const std::filesystem::path& root, size_t max_in_memory_size = MAX_IN_MEMORY_SIZE);
+
+    StaticStore(const StaticStore&) = delete;
+    StaticStore& operator=(const StaticStore&) = delete;
+
+    //path is relative to the root and starts with '/', e.g. "/index.html".
+    //Returns nullptr for a mapped file which changed on disk since loading
+    const File* Find(std::string_view path) const;
+
+    size_t GetFilesCount() const {
+        return files_.size();
+    }
+
+private:
+    struct PathHash {
+        using is_transparent = void;
+
+        size_t operator()(std::string_view path) const {
+            return std::hash<std::string_view>{}(path);
+        }
+    };
+
+    struct Entry {
+        File file;
+        std::string content;
+        std::shared_ptr<const char> mapping;
+        //Set for mapped files to check them before serving
+        std::string disk_path;
+        std::int64_t mtime_ns = 0;
+    };
+
+    std::unordered_map<std::string, Entry, PathHash, std::equal_to<>> files_;
+};
+
+struct ByteRange {
+    std::uint64_t offset = 0;
+    std::uint64_t length = 0;
+};
+
+enum class RangeStatus {
+    WHOLE,
+    PARTIAL,
+    UNSATISFIABLE
+};
+
+/*
+ * Разбирает заголовок Range для файла размера size.
+ * Поддерживается один диапазон байт: "bytes=a-b", "bytes=a-" и "bytes=-n".
+ * Некорректный заголовок и несколько диапазонов дают WHOLE - файл отдаётся целиком.
+ */
+RangeStatus ParseRange(std::string_view header, std::uint64_t size, ByteRange& range);
+
+//Weak comparison of If-None-Match list with etag, "*" matches anything
+bool MatchesETag(std::string_view if_none_match, std::string_view etag);
+
+}  // namespace static_store
@@ -0,0 +1,106 @@
+#include "tick_budget.h"
+
+#include <stdexcept>
+
+namespace tick_budget {
+
+using namespace std::literals;
+
+namespace {
+
+// Вес нового тика в скользящем среднем
+constexpr double SMOOTHING = 1. / 8.;
+
+double ToMicroseconds(std::chrono::steady_clock::duration duration) {
+    return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+}  // namespace
+
+Controller::Controller(Config config)
+    : config_(config) {
+    if (config_.budget.count() <= 0 || config_.broadcast_interval == 0) {
+        throw std::invalid_argument("Wrong tick budget"s);
+    }
+}
+
+model::TickOptions Controller::BeforeTick() {
+    ++tick_;
+    model::TickOptions options;
+    if (level_ >= DEFER_BACKGROUND) {
+        // Генерация трофеев и поиск AFK идут в разных тиках, чтобы не складываться
+        options.spawn_loot = tick_ % BACKGROUND_INTERVAL == 0;
+        options.scan_afk = tick_ % BACKGROUND_INTERVAL == BACKGROUND_INTERVAL / 2;
+        if (!options.spawn_loot) {
+            counters_.loot_deferrals.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (!options.scan_afk) {
+            counters_.afk_scans_skipped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    return options;
+}
+
+void Controller::AfterTick(std::chrono::steady_clock::duration duration, const model::TickProfile& profile) {
+    const double tick_us = ToMicroseconds(duration);
+    average_us_ += (tick_us - average_us_) * SMOOTHING;
+    for (size_t i = 0; i < PHASES.size(); ++i) {
+        phase_average_us_[i] += (ToMicroseconds(profile.*PHASES[i].second) - phase_average_us_[i]) * SMOOTHING;
+        counters_.phase_us[i].store(static_cast<uint64_t>(phase_average_us_[i]), std::memory_order_relaxed);
+    }
+    counters_.ticks.fetch_add(1, std::memory_order_relaxed);
+    counters_.last_tick_us.store(static_cast<uint64_t>(tick_us), std::memory_order_relaxed);
+    counters_.average_tick_us.store(static_cast<uint64_t>(average_us_), std::memory_order_relaxed);
+
+    const double budget_us = static_cast<double>(config_.budget.count());
+    if (tick_us > budget_us) {
+        counters_.over_budget_ticks.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (++ticks_at_level_ < HOLD_TICKS) {
+        return;
+    }
+    if (average_us_ > budget_us) {
+        for (unsigned level = level_ + 1; level <= STRETCH_PERIOD; ++level) {
+            if (IsEnabled(static_cast<Level>(level))) {
+                SetLevel(static_cast<Level>(level));
+                break;
+            }
+        }
+    }
+    else if (average_us_ < budget_us * 3 / 4 && level_ != NORMAL) {
+        unsigned level = level_ - 1;
+        while (!IsEnabled(static_cast<Level>(level))) {
+            --level;
+        }
+        SetLevel(static_cast<Level>(level));
+    }
+}
+
+bool Controller::ShouldBroadcast() noexcept {
+    if (level_ < THIN_BROADCAST || tick_ % config_.broadcast_interval == 0) {
+        return true;
+    }
+    counters_.broadcasts_skipped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+bool Controller::IsEnabled(Level level) const noexcept {
+    switch (level) {
+    case THIN_BROADCAST:
+        return config_.broadcast_interval > 1;
+    case STRETCH_PERIOD:
+        return config_.max_period_stretch.count() > 0;
+    default:
+        return true;
+    }
+}
+
+void Controller::SetLevel(Level level) noexcept {
+    level_ = level;
+    ticks_at_level_ = 0;
+    counters_.level.store(level, std::memory_order_relaxed);
+    const auto stretch = level == STRETCH_PERIOD ? config_.max_period_stretch.count() : 0;
+    counters_.period_stretch_ms.store(static_cast<uint64_t>(stretch), std::memory_order_relaxed);
+}
+
+}  // namespace tick_budget
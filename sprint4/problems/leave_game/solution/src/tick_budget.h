@@ -0,0 +1,107 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+
+#include "model.h"
+
+namespace tick_budget {
+
+/*
+ *  Держит время тика в пределах бюджета ценой точности игры.
+ *  Время тика вместе со слушателями сглаживается скользящим средним. Пока среднее выше бюджета,
+ *  раз в HOLD_TICKS тиков включается следующая ступень деградации, пока ниже трёх четвертей бюджета - выключается:
+ *  1 - трофеи генерируются и AFK-собаки ищутся раз в BACKGROUND_INTERVAL тиков, в разных тиках,
+ *  2 - подписчики WebSocket получают состояние раз в broadcast_interval тиков,
+ *  3 - период автоматических тиков растёт на max_period_stretch.
+ *  Выключенные в Config ступени пропускаются. Ход игры при деградации отличается от обычного,
+ *  поэтому запись для game_replay с бюджетом не ведётся.
+ */
+
+struct Config {
+    //Zero turns the controller off
+    std::chrono::microseconds budget{ 0 };
+    //1 doesn't thin out broadcasts
+    unsigned broadcast_interval = 4;
+    //Zero doesn't widen the tick period
+    std::chrono::milliseconds max_period_stretch{ 0 };
+};
+
+enum Level : unsigned {
+    NORMAL,
+    DEFER_BACKGROUND,
+    THIN_BROADCAST,
+    STRETCH_PERIOD
+};
+
+using Phase = model::TickProfile::Duration model::TickProfile::*;
+
+constexpr std::array<std::pair<std::string_view, Phase>, 6> PHASES{ {
+    { "actions", &model::TickProfile::actions },
+    { "movement", &model::TickProfile::movement },
+    { "collision", &model::TickProfile::collision },
+    { "events", &model::TickProfile::events },
+    { "spawn", &model::TickProfile::spawn },
+    { "afk", &model::TickProfile::afk },
+} };
+
+// Пишутся в strand игры, читаются из любого потока
+struct Counters {
+    std::atomic<uint64_t> ticks = 0;
+    std::atomic<uint64_t> over_budget_ticks = 0;
+    std::atomic<uint64_t> loot_deferrals = 0;
+    std::atomic<uint64_t> afk_scans_skipped = 0;
+    std::atomic<uint64_t> broadcasts_skipped = 0;
+    std::atomic<uint64_t> last_tick_us = 0;
+    std::atomic<uint64_t> average_tick_us = 0;
+    //Average time of the phases in a tick, summed over sessions
+    std::array<std::atomic<uint64_t>, PHASES.size()> phase_us{};
+    std::atomic<unsigned> level = NORMAL;
+    std::atomic<uint64_t> period_stretch_ms = 0;
+};
+
+class Controller : public app::TickBudget {
+public:
+    static constexpr unsigned HOLD_TICKS = 8;
+    static constexpr unsigned BACKGROUND_INTERVAL = 4;
+
+    //Throws std::invalid_argument if the budget or the broadcast interval is zero
+    explicit Controller(Config config);
+
+    model::TickOptions BeforeTick() override;
+    void AfterTick(std::chrono::steady_clock::duration duration, const model::TickProfile& profile) override;
+
+    //Called by the state broadcaster in the strand after each tick, false if this tick is not broadcast
+    bool ShouldBroadcast() noexcept;
+
+    //Added to the period of automatic ticks, can be called from any thread
+    std::chrono::milliseconds GetPeriodStretch() const noexcept {
+        return std::chrono::milliseconds(counters_.period_stretch_ms.load(std::memory_order_relaxed));
+    }
+
+    const Counters& GetCounters() const noexcept {
+        return counters_;
+    }
+
+    const Config& GetConfig() const noexcept {
+        return config_;
+    }
+
+private:
+    Config config_;
+    Counters counters_;
+    Level level_ = NORMAL;
+    unsigned ticks_at_level_ = 0;
+    std::uint64_t tick_ = 0;
+    double average_us_ = 0.;
+    std::array<double, PHASES.size()> phase_average_us_{};
+
+    bool IsEnabled(Level level) const noexcept;
+    void SetLevel(Level level) noexcept;
+};
+
+}  // namespace tick_budget
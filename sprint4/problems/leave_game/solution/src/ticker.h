@@ -1,6 +1,10 @@
 #pragma once
 
 #include <boost/asio.hpp>
+#include <atomic>
+#include <chrono>
+
+#include "tick_budget.h"
 
 namespace ticker {
 
@@ -26,12 +30,26 @@ public:
             });
     }
 
+    //While the budget stretches the period ticks come less often. Call before Start
+    void SetBudget(std::shared_ptr<const tick_budget::Controller> budget) {
+        budget_ = std::move(budget);
+    }
+
+    // Насколько текущий тик опаздывает: strand занят или потоки перегружены. Можно вызывать из любого потока
+    std::chrono::milliseconds GetLag() const {
+        using namespace std::chrono;
+        auto expected = Clock::time_point(Clock::duration(next_tick_.load(std::memory_order_relaxed)));
+        auto lag = duration_cast<milliseconds>(Clock::now() - expected);
+        return std::max(lag, milliseconds::zero());
+    }
+
 private:
     void ScheduleTick() {
         if (!strand_.running_in_this_thread()) {
             throw std::logic_error("Wrong ticker logic");
         }
-        timer_.expires_after(period_);
+        timer_.expires_after(budget_ ? period_ + budget_->GetPeriodStretch() : period_);
+        next_tick_.store(timer_.expiry().time_since_epoch().count(), std::memory_order_relaxed);
         timer_.async_wait([self = shared_from_this()](sys::error_code ec) {
             self->OnTick(ec);
             });
@@ -64,7 +82,10 @@ private:
     std::chrono::milliseconds period_;
     net::steady_timer timer_{ strand_ };
     Handler handler_;
+    std::shared_ptr<const tick_budget::Controller> budget_;
     std::chrono::steady_clock::time_point last_tick_;
+    // Ожидаемое время следующего тика, до первого тика лаг нулевой
+    std::atomic<Clock::rep> next_tick_ = Clock::time_point::max().time_since_epoch().count();
 };
 
 } //ticker
\ No newline at end of file
@@ -0,0 +1,146 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace trace {
+
+using namespace std::literals;
+
+namespace detail {
+    std::atomic<bool> enabled = false;
+}
+
+namespace {
+
+constexpr size_t BUFFER_CAPACITY = 1 << 15;
+
+// Пишет только свой поток, читать можно из любого
+class ThreadBuffer {
+public:
+    explicit ThreadBuffer(unsigned thread_id)
+        : events_(BUFFER_CAPACITY)
+        , thread_id_(thread_id) {
+    }
+
+    void Push(const Event& event) noexcept {
+        auto written = written_.load(std::memory_order_relaxed);
+        events_[written % BUFFER_CAPACITY] = event;
+        written_.store(written + 1, std::memory_order_release);
+    }
+
+    //Appends the buffered events, the ones the writer may have overwritten while copying are left out
+    void CopyTo(std::vector<Event>& out) const {
+        const auto end = written_.load(std::memory_order_acquire);
+        auto begin = end > BUFFER_CAPACITY ? end - BUFFER_CAPACITY : 0;
+        const auto first = out.size();
+        for (auto i = begin; i < end; ++i) {
+            out.push_back(events_[i % BUFFER_CAPACITY]);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const auto written = written_.load(std::memory_order_relaxed);
+        // Push, ещё не увеличивший written_, перезаписывает событие written - BUFFER_CAPACITY, оно тоже отбрасывается
+        if (written >= BUFFER_CAPACITY && written - BUFFER_CAPACITY >= begin) {
+            const auto lost = std::min(written - BUFFER_CAPACITY + 1, end) - begin;
+            out.erase(out.begin() + first, out.begin() + first + lost);
+        }
+    }
+
+    unsigned GetThreadId() const noexcept {
+        return thread_id_;
+    }
+
+private:
+    std::vector<Event> events_;
+    std::atomic<std::uint64_t> written_ = 0;
+    unsigned thread_id_;
+};
+
+// Буферы живут до конца программы, чтобы события завершившихся потоков тоже попали в выгрузку
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    std::atomic<Clock::rep> since = 0;
+};
+
+Registry& GetRegistry() {
+    static Registry registry;
+    return registry;
+}
+
+ThreadBuffer& ThisThreadBuffer() {
+    thread_local std::shared_ptr<ThreadBuffer> buffer = [] {
+        auto& registry = GetRegistry();
+        std::lock_guard lock{ registry.mutex };
+        return registry.buffers.emplace_back(std::make_shared<ThreadBuffer>(static_cast<unsigned>(registry.buffers.size() + 1)));
+    }();
+    return *buffer;
+}
+
+double ToMicroseconds(Clock::duration duration) {
+    return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+}  // namespace
+
+void Start() {
+    GetRegistry().since.store(Clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+    detail::enabled.store(true, std::memory_order_release);
+}
+
+void Stop() noexcept {
+    detail::enabled.store(false, std::memory_order_release);
+}
+
+void Record(const Event& event) noexcept {
+    ThisThreadBuffer().Push(event);
+}
+
+void WriteJson(std::ostream& out) {
+    auto& registry = GetRegistry();
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    {
+        std::lock_guard lock{ registry.mutex };
+        buffers = registry.buffers;
+    }
+    const Clock::time_point since{ Clock::duration{ registry.since.load(std::memory_order_relaxed) } };
+
+    out << R"({"displayTimeUnit":"ms","traceEvents":[)"sv;
+    out << std::fixed << std::setprecision(3);
+    bool first = true;
+    std::vector<Event> events;
+    for (const auto& buffer : buffers) {
+        events.clear();
+        buffer->CopyTo(events);
+        for (const auto& event : events) {
+            if (event.start < since) {
+                continue;
+            }
+            out << (first ? "\n"sv : ",\n"sv)
+                << R"({"name":")"sv << event.name << R"(","cat":")"sv << event.category
+                << R"(","ph":"X","pid":1,"tid":)"sv << buffer->GetThreadId()
+                << R"(,"ts":)"sv << ToMicroseconds(event.start - since)
+                << R"(,"dur":)"sv << ToMicroseconds(event.duration) << '}';
+            first = false;
+        }
+    }
+    out << "\n]}\n"sv;
+}
+
+void Dump(const std::filesystem::path& path) {
+    std::ofstream out{ path, std::ios::trunc };
+    if (!out) {
+        throw std::runtime_error("Can't create trace file "s + path.string());
+    }
+    WriteJson(out);
+    if (!out.flush()) {
+        throw std::runtime_error("Can't write trace file "s + path.string());
+    }
+}
+
+}  // namespace trace
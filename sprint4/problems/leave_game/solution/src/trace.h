@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <ostream>
+
+namespace trace {
+
+/*
+ *  Лёгкая трассировка: Span замеряет время своей области видимости, пока запись включена.
+ *  Каждый поток пишет в свой кольцевой буфер без блокировок, при переполнении старые события теряются.
+ *  Записанное выгружается в формате Chrome trace event, его открывают chrome://tracing и ui.perfetto.dev.
+ *  Имена и категории - строковые литералы, строки не копируются.
+ */
+
+using Clock = std::chrono::steady_clock;
+
+struct Event {
+    const char* category = nullptr;
+    const char* name = nullptr;
+    Clock::time_point start;
+    Clock::duration duration{};
+};
+
+namespace detail {
+    extern std::atomic<bool> enabled;
+}
+
+inline bool IsEnabled() noexcept {
+    return detail::enabled.load(std::memory_order_relaxed);
+}
+
+//Turns recording on, events recorded before are dropped
+void Start();
+
+void Stop() noexcept;
+
+//Adds the event to the buffer of the calling thread
+void Record(const Event& event) noexcept;
+
+//Writes the events recorded since the last Start, can be called while recording goes on
+void WriteJson(std::ostream& out);
+
+//Throws std::runtime_error if the file can't be written
+void Dump(const std::filesystem::path& path);
+
+class Span {
+public:
+    Span(const char* category, const char* name) noexcept
+        : category_(category)
+        , name_(name) {
+        if (IsEnabled()) {
+            start_ = Clock::now();
+            active_ = true;
+        }
+    }
+
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+    ~Span() {
+        if (active_) {
+            Record({ category_, name_, start_, Clock::now() - start_ });
+        }
+    }
+
+private:
+    const char* category_;
+    const char* name_;
+    Clock::time_point start_;
+    bool active_ = false;
+};
+
+}  // namespace trace
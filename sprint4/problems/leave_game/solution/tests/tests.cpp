@@ -1,12 +1,33 @@
 #include <boost/archive/text_iarchive.hpp>
 #include <boost/archive/text_oarchive.hpp>
+#include <boost/beast/core/buffers_to_string.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/json.hpp>
 #include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <set>
+#include <shared_mutex>
+#include <thread>
 #include <catch2/catch_test_macros.hpp>
+#include <catch2/benchmark/catch_benchmark.hpp>
 
 #include "../src/model.h"
 #include "../src/model_serialization.h"
 #include "../src/loot_generator.h"
 #include "../src/collision_detector.h"
+#include "../src/compression.h"
+#include "../src/json_reader.h"
+#include "../src/json_writer.h"
+#include "../src/msgpack_reader.h"
+#include "../src/msgpack_writer.h"
+#include "../src/replay.h"
+#include "../src/router.h"
+#include "../src/slot_map.h"
+#include "../src/static_store.h"
+#include "../src/tick_budget.h"
+#include "../src/trace.h"
 
 using namespace std::literals;
 using namespace collision_detector;
@@ -92,6 +113,100 @@ SCENARIO("Loot generation") {
     }
 }
 
+SCENARIO("Batch loot generation") {
+    using loot_gen::BatchLootGenerator;
+    using loot_gen::LootGenerator;
+    using TimeInterval = LootGenerator::TimeInterval;
+
+    constexpr size_t SESSIONS = 8;
+    constexpr int TICKS = 500;
+    constexpr std::uint64_t SEED = 2024;
+
+    // Одинаковые для всех вариантов состояния карт на каждом тике
+    std::mt19937 load{7};
+    std::vector<TimeInterval> deltas;
+    std::vector<std::vector<unsigned>> loot(TICKS, std::vector<unsigned>(SESSIONS));
+    std::vector<std::vector<unsigned>> looters(TICKS, std::vector<unsigned>(SESSIONS));
+    for (int tick = 0; tick < TICKS; ++tick) {
+        deltas.emplace_back(load() % 300);
+        for (size_t i = 0; i < SESSIONS; ++i) {
+            loot[tick][i] = load() % 10;
+            looters[tick][i] = load() % 20;
+        }
+    }
+
+    auto run_batch = [&](BatchLootGenerator& batch) {
+        batch.Resize(SESSIONS);
+        std::vector<unsigned> result;
+        std::vector<unsigned> generated(SESSIONS);
+        for (int tick = 0; tick < TICKS; ++tick) {
+            batch.Generate(deltas[tick], loot[tick], looters[tick], generated);
+            result.insert(result.end(), generated.begin(), generated.end());
+        }
+        return result;
+    };
+
+    auto run_scalar = [&](std::vector<LootGenerator>& generators) {
+        std::vector<unsigned> result;
+        for (int tick = 0; tick < TICKS; ++tick) {
+            for (size_t i = 0; i < SESSIONS; ++i) {
+                result.push_back(generators[i].Generate(deltas[tick], loot[tick][i], looters[tick][i]));
+            }
+        }
+        return result;
+    };
+
+    GIVEN("a batch generator without a seed") {
+        BatchLootGenerator batch{1s, 0.5};
+
+        THEN("every session matches its own scalar generator") {
+            std::vector<LootGenerator> generators(SESSIONS, LootGenerator{1s, 0.5});
+            CHECK(run_batch(batch) == run_scalar(generators));
+        }
+    }
+
+    GIVEN("a batch generator with a seed") {
+        BatchLootGenerator batch{1s, 0.5, SEED};
+
+        THEN("every session matches a scalar generator fed by the same stream") {
+            std::vector<BatchLootGenerator::Random> streams;
+            std::vector<LootGenerator> generators;
+            streams.reserve(SESSIONS);
+            for (size_t i = 0; i < SESSIONS; ++i) {
+                auto& stream = streams.emplace_back(BatchLootGenerator::MakeStream(SEED, i));
+                generators.emplace_back(1s, 0.5, [&stream] {
+                    return std::uniform_real_distribution<double>{0.0, 1.0}(stream);
+                });
+            }
+            auto result = run_batch(batch);
+            CHECK(result == run_scalar(generators));
+            CHECK(std::ranges::any_of(result, [](unsigned count) {
+                return count != 0;
+            }));
+        }
+
+        THEN("the same seed gives the same schedule and another seed a different one") {
+            BatchLootGenerator same{1s, 0.5, SEED};
+            BatchLootGenerator other{1s, 0.5, SEED + 1};
+            auto result = run_batch(batch);
+            CHECK(result == run_batch(same));
+            CHECK(result != run_batch(other));
+        }
+
+        THEN("seeding a generator that already has sessions restarts their streams") {
+            BatchLootGenerator late{1s, 0.5, SEED + 1};
+            late.Resize(SESSIONS);
+            late.Seed(SEED);
+            CHECK(run_batch(late) == run_batch(batch));
+            BatchLootGenerator off{1s, 0.5, SEED};
+            off.Resize(SESSIONS);
+            off.Seed(std::nullopt);
+            BatchLootGenerator unseeded{1s, 0.5};
+            CHECK(run_batch(off) == run_batch(unseeded));
+        }
+    }
+}
+
 class TestingProvider : public collision_detector::ItemGathererProvider {
 public:
 	TestingProvider() = default;
@@ -222,4 +337,1414 @@ SCENARIO_METHOD(Fixture, "Dog Serialization") {
             }
         }
     }
-}
\ No newline at end of file
+}
+namespace {
+
+Map MakeSquareMap() {
+    Map map{Map::Id{"square"s}, "Square"s, 3};
+    map.SetSpeed(1.);
+    map.SetLootTypesCount(1);
+    map.AddRoad({Road::HORIZONTAL, {0, 0}, 10});
+    map.AddRoad({Road::VERTICAL, {0, 0}, 10});
+    return map;
+}
+
+struct NullStatSaver : StatSaver {
+    void Save(const std::vector<SaveStat>&) override {
+    }
+};
+
+struct RecordingStatSaver : StatSaver {
+    std::vector<SaveStat> saved;
+
+    void Save(const std::vector<SaveStat>& stat) override {
+        saved.insert(saved.end(), stat.begin(), stat.end());
+    }
+};
+
+}  // namespace
+
+SCENARIO("Player actions are applied at tick boundaries") {
+    GIVEN("a session with a dog") {
+        auto map = MakeSquareMap();
+        GameSession session{&map, false, 60000, nullptr};
+        const auto* dog = session.AddDog(Dog{"Rex"s, 3});
+
+        WHEN("several actions are queued before a tick") {
+            session.QueueAction({static_cast<size_t>(dog->GetId()), Direction::SOUTH});
+            session.QueueAction({static_cast<size_t>(dog->GetId()), Direction::EAST});
+
+            THEN("nothing changes until the tick") {
+                CHECK(dog->GetSpeed() == Speed{0., 0.});
+            }
+
+            AND_WHEN("the tick happens") {
+                session.Tick(0, 0);
+
+                THEN("only the latest action is applied") {
+                    CHECK(dog->GetDirection() == Direction::EAST);
+                    CHECK(dog->GetSpeed() == Speed{1., 0.});
+                }
+
+                AND_WHEN("the dog is stopped") {
+                    session.QueueAction({static_cast<size_t>(dog->GetId()), std::nullopt});
+                    session.Tick(0, 0);
+
+                    THEN("its speed is reset") {
+                        CHECK(dog->GetSpeed() == Speed{0., 0.});
+                    }
+                }
+            }
+        }
+
+        WHEN("an action targets an unknown dog") {
+            session.QueueAction({dog->GetId() + 100u, Direction::WEST});
+
+            THEN("it is ignored") {
+                CHECK_NOTHROW(session.Tick(0, 0));
+                CHECK(dog->GetSpeed() == Speed{0., 0.});
+            }
+        }
+    }
+}
+
+SCENARIO("Road sampling") {
+    GIVEN("separate roads of lengths 10, 30 and 60, one of them reversed, and one of zero length") {
+        Map::Roads roads{
+            Road{Road::HORIZONTAL, {0, 0}, 10},
+            Road{Road::VERTICAL, {20, 0}, 30},
+            Road{Road::HORIZONTAL, {60, 40}, 0},
+            Road{Road::VERTICAL, {5, 5}, 5}
+        };
+        RoadSampler sampler{roads};
+        RoadSampler::Random random{42};
+        constexpr int SAMPLES = 100'000;
+
+        WHEN("roads are sampled") {
+            std::array<int, 4> hits{};
+            for (int i = 0; i < SAMPLES; ++i) {
+                ++hits[sampler.SampleRoad(random)];
+            }
+
+            THEN("each road is picked in proportion to its length") {
+                CHECK(hits[3] == 0);
+                // Хи-квадрат с 2 степенями свободы, критическое значение для p = 0.001
+                const std::array<double, 3> expected{SAMPLES * 0.1, SAMPLES * 0.3, SAMPLES * 0.6};
+                double chi_square = 0.;
+                for (size_t i = 0; i < expected.size(); ++i) {
+                    chi_square += (hits[i] - expected[i]) * (hits[i] - expected[i]) / expected[i];
+                }
+                CHECK(chi_square < 13.82);
+            }
+        }
+
+        WHEN("points are sampled") {
+            // Единичные отрезки всех дорог подряд: 10 + 30 + 60
+            std::array<int, 100> hits{};
+            bool on_roads = true;
+            for (int i = 0; i < SAMPLES; ++i) {
+                auto [x, y] = sampler.SamplePoint(random, 0.4);
+                if (std::abs(y) <= 0.4 && x >= 0. && x <= 10.) {
+                    ++hits[std::min(static_cast<int>(x), 9)];
+                }
+                else if (std::abs(x - 20.) <= 0.4 && y >= 0. && y <= 30.) {
+                    ++hits[10 + std::min(static_cast<int>(y), 29)];
+                }
+                else if (std::abs(y - 40.) <= 0.4 && x >= 0. && x <= 60.) {
+                    ++hits[40 + std::min(static_cast<int>(x), 59)];
+                }
+                else {
+                    on_roads = false;
+                }
+            }
+
+            THEN("they stay on the roads and cover every unit of road equally") {
+                CHECK(on_roads);
+                // Хи-квадрат с 99 степенями свободы, критическое значение для p = 0.001
+                const double expected = SAMPLES / 100.;
+                double chi_square = 0.;
+                for (auto hit : hits) {
+                    chi_square += (hit - expected) * (hit - expected) / expected;
+                }
+                CHECK(chi_square < 148.23);
+            }
+        }
+    }
+
+    GIVEN("a session spawning loot") {
+        auto map = MakeSquareMap();
+        GameSession session{&map, true, 60000, nullptr};
+        session.Tick(0, 10);
+        session.Tick(0, 10);
+
+        THEN("loot doesn't land on the same spots every time") {
+            std::set<std::pair<double, double>> positions;
+            for (const auto& loot : session.GetLoot()) {
+                positions.emplace(loot.position.x, loot.position.y);
+            }
+            CHECK(positions.size() == 20);
+        }
+    }
+}
+
+SCENARIO("Tick profile") {
+    GIVEN("a profiled session") {
+        auto map = MakeSquareMap();
+        GameSession session{&map, false, 60000, nullptr};
+        session.AddDog(Dog{"Rex"s, 3});
+        TickProfile profile;
+        session.SetTickProfile(&profile);
+
+        WHEN("it ticks") {
+            session.Tick(100, 1);
+            session.Tick(100, 1);
+            session.SetTickProfile(nullptr);
+            session.Tick(100, 1);
+
+            THEN("only the profiled ticks are counted") {
+                CHECK(profile.ticks == 2);
+                const auto total = profile.actions + profile.movement + profile.collision
+                    + profile.events + profile.spawn + profile.afk;
+                CHECK(total > TickProfile::Duration::zero());
+            }
+        }
+    }
+}
+
+SCENARIO("Trace spans") {
+    GIVEN("a session") {
+        auto map = MakeSquareMap();
+        GameSession session{&map, false, 60000, nullptr};
+        session.AddDog(Dog{"Rex"s, 3});
+
+        WHEN("a tick runs while tracing is on") {
+            {
+                trace::Span span{"test", "before start"};
+            }
+            trace::Start();
+            {
+                trace::Span span{"test", "outer"};
+                session.Tick(100, 1);
+            }
+            trace::Stop();
+            {
+                trace::Span span{"test", "after stop"};
+            }
+            std::ostringstream out;
+            trace::WriteJson(out);
+            const auto json = out.str();
+
+            THEN("the span and every tick phase are written as complete events") {
+                CHECK(json.find(R"({"name":"outer","cat":"test","ph":"X")") != std::string::npos);
+                for (std::string phase : {"actions", "movement", "collision", "events", "spawn", "afk"}) {
+                    CHECK(json.find(R"({"name":")"s + phase + R"(","cat":"game","ph":"X")") != std::string::npos);
+                }
+            }
+            THEN("spans outside the recording are left out") {
+                CHECK(json.find("before start") == std::string::npos);
+                CHECK(json.find("after stop") == std::string::npos);
+            }
+
+            AND_WHEN("tracing starts again") {
+                trace::Start();
+                trace::Stop();
+                std::ostringstream restarted;
+                trace::WriteJson(restarted);
+
+                THEN("the previous recording is dropped") {
+                    CHECK(restarted.str().find("outer") == std::string::npos);
+                }
+            }
+        }
+    }
+}
+
+SCENARIO("Tick budget") {
+    using namespace std::chrono_literals;
+    // Тики заданной длины, опции тиков складываются в options
+    auto run = [](tick_budget::Controller& budget, std::chrono::microseconds duration, unsigned ticks,
+                  std::vector<TickOptions>* options = nullptr) {
+        for (unsigned i = 0; i < ticks; ++i) {
+            auto tick_options = budget.BeforeTick();
+            if (options) {
+                options->push_back(tick_options);
+            }
+            budget.AfterTick(duration, TickProfile{});
+        }
+    };
+    constexpr unsigned HOLD = tick_budget::Controller::HOLD_TICKS;
+
+    GIVEN("a controller with every degradation enabled") {
+        tick_budget::Controller budget{ {1000us, 4, 20ms} };
+
+        WHEN("ticks stay within the budget") {
+            std::vector<TickOptions> options;
+            run(budget, 500us, HOLD * 4, &options);
+
+            THEN("nothing is degraded") {
+                CHECK(budget.GetCounters().level == tick_budget::NORMAL);
+                CHECK(std::ranges::all_of(options, [](const TickOptions& tick) { return tick.spawn_loot && tick.scan_afk; }));
+                CHECK(budget.ShouldBroadcast());
+                CHECK(budget.GetPeriodStretch() == 0ms);
+                CHECK(budget.GetCounters().over_budget_ticks == 0);
+            }
+        }
+
+        WHEN("ticks run over the budget") {
+            run(budget, 3000us, HOLD);
+            THEN("background work is deferred first") {
+                CHECK(budget.GetCounters().level == tick_budget::DEFER_BACKGROUND);
+                std::vector<TickOptions> options;
+                run(budget, 3000us, tick_budget::Controller::BACKGROUND_INTERVAL, &options);
+                CHECK(std::ranges::count_if(options, [](const TickOptions& tick) { return tick.spawn_loot; }) == 1);
+                CHECK(std::ranges::count_if(options, [](const TickOptions& tick) { return tick.scan_afk; }) == 1);
+                CHECK(std::ranges::none_of(options, [](const TickOptions& tick) { return tick.spawn_loot && tick.scan_afk; }));
+            }
+
+            AND_WHEN("they keep running over") {
+                run(budget, 3000us, HOLD * 2);
+
+                THEN("broadcasts are thinned out and the period is stretched") {
+                    CHECK(budget.GetCounters().level == tick_budget::STRETCH_PERIOD);
+                    CHECK(budget.GetPeriodStretch() == 20ms);
+                    unsigned broadcasts = 0;
+                    for (int i = 0; i < 8; ++i) {
+                        budget.BeforeTick();
+                        broadcasts += budget.ShouldBroadcast();
+                        budget.AfterTick(3000us, TickProfile{});
+                    }
+                    CHECK(broadcasts == 2);
+                    CHECK(budget.GetCounters().broadcasts_skipped == 6);
+                    CHECK(budget.GetCounters().average_tick_us > 1000);
+                }
+
+                AND_WHEN("ticks get short again") {
+                    run(budget, 100us, HOLD * 8);
+
+                    THEN("the degradations are lifted") {
+                        CHECK(budget.GetCounters().level == tick_budget::NORMAL);
+                        CHECK(budget.GetPeriodStretch() == 0ms);
+                        CHECK(budget.BeforeTick().spawn_loot);
+                    }
+                }
+            }
+        }
+    }
+
+    GIVEN("a controller which may only defer background work") {
+        tick_budget::Controller budget{ {1000us, 1, 0ms} };
+
+        WHEN("ticks run over the budget for long") {
+            run(budget, 3000us, HOLD * 8);
+
+            THEN("the disabled degradations are skipped") {
+                CHECK(budget.GetCounters().level == tick_budget::DEFER_BACKGROUND);
+                CHECK(budget.ShouldBroadcast());
+                CHECK(budget.GetPeriodStretch() == 0ms);
+            }
+        }
+    }
+
+    GIVEN("a session with a standing dog") {
+        auto map = MakeSquareMap();
+        auto saver = std::make_shared<RecordingStatSaver>();
+        GameSession session{&map, false, 1000, saver};
+        const size_t dog = session.AddDog(Dog{"Standing"s, 3})->GetId();
+
+        WHEN("the AFK scan is skipped when the retirement time comes") {
+            auto retired = session.Tick(1000, 0, {.spawn_loot = true, .scan_afk = false});
+
+            THEN("the dog retires at the next scan with its whole playtime") {
+                CHECK(retired.empty());
+                CHECK(session.FindDog(dog) != nullptr);
+                retired = session.Tick(100, 0);
+                CHECK(retired == std::unordered_set<size_t>{dog});
+                REQUIRE(saver->saved.size() == 1);
+                CHECK(saver->saved[0].playtime == 1100);
+            }
+        }
+    }
+}
+
+SCENARIO("Dog retirement") {
+    GIVEN("a session with a standing and a running dog") {
+        auto map = MakeSquareMap();
+        auto saver = std::make_shared<RecordingStatSaver>();
+        GameSession session{&map, false, 1000, saver};
+        const size_t standing = session.AddDog(Dog{"Standing"s, 3})->GetId();
+        const size_t running = session.AddDog(Dog{"Running"s, 3})->GetId();
+        session.QueueAction({running, Direction::EAST});
+
+        WHEN("less than the retirement time passes") {
+            auto retired = session.Tick(600, 0);
+            retired.merge(session.Tick(399, 0));
+
+            THEN("nobody retires") {
+                CHECK(retired.empty());
+                CHECK(saver->saved.empty());
+            }
+
+            AND_WHEN("the retirement time is reached") {
+                retired = session.Tick(1, 0);
+
+                THEN("only the standing dog retires with its whole playtime") {
+                    CHECK(retired == std::unordered_set<size_t>{standing});
+                    REQUIRE(saver->saved.size() == 1);
+                    CHECK(saver->saved[0].name == "Standing"s);
+                    CHECK(saver->saved[0].playtime == 1000);
+                    CHECK(session.FindDog(standing) == nullptr);
+                    CHECK(session.FindDog(running) != nullptr);
+                }
+            }
+        }
+
+        WHEN("the standing dog moves and stops again") {
+            session.Tick(800, 0);
+            session.QueueAction({standing, Direction::SOUTH});
+            session.Tick(100, 0);
+            session.QueueAction({standing, std::nullopt});
+            session.Tick(100, 0);
+
+            THEN("the idle time is counted from the tick of the last stop") {
+                CHECK(session.Tick(899, 0).empty());
+                CHECK(session.Tick(1, 0) == std::unordered_set<size_t>{standing});
+                REQUIRE(saver->saved.size() == 1);
+                CHECK(saver->saved[0].playtime == 1900);
+            }
+        }
+
+        WHEN("a dog stops many times while idle") {
+            for (int i = 0; i < 1000; ++i) {
+                session.QueueAction({standing, std::nullopt});
+                session.Tick(0, 0);
+            }
+
+            THEN("it still retires once") {
+                CHECK(session.Tick(1000, 0) == std::unordered_set<size_t>{standing});
+                CHECK(session.Tick(1000, 0).empty());
+            }
+        }
+    }
+}
+
+SCENARIO("Players registry") {
+    GIVEN("players spread over the shards") {
+        auto map = MakeSquareMap();
+        GameSession session{&map, false, 60000, nullptr};
+        app::Players players;
+        std::vector<app::Token> tokens;
+        for (int i = 0; i < 500; ++i) {
+            tokens.push_back(players.AddPlayer(Dog{"Dog #"s + std::to_string(i), 3}, &session).GetToken());
+        }
+
+        THEN("every token resolves to its player") {
+            CHECK(players.GetPlayers().size() == tokens.size());
+            for (const auto& token : tokens) {
+                auto* player = players.FindByToken(token);
+                REQUIRE(player);
+                CHECK(player->GetToken() == token);
+                CHECK(players.HasPlayer(token));
+            }
+            CHECK_FALSE(players.HasPlayer(app::Token{"unknown"s}));
+        }
+
+        WHEN("some players retire") {
+            std::vector<size_t> retired;
+            for (size_t i = 0; i < 100; ++i) {
+                retired.push_back(players.FindByToken(tokens[i])->GetDogId());
+            }
+            players.RemovePlayers(retired);
+
+            THEN("only their tokens are forgotten") {
+                CHECK(players.GetPlayers().size() == tokens.size() - retired.size());
+                for (size_t i = 0; i < tokens.size(); ++i) {
+                    CHECK(players.HasPlayer(tokens[i]) == (i >= 100));
+                }
+            }
+
+            THEN("the remaining players still reach their dogs") {
+                for (size_t i = 100; i < tokens.size(); ++i) {
+                    auto* player = players.FindByToken(tokens[i]);
+                    REQUIRE(player);
+                    REQUIRE(player->GetDog());
+                    CHECK(static_cast<size_t>(player->GetDog()->GetId()) == player->GetDogId());
+                }
+            }
+        }
+
+        WHEN("tokens are looked up from other threads while players join") {
+            std::atomic<size_t> missed = 0;
+            {
+                std::vector<std::jthread> readers;
+                for (int t = 0; t < 4; ++t) {
+                    readers.emplace_back([&players, &tokens, &missed] {
+                        for (int round = 0; round < 20; ++round) {
+                            for (const auto& token : tokens) {
+                                missed += !players.HasPlayer(token);
+                            }
+                        }
+                    });
+                }
+                for (int i = 0; i < 500; ++i) {
+                    players.AddPlayer(Dog{"Late #"s + std::to_string(i), 3}, &session);
+                }
+            }
+
+            THEN("existing players are always found") {
+                CHECK(missed == 0);
+                CHECK(players.GetPlayers().size() == 1000);
+            }
+        }
+    }
+}
+
+namespace {
+
+struct ExpectedField {
+    json_reader::Field::Kind kind = json_reader::Field::ABSENT;
+    std::string string;
+    std::int64_t int64 = 0;
+};
+
+// Reference result built with boost::json, as request handlers did before json_reader
+bool ReadWithBoost(std::string_view body, std::string_view key, ExpectedField& result) {
+    boost::json::error_code ec;
+    auto value = boost::json::parse(body, ec);
+    if (ec || !value.is_object()) {
+        return false;
+    }
+    const auto* field = value.get_object().if_contains(key);
+    if (!field) {
+        result.kind = json_reader::Field::ABSENT;
+    }
+    else if (field->is_string()) {
+        result.kind = json_reader::Field::STRING;
+        result.string = field->get_string().c_str();
+    }
+    else if (field->is_int64()) {
+        result.kind = json_reader::Field::INT64;
+        result.int64 = field->get_int64();
+    }
+    else {
+        result.kind = json_reader::Field::OTHER;
+    }
+    return true;
+}
+
+void CheckSameAsBoost(std::string_view body) {
+    INFO("body: " << body);
+    for (std::string_view key : {"move"sv, "timeDelta"sv, "userName"sv}) {
+        ExpectedField expected;
+        json_reader::Field field;
+        const bool expected_ok = ReadWithBoost(body, key, expected);
+        REQUIRE(json_reader::ReadObject(body, { {key, &field} }) == expected_ok);
+        if (!expected_ok) {
+            continue;
+        }
+        REQUIRE(field.kind == expected.kind);
+        if (field.kind == json_reader::Field::STRING) {
+            CHECK(field.string == expected.string);
+        }
+        if (field.kind == json_reader::Field::INT64) {
+            CHECK(field.int64 == expected.int64);
+        }
+    }
+}
+
+}  // namespace
+
+SCENARIO("Slot map") {
+    GIVEN("a slot map with a few values") {
+        util::SlotMap<std::string> values;
+        auto first = values.Insert("first"s);
+        auto second = values.Insert("second"s);
+        auto third = values.Insert("third"s);
+
+        THEN("handles find their values") {
+            CHECK(values.Size() == 3);
+            CHECK(*values.Find(first) == "first"s);
+            CHECK(*values.Find(second) == "second"s);
+            CHECK(*values.Find(third) == "third"s);
+            CHECK_FALSE(values.Contains(util::SlotMap<std::string>::Handle{}));
+        }
+
+        WHEN("a value in the middle is erased") {
+            CHECK(values.Erase(second));
+
+            THEN("the others keep their handles and stay dense") {
+                CHECK(values.Size() == 2);
+                CHECK(*values.Find(first) == "first"s);
+                CHECK(*values.Find(third) == "third"s);
+                CHECK(std::vector<std::string>(values.begin(), values.end()) == std::vector{"first"s, "third"s});
+                CHECK(values.GetHandle(1) == third);
+            }
+
+            THEN("its handle goes stale") {
+                CHECK_FALSE(values.Contains(second));
+                CHECK(values.Find(second) == nullptr);
+                CHECK_FALSE(values.Erase(second));
+            }
+
+            AND_WHEN("the slot is reused") {
+                auto fourth = values.Insert("fourth"s);
+
+                THEN("the stale handle doesn't see the new value") {
+                    CHECK(fourth.index == second.index);
+                    CHECK(values.Find(second) == nullptr);
+                    CHECK(*values.Find(fourth) == "fourth"s);
+                }
+            }
+        }
+    }
+
+    GIVEN("a session whose dogs retire") {
+        auto map = MakeSquareMap();
+        GameSession session{&map, false, 1000, std::make_shared<NullStatSaver>()};
+        auto rex = session.SpawnDog(Dog{"Rex"s, 3});
+        auto* dog = session.GetDog(rex);
+        REQUIRE(dog);
+        const auto id = dog->GetId();
+        session.Tick(1000, 0);
+
+        THEN("their handles and ids no longer resolve") {
+            CHECK(session.GetDog(rex) == nullptr);
+            CHECK(session.FindDog(id) == nullptr);
+            CHECK(session.GetDogsCount() == 0);
+        }
+    }
+}
+
+SCENARIO("Loot store") {
+    GIVEN("a store with a few objects") {
+        LootStore loot;
+        loot.Reserve(3);
+        loot.Insert({1, 0, {1., 0.}});
+        loot.Insert({2, 1, {2., 0.}});
+        loot.Insert({3, 2, {3., 0.}});
+
+        WHEN("an object in the middle is erased") {
+            CHECK(loot.Erase(2));
+
+            THEN("the rest stays dense and findable") {
+                CHECK(loot.Size() == 2);
+                CHECK_FALSE(loot.Contains(2));
+                CHECK(loot.Find(2) == nullptr);
+                CHECK(loot.Find(3)->position == Position{3., 0.});
+                std::vector<unsigned> ids;
+                for (const auto& object : loot) {
+                    ids.push_back(object.id);
+                }
+                CHECK(ids == std::vector<unsigned>{1, 3});
+                CHECK_FALSE(loot.Erase(2));
+            }
+        }
+
+        WHEN("an object with an existing id is inserted") {
+            loot.Insert({1, 2, {5., 5.}});
+
+            THEN("it replaces the old one") {
+                CHECK(loot.Size() == 3);
+                CHECK(loot.Find(1)->type == 2);
+            }
+        }
+    }
+
+    GIVEN("a session with restored loot") {
+        auto map = MakeSquareMap();
+        GameSession session{&map, false, 60000, nullptr};
+        session.AddLoot(5, 0, {5., 0.});
+        session.AddLoot(9, 0, {0., 9.});
+
+        WHEN("new loot spawns and a dog picks some up") {
+            auto* dog = session.AddDog(Dog{"Rex"s, 3});
+            session.QueueAction({static_cast<size_t>(dog->GetId()), Direction::EAST});
+            session.Tick(0, 1);
+            const bool spawned_after_restored = session.GetLoot().Contains(10);
+            session.Tick(6000, 0);
+
+            THEN("new ids don't collide with restored ones and the count follows the store") {
+                CHECK(spawned_after_restored);
+                CHECK_FALSE(session.GetLoot().Contains(5));
+                CHECK(session.GetLootCount() == session.GetLoot().Size());
+            }
+        }
+    }
+}
+
+SCENARIO("Request body reading") {
+    GIVEN("a join request body") {
+        const std::string body = R"({"userName": "Scooby Doo", "mapId": "map1"})";
+
+        WHEN("fields are read") {
+            json_reader::Field user_name;
+            json_reader::Field map_id;
+            json_reader::Field missing;
+            REQUIRE(json_reader::ReadObject(body, { {"userName"sv, &user_name}, {"mapId"sv, &map_id}, {"x"sv, &missing} }));
+
+            THEN("strings point into the body") {
+                CHECK(user_name.kind == json_reader::Field::STRING);
+                CHECK(user_name.string == "Scooby Doo"sv);
+                CHECK(user_name.string.data() >= body.data());
+                CHECK(user_name.string.data() < body.data() + body.size());
+                CHECK(map_id.string == "map1"sv);
+                CHECK(missing.kind == json_reader::Field::ABSENT);
+            }
+        }
+    }
+
+    GIVEN("bodies with escapes, nesting and numbers") {
+        THEN("the result matches boost::json") {
+            for (std::string_view body : {
+                    R"({"move":"\u0055"})"sv,
+                    R"({"m\u006fve":"L"})"sv,
+                    R"({"move":"\ud83d\ude00"})"sv,
+                    R"({"move":"\ud83d"})"sv,
+                    R"({"move":"D","move":"R"})"sv,
+                    R"({"timeDelta":9223372036854775807})"sv,
+                    R"({"timeDelta":9223372036854775808})"sv,
+                    R"({"timeDelta":-9223372036854775808})"sv,
+                    R"({"timeDelta":100.0})"sv,
+                    R"({"timeDelta":1e2})"sv,
+                    R"({"timeDelta":0100})"sv,
+                    R"({"a":[1,{"b":[true,false,null]}],"move":""})"sv,
+                    R"([{"move":"U"}])"sv,
+                    R"({"move":"U"} {})"sv,
+                    R"({"move":"U",})"sv,
+                    R"({"move":'U'})"sv,
+                    ""sv,
+                    "   "sv}) {
+                CheckSameAsBoost(body);
+            }
+        }
+    }
+
+    GIVEN("randomly mutated bodies") {
+        const std::vector<std::string> seeds = {
+            R"({"move":"U"})",
+            R"({"move": "L", "x": [1, 2.5, {"a": null}]})",
+            R"({"timeDelta": 100})",
+            R"({ "move" : "" , "timeDelta" : -12e3 })",
+            R"({"userName":"Bob","mapId":"map1"})",
+            R"({"a":true,"b":false,"move":"D"})",
+        };
+        const std::string alphabet = "{}[]:,\"\\ 0123456789-+.eEtruefalsnu\t\nUDLR";
+
+        THEN("the result matches boost::json") {
+            std::mt19937 generator{42};
+            for (int i = 0; i < 20000; ++i) {
+                std::string body = seeds[generator() % seeds.size()];
+                const int mutations = 1 + generator() % 3;
+                for (int m = 0; m < mutations; ++m) {
+                    const size_t pos = generator() % (body.size() + 1);
+                    const char c = alphabet[generator() % alphabet.size()];
+                    switch (generator() % 3) {
+                    case 0:
+                        body.insert(body.begin() + pos, c);
+                        break;
+                    case 1:
+                        if (!body.empty()) {
+                            body.erase(std::min(pos, body.size() - 1), 1);
+                        }
+                        break;
+                    default:
+                        if (pos < body.size()) {
+                            body[pos] = c;
+                        }
+                    }
+                }
+                CheckSameAsBoost(body);
+            }
+        }
+    }
+}
+
+namespace {
+
+std::string ToString(const boost::beast::flat_buffer& buffer) {
+    return boost::beast::buffers_to_string(buffer.data());
+}
+
+// The way /game/state body was built before json_writer
+boost::json::value StateToJsonDom(const GameSession& session) {
+    boost::json::object players;
+    for (const auto* dog : session.GetDogs()) {
+        boost::json::object data;
+        auto pos = dog->GetPosition();
+        auto speed = dog->GetSpeed();
+        data["pos"] = { pos.x, pos.y };
+        data["speed"] = { speed.vx, speed.vy };
+        data["dir"] = json_writer::DirectionToString(dog->GetDirection());
+        boost::json::array bag;
+        for (const auto& item : dog->GetItems()) {
+            bag.push_back(boost::json::value{ { "id", item.id }, { "type", item.type } });
+        }
+        data["bag"] = bag;
+        data["score"] = dog->GetScore();
+        players[std::to_string(dog->GetId())] = data;
+    }
+    boost::json::object lost_objects;
+    for (const auto& loot : session.GetLoot()) {
+        boost::json::object obj;
+        obj["type"] = loot.type;
+        obj["pos"] = { loot.position.x, loot.position.y };
+        lost_objects[std::to_string(loot.id)] = obj;
+    }
+    boost::json::object result;
+    result["players"] = players;
+    result["lostObjects"] = lost_objects;
+    return result;
+}
+
+void FillSession(GameSession& session, size_t dogs_count) {
+    const Direction directions[] = { Direction::NORTH, Direction::SOUTH, Direction::WEST, Direction::EAST };
+    for (size_t i = 0; i < dogs_count; ++i) {
+        auto* dog = session.AddDog(Dog{"Dog #"s + std::to_string(i), 3});
+        session.QueueAction({static_cast<size_t>(dog->GetId()), directions[i % 4]});
+        session.AddLoot(i, i % 3, {i * 0.01, 10. - i * 0.01});
+    }
+    session.Tick(137, 0);
+}
+
+}  // namespace
+
+SCENARIO("JSON writer") {
+    boost::beast::flat_buffer buffer;
+    json_writer::Writer writer{buffer};
+
+    WHEN("nested values are written") {
+        writer.BeginObject();
+        writer.Key("a"sv).BeginArray().Int(-1).Uint(2).BeginObject().EndObject().BeginArray().EndArray().EndArray();
+        writer.Key("b"sv).Raw("{}"sv);
+        writer.EndObject();
+        writer.Flush();
+
+        THEN("commas and colons are placed between elements") {
+            CHECK(ToString(buffer) == R"({"a":[-1,2,{},[]],"b":{}})"s);
+        }
+    }
+
+    WHEN("strings with special characters are written") {
+        writer.BeginArray().String("q\"b\\n\n\x01\xd0\xbf"sv).EndArray();
+        writer.Flush();
+
+        THEN("they are escaped") {
+            CHECK(ToString(buffer) == "[\"q\\\"b\\\\n\\n\\u0001\xd0\xbf\"]"s);
+        }
+    }
+
+    WHEN("doubles are written") {
+        writer.BeginArray().Double(1.).Double(-0.5).Double(0.1).Double(1e300).Double(NAN).EndArray();
+        writer.Flush();
+
+        THEN("they stay doubles and read back exactly") {
+            CHECK(ToString(buffer) == "[1.0,-0.5,0.1,1e+300,null]"s);
+        }
+    }
+}
+
+SCENARIO("State response body") {
+    GIVEN("a session with dogs and loot") {
+        auto map = MakeSquareMap();
+        GameSession session{&map, true, 60000, nullptr};
+        FillSession(session, 20);
+
+        WHEN("the state is written") {
+            boost::beast::flat_buffer buffer;
+            json_writer::WriteState(buffer, session.GetDogs(), session);
+
+            THEN("it is the same JSON as the DOM one") {
+                CHECK(boost::json::parse(ToString(buffer)) == StateToJsonDom(session));
+            }
+        }
+    }
+}
+
+SCENARIO("State changes by generation") {
+    GIVEN("a session with a dog and loot") {
+        auto map = MakeSquareMap();
+        GameSession session{&map, false, 60000, nullptr};
+        const auto* dog = session.AddDog(Dog{"Rex"s, 3});
+        const size_t dog_id = dog->GetId();
+        session.AddLoot(4, 0, {5., 0.});
+        ChangeSet changes;
+
+        THEN("changes before the first tick belong to the open generation") {
+            CHECK(session.GetGeneration() == 0);
+            REQUIRE(session.GetChangesSince(0, changes));
+            CHECK(changes.dogs == std::vector<size_t>{dog_id});
+            CHECK(changes.loot == std::vector<unsigned>{4});
+        }
+
+        WHEN("the session ticks with nothing moving") {
+            session.Tick(100, 0);
+
+            THEN("the generation grows and nothing changed since it") {
+                CHECK(session.GetGeneration() == 1);
+                REQUIRE(session.GetChangesSince(1, changes));
+                CHECK(changes.Empty());
+            }
+        }
+
+        WHEN("the dog runs over the loot") {
+            session.Tick(100, 0);
+            session.QueueAction({dog_id, Direction::EAST});
+            session.Tick(6000, 0);
+
+            THEN("the dog is changed and the loot is removed") {
+                REQUIRE(session.GetChangesSince(1, changes));
+                CHECK(changes.dogs == std::vector<size_t>{dog_id});
+                CHECK(changes.removed_loot == std::vector<unsigned>{4});
+                CHECK(changes.loot.empty());
+            }
+
+            THEN("loot spawned and collected within the range is only removed") {
+                REQUIRE(session.GetChangesSince(0, changes));
+                CHECK(changes.loot.empty());
+                CHECK(changes.removed_loot == std::vector<unsigned>{4});
+            }
+        }
+
+        WHEN("more generations pass than the ring keeps") {
+            for (size_t i = 0; i <= ChangeLog::CAPACITY; ++i) {
+                session.Tick(1, 0);
+            }
+
+            THEN("old and future generations are not covered") {
+                CHECK_FALSE(session.GetChangesSince(0, changes));
+                CHECK(session.GetChangesSince(1, changes));
+                CHECK_FALSE(session.GetChangesSince(session.GetGeneration() + 1, changes));
+            }
+        }
+    }
+}
+
+SCENARIO("State delta body") {
+    GIVEN("a session with a dog and loot") {
+        auto map = MakeSquareMap();
+        GameSession session{&map, false, 60000, nullptr};
+        auto* dog = session.AddDog(Dog{"Rex"s, 3});
+        dog->TakeLoot({7, 1});
+        session.AddLoot(4, 0, {0.5, 0.});
+        session.QueueAction({static_cast<size_t>(dog->GetId()), Direction::EAST});
+        session.Tick(0, 0);
+        boost::beast::flat_buffer buffer;
+
+        WHEN("a delta is written") {
+            ChangeSet changes{ {static_cast<size_t>(dog->GetId())}, {3}, {4}, {5, 6} };
+            json_writer::WriteStateDelta(buffer, session, changes);
+
+            THEN("it lists changed and removed dogs and loot") {
+                CHECK(ToString(buffer) == R"({"type":"delta","generation":1,"players":{")"s + std::to_string(dog->GetId())
+                    + R"(":{"pos":[0.0,0.0],"speed":[1.0,0.0],"dir":"R","bag":[{"id":7,"type":1}],"score":0}},)"
+                    + R"("removedPlayers":[3],"lostObjects":{"4":{"type":0,"pos":[0.5,0.0]}},"removedObjects":[5,6]})");
+            }
+        }
+
+        WHEN("an empty delta is written") {
+            json_writer::WriteStateDelta(buffer, session, ChangeSet{});
+
+            THEN("all fields are present") {
+                CHECK(ToString(buffer) == R"({"type":"delta","generation":1,"players":{},"removedPlayers":[],"lostObjects":{},"removedObjects":[]})"s);
+            }
+        }
+    }
+}
+
+SCENARIO("MessagePack state body") {
+    GIVEN("a session with dogs, bags and loot") {
+        auto map = MakeSquareMap();
+        GameSession session{&map, true, 60000, nullptr};
+        FillSession(session, 20);
+        session.AddDog(Dog{"Rex"s, 3})->TakeLoot({300, 2});
+        boost::beast::flat_buffer json;
+        boost::beast::flat_buffer msgpack;
+        std::string decoded;
+
+        WHEN("the state and players are packed") {
+            json_writer::WriteState(json, session.GetDogs(), session);
+            msgpack_writer::WriteState(msgpack, session.GetDogs(), session);
+            boost::beast::flat_buffer json_players;
+            boost::beast::flat_buffer msgpack_players;
+            json_writer::WritePlayers(json_players, session.GetDogs());
+            msgpack_writer::WritePlayers(msgpack_players, session.GetDogs());
+
+            THEN("they decode to the same JSON") {
+                REQUIRE(msgpack_reader::ToJson(ToString(msgpack), decoded));
+                CHECK(decoded == ToString(json));
+                REQUIRE(msgpack_reader::ToJson(ToString(msgpack_players), decoded));
+                CHECK(decoded == ToString(json_players));
+            }
+
+            THEN("they are smaller than JSON") {
+                CHECK(msgpack.size() < json.size());
+            }
+
+            THEN("a truncated body is rejected") {
+                auto body = ToString(msgpack);
+                CHECK_FALSE(msgpack_reader::ToJson(std::string_view(body).substr(0, body.size() - 1), decoded));
+                CHECK_FALSE(msgpack_reader::ToJson(body + '\0', decoded));
+            }
+        }
+
+        WHEN("a snapshot and a delta are packed") {
+            ChangeSet changes{ {0, 5, 1000}, {7}, {0, 1, 2000}, {3} };
+            boost::beast::flat_buffer json_delta;
+            boost::beast::flat_buffer msgpack_delta;
+            json_writer::WriteStateSnapshot(json, session);
+            json_writer::WriteStateDelta(json_delta, session, changes);
+            msgpack_writer::WriteStateSnapshot(msgpack, session);
+            msgpack_writer::WriteStateDelta(msgpack_delta, session, changes);
+
+            THEN("each decodes to its JSON body") {
+                REQUIRE(msgpack_reader::ToJson(ToString(msgpack), decoded));
+                CHECK(decoded == ToString(json));
+                REQUIRE(msgpack_reader::ToJson(ToString(msgpack_delta), decoded));
+                CHECK(decoded == ToString(json_delta));
+            }
+        }
+    }
+
+    GIVEN("a packer") {
+        boost::beast::flat_buffer msgpack;
+        msgpack_writer::Packer packer{msgpack};
+        std::string decoded;
+
+        WHEN("values of every width are packed") {
+            packer.ArrayHeader(17);
+            packer.Uint(127).Uint(255).Uint(65535).Uint(4294967295).Uint(4294967296);
+            packer.Int(-32).Int(-128).Int(-32768).Int(-2147483648LL).Int(-2147483649LL);
+            packer.Double(0.1).Nil().Bool(true).String("");
+            packer.String(std::string(31, 'a')).String(std::string(255, 'b')).String(std::string(70000, 'c'));
+            packer.Flush();
+
+            THEN("they read back unchanged") {
+                REQUIRE(msgpack_reader::ToJson(ToString(msgpack), decoded));
+                CHECK(decoded == "[127,255,65535,4294967295,4294967296,-32,-128,-32768,-2147483648,-2147483649,0.1,null,true,\"\","s
+                    + '"' + std::string(31, 'a') + "\",\"" + std::string(255, 'b') + "\",\"" + std::string(70000, 'c') + "\"]");
+            }
+        }
+
+        WHEN("a map has more than 15 entries") {
+            packer.MapHeader(16);
+            for (int i = 0; i < 16; ++i) {
+                packer.Int(-i).ArrayHeader(0);
+            }
+            packer.Flush();
+
+            THEN("integer keys become strings") {
+                REQUIRE(msgpack_reader::ToJson(ToString(msgpack), decoded));
+                CHECK(decoded.starts_with(R"({"0":[],"-1":[],"-2":[])"));
+                CHECK(decoded.ends_with(R"("-15":[]})"));
+            }
+        }
+    }
+}
+
+SCENARIO("Gzip compression") {
+    GIVEN("a compressor") {
+        compression::GzipCompressor compressor;
+        boost::beast::flat_buffer buffer;
+        std::string decompressed;
+
+        WHEN("several bodies are compressed one after another") {
+            std::string first(5000, 'a');
+            std::string second = "{\"players\":{}}"s;
+            compressor.Compress(first, buffer);
+            auto first_size = buffer.size();
+            compressor.Compress(second, buffer);
+            auto data = ToString(buffer);
+
+            THEN("each one is a separate gzip stream") {
+                CHECK(first_size < first.size());
+                REQUIRE(compression::Decompress(std::string_view(data).substr(0, first_size), decompressed));
+                CHECK(decompressed == first);
+                REQUIRE(compression::Decompress(std::string_view(data).substr(first_size), decompressed));
+                CHECK(decompressed == second);
+            }
+
+            THEN("a truncated stream is rejected") {
+                CHECK_FALSE(compression::Decompress(std::string_view(data).substr(0, first_size - 1), decompressed));
+            }
+        }
+    }
+}
+
+SCENARIO("Record and replay") {
+    namespace fs = std::filesystem;
+    constexpr std::uint64_t SEED = 77;
+
+    auto make_app = [](std::uint64_t seed) {
+        Game game{loot_gen::LootGenerator{1s, 0.5}, 3000};
+        auto map = MakeSquareMap();
+        map.SetLootValues({{0, 5}});
+        game.AddMap(map);
+        return app::Application{std::move(game), true, std::make_shared<NullStatSaver>(), seed};
+    };
+
+    GIVEN("a recorded seeded game") {
+        const auto path = fs::temp_directory_path() / "game_record_test.bin";
+        std::uint64_t recorded_checksum = 0;
+        {
+            auto recorded = make_app(SEED);
+            recorded.SetInputListener(std::make_shared<replay::Recorder>(path, replay::Header{SEED, true}));
+            std::mt19937 random{3};
+            std::vector<app::Token> tokens;
+            for (int tick = 0; tick < 2000; ++tick) {
+                if (random() % 25 == 0) {
+                    auto* session = recorded.FindSession(Map::Id{"square"s});
+                    tokens.push_back(recorded.AddPlayer(Dog{"Dog"s, 3}, session).GetToken());
+                }
+                for (int i = 0; i < 3 && !tokens.empty(); ++i) {
+                    const int move = random() % 5;
+                    recorded.QueueAction(tokens[random() % tokens.size()],
+                                         move == 4 ? std::nullopt : std::optional{static_cast<Direction>(move)});
+                }
+                recorded.Tick(10 + random() % 90);
+            }
+            recorded_checksum = replay::StateChecksum(recorded);
+        }
+
+        WHEN("it is replayed") {
+            replay::Reader reader{path};
+            auto replayed = make_app(reader.GetHeader().seed);
+            auto stats = replay::Replay(reader, replayed);
+
+            THEN("the game ends in the same state") {
+                CHECK(reader.GetHeader().seed == SEED);
+                CHECK(reader.GetHeader().randomize_spawn);
+                CHECK(stats.ticks == 2000);
+                CHECK(stats.joins > 0);
+                CHECK(stats.actions > 0);
+                CHECK(replay::StateChecksum(replayed) == recorded_checksum);
+            }
+        }
+
+        WHEN("the record is cut") {
+            fs::resize_file(path, fs::file_size(path) - 1);
+            replay::Reader reader{path};
+            auto replayed = make_app(SEED);
+
+            THEN("replay reports it") {
+                CHECK_THROWS_AS(replay::Replay(reader, replayed), std::runtime_error);
+            }
+        }
+    }
+
+    GIVEN("a file which isn't a record") {
+        const auto path = fs::temp_directory_path() / "game_record_test.txt";
+        std::ofstream(path) << "not a record";
+
+        THEN("it is rejected") {
+            CHECK_THROWS_AS(replay::Reader{path}, std::runtime_error);
+        }
+    }
+}
+
+SCENARIO("Map sharding") {
+    GIVEN("two shards") {
+        router::Directory directory{{router::ParseShard("127.0.0.1:8081=map1,map2"sv), router::ParseShard("localhost:8082=town"sv)}};
+
+        THEN("maps and tokens find their shards") {
+            CHECK(directory.GetShardsCount() == 2);
+            CHECK(directory.GetShard(0).port == "8081"s);
+            CHECK(directory.GetShard(1).host == "localhost"s);
+            CHECK(directory.FindByMap("map2"sv) == 0);
+            CHECK(directory.FindByMap("town"sv) == 1);
+            CHECK_FALSE(directory.FindByMap("map3"sv));
+            CHECK(directory.FindByAuthorization("Bearer 01"s + std::string(30, 'f')) == 1);
+            CHECK_FALSE(directory.FindByAuthorization("Bearer 02"s + std::string(30, 'f')));
+            CHECK_FALSE(directory.FindByAuthorization("Bearer 0"sv));
+            CHECK_FALSE(directory.FindByAuthorization("Basic 00"sv));
+        }
+
+        THEN("wrong configurations are rejected") {
+            CHECK_THROWS_AS(router::ParseShard("127.0.0.1=map1"sv), std::invalid_argument);
+            CHECK_THROWS_AS(router::ParseShard("127.0.0.1:8081="sv), std::invalid_argument);
+            CHECK_THROWS_AS(router::Directory({router::ParseShard("a:1=map1"sv), router::ParseShard("b:2=map1"sv)}), std::invalid_argument);
+            CHECK_THROWS_AS(router::MakeTokenPrefix(router::MAX_SHARDS), std::out_of_range);
+        }
+    }
+
+    THEN("requests are classified by their targets") {
+        CHECK(router::Classify("/api/v1/maps"sv).kind == router::RouteKind::MAPS);
+        auto map = router::Classify("/api/v1/maps/town"sv);
+        CHECK(map.kind == router::RouteKind::MAP);
+        CHECK(map.map_id == "town"sv);
+        CHECK(router::Classify("/api/v1/game/records?start=5"sv).kind == router::RouteKind::RECORDS);
+        CHECK(router::Classify("/api/v1/game/join"sv).kind == router::RouteKind::JOIN);
+        CHECK(router::Classify("/api/v1/game/tick"sv).kind == router::RouteKind::TICK);
+        CHECK(router::Classify("/api/v1/game/state"sv).kind == router::RouteKind::PLAYER);
+        CHECK(router::Classify("/api/v1/game/player/action"sv).kind == router::RouteKind::PLAYER);
+        CHECK(router::Classify("/api/v1/metrics"sv).kind == router::RouteKind::FIRST_SHARD);
+        CHECK(router::Classify("/index.html"sv).kind == router::RouteKind::FIRST_SHARD);
+
+        size_t start = 0;
+        size_t max_items = 0;
+        CHECK(router::ParseRecordsQuery("/api/v1/game/records?maxItems=7&start=3"sv, start, max_items));
+        CHECK(start == 3);
+        CHECK(max_items == 7);
+        CHECK_FALSE(router::ParseRecordsQuery("/api/v1/game/records?maxItems=101"sv, start, max_items));
+        CHECK_FALSE(router::ParseRecordsQuery("/api/v1/game/records?start=x"sv, start, max_items));
+    }
+
+    GIVEN("a shard of a game with two maps") {
+        Game game{loot_gen::LootGenerator{1s, 0.5}, 3000};
+        auto square = MakeSquareMap();
+        game.AddMap(square);
+        game.AddMap(Map{Map::Id{"other"s}, "Other"s, 3});
+        CHECK_THROWS_AS(game.KeepMaps({Map::Id{"unknown"s}}), std::invalid_argument);
+        game.KeepMaps({Map::Id{"square"s}});
+        app::Application app{std::move(game), false, std::make_shared<NullStatSaver>()};
+        app.SetTokenPrefix(router::MakeTokenPrefix(26));
+
+        THEN("it keeps its map and marks tokens with its index") {
+            CHECK(app.FindSession(Map::Id{"square"s}));
+            CHECK_FALSE(app.FindSession(Map::Id{"other"s}));
+            auto token = *app.AddPlayer(Dog{"Dog"s, 3}, app.FindSession(Map::Id{"square"s})).GetToken();
+            CHECK(token.size() == 32);
+            CHECK(token.starts_with("1a"sv));
+        }
+    }
+
+    GIVEN("records of two shards") {
+        std::vector<router::Record> records;
+        REQUIRE(router::ReadRecords(R"([{"name":"b","score":10,"playTime":2.5},{"name":"c","score":3,"playTime":1}])"sv, records));
+        REQUIRE(router::ReadRecords(R"([{"name":"a","score":10,"playTime":1.5},{"name":"d","score":10,"playTime":2.5}])"sv, records));
+        CHECK_FALSE(router::ReadRecords(R"([{"name":"a"}])"sv, records));
+
+        THEN("they are merged in the leaderboard order") {
+            CHECK(router::MergeRecords(records, 0, 10)
+                  == R"([{"name":"a","score":10,"playTime":1.5},{"name":"b","score":10,"playTime":2.5},{"name":"d","score":10,"playTime":2.5},{"name":"c","score":3,"playTime":1}])"s);
+            CHECK(router::MergeRecords(records, 1, 2)
+                  == R"([{"name":"b","score":10,"playTime":2.5},{"name":"d","score":10,"playTime":2.5}])"s);
+            CHECK(router::MergeRecords(records, 5, 2) == "[]"s);
+        }
+    }
+
+    THEN("map lists are joined") {
+        std::string maps;
+        CHECK(router::JoinArrays({R"([{"id":"map1"}, {"id":"map2"}])"s, "[]"s, R"([{"id":"town"}])"s}, maps));
+        CHECK(maps == R"([{"id":"map1"},{"id":"map2"},{"id":"town"}])"s);
+        CHECK_FALSE(router::JoinArrays({R"({"id":"map1"})"s}, maps));
+    }
+}
+
+SCENARIO("Static store") {
+    GIVEN("a directory with text and random files") {
+        namespace fs = std::filesystem;
+        auto root = fs::temp_directory_path() / "static_store_test";
+        fs::remove_all(root);
+        fs::create_directories(root / "js");
+        std::string text;
+        for (int i = 0; i < 200; ++i) {
+            text += "<p>line "s + std::to_string(i) + "</p>\n";
+        }
+        std::string noise(4096, '\0');
+        std::mt19937 random;
+        std::ranges::generate(noise, [&random] { return static_cast<char>(random()); });
+        std::ofstream(root / "index.html", std::ios::binary) << text;
+        std::ofstream(root / "js" / "noise.bin", std::ios::binary) << noise;
+        std::ofstream(root / "big.txt", std::ios::binary) << std::string(6000, 'x');
+
+        WHEN("the store is loaded") {
+            static_store::StaticStore store{root, 5000};
+
+            THEN("files are found by their path") {
+                CHECK(store.GetFilesCount() == 3);
+                REQUIRE(store.Find("/index.html"sv));
+                CHECK(store.Find("/index.html"sv)->data == text);
+                REQUIRE(store.Find("/js/noise.bin"sv));
+                CHECK(store.Find("/js/noise.bin"sv)->data == noise);
+                CHECK_FALSE(store.Find("index.html"sv));
+            }
+
+            THEN("large files are mapped and never compressed") {
+                REQUIRE(store.Find("/big.txt"sv));
+                CHECK(store.Find("/big.txt"sv)->data == std::string(6000, 'x'));
+                CHECK(store.Find("/big.txt"sv)->gzip.empty());
+            }
+
+            AND_WHEN("a mapped file is rewritten on disk") {
+                std::ofstream(root / "big.txt", std::ios::binary | std::ios::trunc) << std::string(5500, 'y');
+
+                THEN("the store stops serving it") {
+                    CHECK_FALSE(store.Find("/big.txt"sv));
+                    CHECK(store.Find("/index.html"sv));
+                }
+            }
+
+            THEN("only files which shrink keep a gzip variant with its own ETag") {
+                const auto* index = store.Find("/index.html"sv);
+                std::string decompressed;
+                REQUIRE(compression::Decompress(index->gzip, decompressed));
+                CHECK(decompressed == text);
+                CHECK(index->etag.starts_with('"'));
+                CHECK(index->gzip_etag != index->etag);
+                CHECK(index->last_modified.ends_with(" GMT"sv));
+                CHECK(store.Find("/js/noise.bin"sv)->gzip.empty());
+            }
+        }
+        fs::remove_all(root);
+    }
+}
+
+SCENARIO("Static file validators and ranges") {
+    using static_store::RangeStatus;
+    static_store::ByteRange range;
+
+    WHEN("a single range is asked") {
+        THEN("it is clamped to the file size") {
+            REQUIRE(static_store::ParseRange("bytes=10-19"sv, 100, range) == RangeStatus::PARTIAL);
+            CHECK((range.offset == 10 && range.length == 10));
+            REQUIRE(static_store::ParseRange("bytes=90-"sv, 100, range) == RangeStatus::PARTIAL);
+            CHECK((range.offset == 90 && range.length == 10));
+            REQUIRE(static_store::ParseRange("bytes=95-200"sv, 100, range) == RangeStatus::PARTIAL);
+            CHECK((range.offset == 95 && range.length == 5));
+            REQUIRE(static_store::ParseRange("bytes=-30"sv, 100, range) == RangeStatus::PARTIAL);
+            CHECK((range.offset == 70 && range.length == 30));
+            REQUIRE(static_store::ParseRange("bytes=-300"sv, 100, range) == RangeStatus::PARTIAL);
+            CHECK((range.offset == 0 && range.length == 100));
+        }
+
+        THEN("a range past the end is unsatisfiable") {
+            CHECK(static_store::ParseRange("bytes=100-"sv, 100, range) == RangeStatus::UNSATISFIABLE);
+            CHECK(static_store::ParseRange("bytes=-0"sv, 100, range) == RangeStatus::UNSATISFIABLE);
+            CHECK(static_store::ParseRange("bytes=0-"sv, 0, range) == RangeStatus::UNSATISFIABLE);
+        }
+    }
+
+    WHEN("the header is malformed or has several ranges") {
+        THEN("the whole file is sent") {
+            CHECK(static_store::ParseRange(""sv, 100, range) == RangeStatus::WHOLE);
+            CHECK(static_store::ParseRange("bytes=0-1,5-6"sv, 100, range) == RangeStatus::WHOLE);
+            CHECK(static_store::ParseRange("bytes=5-1"sv, 100, range) == RangeStatus::WHOLE);
+            CHECK(static_store::ParseRange("items=0-1"sv, 100, range) == RangeStatus::WHOLE);
+            CHECK(static_store::ParseRange("bytes=a-1"sv, 100, range) == RangeStatus::WHOLE);
+        }
+    }
+
+    WHEN("If-None-Match is compared with an ETag") {
+        THEN("weak tags, lists and * match") {
+            CHECK(static_store::MatchesETag(R"("1a-5f")"sv, R"("1a-5f")"sv));
+            CHECK(static_store::MatchesETag(R"("x", W/"1a-5f")"sv, R"("1a-5f")"sv));
+            CHECK(static_store::MatchesETag("*"sv, R"("1a-5f")"sv));
+            CHECK_FALSE(static_store::MatchesETag(R"("1a-5f-gz")"sv, R"("1a-5f")"sv));
+        }
+    }
+}
+
+SCENARIO("State response body benchmark", "[.benchmark]") {
+    auto map = MakeSquareMap();
+    GameSession session{&map, true, 60000, nullptr};
+    FillSession(session, 1000);
+
+    BENCHMARK("json::serialize of a DOM, 1k dogs") {
+        return boost::json::serialize(StateToJsonDom(session));
+    };
+
+    BENCHMARK("json_writer into flat_buffer, 1k dogs") {
+        boost::beast::flat_buffer buffer;
+        json_writer::WriteState(buffer, session.GetDogs(), session);
+        return buffer.size();
+    };
+}
+
+SCENARIO("Players registry contention benchmark", "[.benchmark]") {
+    constexpr size_t PLAYERS_COUNT = 1'000'000;
+    constexpr int THREADS_COUNT = 64;
+    constexpr int LOOKUPS_PER_THREAD = 10'000;
+
+    auto map = MakeSquareMap();
+    GameSession session{&map, false, 60000, nullptr};
+    app::Players players;
+    // Reference: one shared_mutex over the whole registry, as before sharding
+    std::shared_mutex single_mutex;
+    std::unordered_map<app::Token, size_t, util::TaggedHasher<app::Token>> single;
+    std::vector<app::Token> tokens;
+    tokens.reserve(PLAYERS_COUNT);
+    for (size_t i = 0; i < PLAYERS_COUNT; ++i) {
+        auto& player = players.AddPlayer(Dog{"Dog"s, 3}, &session);
+        tokens.push_back(player.GetToken());
+        single.emplace(player.GetToken(), player.GetId());
+    }
+
+    auto authenticate = [&tokens](auto&& has_player) {
+        std::atomic<size_t> found = 0;
+        std::vector<std::jthread> threads;
+        for (int t = 0; t < THREADS_COUNT; ++t) {
+            threads.emplace_back([&, t] {
+                std::mt19937_64 random(t);
+                size_t thread_found = 0;
+                for (int i = 0; i < LOOKUPS_PER_THREAD; ++i) {
+                    thread_found += has_player(tokens[random() % tokens.size()]);
+                }
+                found += thread_found;
+            });
+        }
+        threads.clear();
+        return found.load();
+    };
+
+    BENCHMARK("one shared_mutex, 64 threads, 1M tokens") {
+        return authenticate([&](const app::Token& token) {
+            std::shared_lock lock{ single_mutex };
+            return single.contains(token);
+        });
+    };
+
+    BENCHMARK("64 shards, 64 threads, 1M tokens") {
+        return authenticate([&](const app::Token& token) {
+            return players.HasPlayer(token);
+        });
+    };
+}
+
+SCENARIO("Entity churn benchmark", "[.benchmark]") {
+    constexpr int PLAYERS_COUNT = 10'000;
+    constexpr unsigned RETIREMENT_TIME = 1000;
+
+    auto map = MakeSquareMap();
+    GameSession session{&map, false, RETIREMENT_TIME, std::make_shared<NullStatSaver>()};
+    app::Players players;
+
+    BENCHMARK("10k players join and retire") {
+        for (int i = 0; i < PLAYERS_COUNT; ++i) {
+            players.AddPlayer(Dog{"Dog"s, 3}, &session);
+        }
+        auto retired = session.Tick(RETIREMENT_TIME, 0);
+        players.RemovePlayers(std::vector<size_t>(retired.begin(), retired.end()));
+        return retired.size();
+    };
+
+    for (int i = 0; i < PLAYERS_COUNT; ++i) {
+        players.AddPlayer(Dog{"Dog"s, 3}, &session);
+    }
+
+    BENCHMARK("tick over 10k dogs") {
+        return session.Tick(0, 0).size();
+    };
+}
+
+SCENARIO("Loot generation benchmark", "[.benchmark]") {
+    using loot_gen::LootGenerator;
+    constexpr size_t SESSIONS = 1000;
+
+    std::vector<unsigned> loot(SESSIONS, 1);
+    std::vector<unsigned> looters(SESSIONS, 50);
+    std::vector<unsigned> generated(SESSIONS);
+    LootGenerator scalar{5s, 0.01};
+    loot_gen::BatchLootGenerator batch{5s, 0.01};
+    batch.Resize(SESSIONS);
+
+    BENCHMARK("scalar generator, 1000 sessions") {
+        for (size_t i = 0; i < SESSIONS; ++i) {
+            generated[i] = scalar.Generate(LootGenerator::TimeInterval{1}, loot[i], looters[i]);
+        }
+        return generated[0];
+    };
+
+    BENCHMARK("batch generator, 1000 sessions") {
+        batch.Generate(LootGenerator::TimeInterval{1}, loot, looters, generated);
+        return generated[0];
+    };
+}
@@ -0,0 +1,105 @@
+#include <benchmark/benchmark.h>
+#include <random>
+#include <string>
+
+#include "../src/model.h"
+
+/*
+ *  Замеры GameSession::Tick на синтетических картах, без сети и базы данных.
+ *  Карта - сетка дорог, офисы стоят на перекрёстках, собаки ходят по случайным командам,
+ *  трофеи досыпаются до заданной плотности. Время фаз тика выводится в счётчиках
+ *  в микросекундах на тик. Результаты в JSON для сравнения между сборками:
+ *      game_bench --benchmark_out=tick.json --benchmark_out_format=json
+ */
+
+using namespace std::literals;
+
+namespace {
+
+constexpr int ROAD_SPACING = 10;
+constexpr unsigned TICK_DELTA = 50;
+constexpr std::uint64_t SEED = 42;
+
+struct NullStatSaver : model::StatSaver {
+    void Save(const std::vector<model::SaveStat>&) override {
+    }
+};
+
+// grid x grid кварталов, offices офисов на перекрёстках по порядку
+model::Map MakeGridMap(int grid, int offices) {
+    model::Map map{ model::Map::Id{"grid"s}, "Grid"s, 3 };
+    map.SetSpeed(4.);
+    map.SetLootTypesCount(3);
+    map.SetLootValues({ {0, 10}, {1, 20}, {2, 30} });
+    const int size = grid * ROAD_SPACING;
+    for (int i = 0; i <= grid; ++i) {
+        map.AddRoad({ model::Road::HORIZONTAL, {0, i * ROAD_SPACING}, size });
+        map.AddRoad({ model::Road::VERTICAL, {i * ROAD_SPACING, 0}, size });
+    }
+    for (int i = 0; i < offices; ++i) {
+        model::Point position{ (i % (grid + 1)) * ROAD_SPACING, (i / (grid + 1) % (grid + 1)) * ROAD_SPACING };
+        map.AddOffice(model::Office{ model::Office::Id{"o"s + std::to_string(i)}, position, {0, 0} });
+    }
+    return map;
+}
+
+// range(0) - размер сетки, range(1) - собак, range(2) - трофеев на 10 собак, range(3) - офисов
+void BM_SessionTick(benchmark::State& state) {
+    const int grid = static_cast<int>(state.range(0));
+    const int dogs = static_cast<int>(state.range(1));
+    const unsigned target_loot = static_cast<unsigned>(dogs * state.range(2) / 10);
+    auto map = MakeGridMap(grid, static_cast<int>(state.range(3)));
+    model::GameSession session{ &map, true, 60000, std::make_shared<NullStatSaver>(), SEED };
+    std::vector<size_t> dog_ids;
+    dog_ids.reserve(dogs);
+    for (int i = 0; i < dogs; ++i) {
+        dog_ids.push_back(session.AddDog(model::Dog{ "Dog"s, 3 })->GetId());
+    }
+
+    std::mt19937_64 random{ SEED };
+    auto tick = [&] {
+        // Каждая десятая собака меняет направление или останавливается
+        for (size_t i = random() % 10; i < dog_ids.size(); i += 10) {
+            const int move = random() % 5;
+            session.QueueAction({ dog_ids[i], move == 4 ? std::nullopt : std::optional{ static_cast<model::Direction>(move) } });
+        }
+        const unsigned loot = session.GetLootCount();
+        session.Tick(TICK_DELTA, loot < target_loot ? target_loot - loot : 0);
+    };
+    // Разгон до установившейся плотности трофеев
+    for (int i = 0; i < 20; ++i) {
+        tick();
+    }
+
+    model::TickProfile profile;
+    session.SetTickProfile(&profile);
+    for (auto _ : state) {
+        tick();
+    }
+    session.SetTickProfile(nullptr);
+
+    auto per_tick_us = [&profile](model::TickProfile::Duration phase) {
+        return benchmark::Counter(std::chrono::duration<double, std::micro>(phase).count() / std::max<size_t>(profile.ticks, 1));
+    };
+    state.counters["actions_us"] = per_tick_us(profile.actions);
+    state.counters["movement_us"] = per_tick_us(profile.movement);
+    state.counters["collision_us"] = per_tick_us(profile.collision);
+    state.counters["events_us"] = per_tick_us(profile.events);
+    state.counters["spawn_us"] = per_tick_us(profile.spawn);
+    state.counters["afk_us"] = per_tick_us(profile.afk);
+    state.counters["loot"] = session.GetLootCount();
+}
+
+BENCHMARK(BM_SessionTick)
+    ->ArgNames({ "grid", "dogs", "loot_per_10", "offices" })
+    ->Args({ 4, 10, 10, 2 })
+    ->Args({ 10, 100, 10, 5 })
+    ->Args({ 10, 1000, 10, 5 })
+    ->Args({ 30, 1000, 10, 50 })
+    ->Args({ 30, 1000, 50, 50 })
+    ->Args({ 50, 5000, 10, 100 })
+    ->Unit(benchmark::kMicrosecond);
+
+}  // namespace
+
+BENCHMARK_MAIN();